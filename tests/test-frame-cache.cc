@@ -0,0 +1,95 @@
+#include <iostream>
+#include <vex/FrameCache.h>
+
+#define DUMP(x) std::cout  << #x << " = " << (x) << "\n"
+
+static BLImage
+make_image(int w, int h)
+{
+  BLImage img(w, h, BL_FORMAT_PRGB32) ;
+  BLContext ctx(img) ;
+  ctx.setFillStyle( BLRgba32(0xFF808080) ) ;
+  ctx.fillAll() ;
+  ctx.end() ;
+  return img ;
+}
+
+// Print the pts of the frames of input 0 at level 0 found in the cache.
+static void
+dump_content(const char *name, const FrameCache &cache)
+{
+  std::cout << name << " =" ;
+  for (int64_t pts=0 ; pts<10 ; pts++) {
+    if ( cache.contains( FrameCache::Key{0, pts} ) )
+      std::cout << " " << pts ;
+  }
+  std::cout << "  (" << cache.size() << " frames, " << cache.bytes() << " bytes)\n" ;
+}
+
+static void
+dump_stats(const FrameCache &cache)
+{
+  FrameCache::Stats st = cache.stats() ;
+  std::cout << "hits=" << st.hits << " proxy_hits=" << st.proxy_hits
+            << " misses=" << st.misses << " evictions=" << st.evictions << "\n" ;
+}
+
+int
+main(void)
+{
+  // A 64x64 PRGB32 image uses 16384 bytes
+  const size_t IMG = 64*64*4 ;
+  BLImage img = make_image(64, 64) ;
+
+  std::cout << "== LRU order\n" ;
+  FrameCache cache(3*IMG) ;
+  for (int64_t pts=0 ; pts<3 ; pts++)
+    cache.putImage( FrameCache::Key{0, pts}, img ) ;
+  dump_content("0,1,2", cache) ;
+
+  // 0 becomes the most recent so 1 is evicted by 3
+  BLImage out ;
+  DUMP( cache.getImage( FrameCache::Key{0, 0}, out ) ) ;
+  cache.putImage( FrameCache::Key{0, 3}, img ) ;
+  dump_content("0,2,3", cache) ;
+
+  // contains() does not change the order so 2 is evicted by 4
+  DUMP( cache.contains( FrameCache::Key{0, 2} ) ) ;
+  cache.putImage( FrameCache::Key{0, 4}, img ) ;
+  dump_content("0,3,4", cache) ;
+
+  // Replacing an entry does not change the number of bytes
+  cache.putImage( FrameCache::Key{0, 3}, img ) ;
+  dump_content("0,3,4", cache) ;
+  dump_stats(cache) ;
+
+  std::cout << "== evict under budget\n" ;
+  cache.setBudget(IMG + IMG/2) ;
+  dump_content("3", cache) ;
+  DUMP( (cache.bytes() <= cache.budget()) ) ;
+
+  // The most recent frame is kept even if it exceeds the budget
+  cache.putImage( FrameCache::Key{0, 5}, make_image(128, 128) ) ;
+  dump_content("5", cache) ;
+
+  // The inputs share the budget so (0,5) is evicted by (1,5)
+  cache.setBudget(4*IMG) ;
+  cache.putImage( FrameCache::Key{1, 5}, img ) ;
+  dump_content("(none of input 0)", cache) ;
+  cache.erase(1) ;
+  dump_content("(empty)", cache) ;
+  dump_stats(cache) ;
+
+  std::cout << "== proxies\n" ;
+  FrameCache::Key key{0, 7} ;
+  cache.putImage( key.proxy(2), FrameCache::downscale(img, 2) ) ;
+  DUMP( cache.getImage(key, out) ) ;
+  DUMP( cache.getImage(key, out, true) ) ;
+  DUMP( out.width() ) ;
+  DUMP( cache.getImage(key.proxy(3), out, true) ) ;
+  cache.putImage( key, img ) ;
+  DUMP( cache.getImage(key, out, true) ) ;
+  DUMP( out.width() ) ;
+  dump_stats(cache) ;
+  return 0 ;
+}
@@ -1,7 +1,15 @@
 #include <optional>
 #include <cassert>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <cstring>
 #include <vex/vex.h>
+#include <vex/PlaybackEngine.h>
+#include <vex/VideoReader.h>
+#include <vex/FrameCache.h>
+#include <vex/ProxyBuilder.h>
 
 namespace col=colors ;
 
@@ -50,11 +58,15 @@ struct AppResources {
   BLFont font3;
   BLFont info_font;
   
-  double fps{0} ;
+  // Also read by the render thread of the playback engine
+  std::atomic<double> fps{0} ;
 
   bool show_fps{false} ;
 
   bool quit{false} ; 
+
+  // The current playing speed (also read by the render thread)
+  std::atomic<double> speed{0} ;
   
   void init() {
     BL_FATAL_DECLARE ;
@@ -73,6 +85,250 @@ struct AppResources {
 } ;
 
 AppResources app ;
+
+//
+// Play a video file at the speed of the player (see -i).
+//
+// Forward, the frames are decoded normally up to 4x and only the
+// keyframes are decoded above. Backward, the frames are provided in
+// reverse order by VideoReaderBase::previousFrame() so they are
+// decoded GOP by GOP.
+//
+// With a PlaybackEngine (-e), prefetch() is its decode stage: the frames
+// are decoded ahead by the decode thread and frameAt() only picks them
+// in the render thread.
+//
+// The converted frames are kept in the global FrameCache (keyed by pts)
+// so playing again a recent part of the video, for instance backward
+// after forward, does not decode it again.
+//
+// With a ProxyBuilder (-p), the player switches to the proxy of the
+// file as soon as it is built. The proxy frames are smaller so they are
+// scaled to the same size and their pts are in another time base so
+// they use another input id in the cache.
+//
+class FootagePlayer : public VideoReaderBase {
+private:
+  FFMpegFrameConverter m_conv ;
+  BLImage    m_image ;          // The current frame (fitted in the window)
+  double     m_time{-1.0} ;     // The time of m_image
+  double     m_last_t{0} ;      // The time of the last update
+  double     m_target{0} ;      // The time searched by run()
+  double     m_start{0} ;       // The start time of the video stream
+  bool       m_backward{false} ;
+  AVFrame *  m_prev{NULL} ;     // The last frame of previousFrame()
+
+  std::mutex                m_mutex ;  // for the decode and render threads
+  std::map<double,FrameCache::Key> m_frames ; // time -> key of the recent frames put in the cache
+  int                       m_input ;  // The input id in the cache
+  std::vector<int>          m_inputs ; // All input ids used in the cache
+
+  int                       m_fw{0} ;  // The size of m_image
+  int                       m_fh{0} ;
+  std::string               m_source ;
+  ProxyBuilder *            m_proxies{NULL} ;
+  std::atomic<bool>         m_proxy{false} ;  // Tell if the proxy is open
+  bool                      m_reopened{false} ;
+
+  static int newInput() {
+    static std::atomic<int> inputs{0} ;
+    return inputs++ ;
+  }
+
+  // Scale the frames of the open file to m_fw x m_fh.
+  void fitFrames() {
+    m_conv = frameScaler(m_fw, m_fh, AV_PIX_FMT_BGRA) ;
+    AVRational tb = videoTimeBase() ;
+    m_start = 0 ;
+    if (m_video_stream->start_time != AV_NOPTS_VALUE)
+      m_start = double(m_video_stream->start_time) * tb.num / tb.den ;
+  }
+
+  // Reopen the player on the proxy if it became ready.
+  //
+  // Reminder: m_mutex must be locked (or no concurrent access)
+  void checkProxy() {
+    if ( !m_proxies || m_proxy || m_proxies->state(m_source) != ProxyBuilder::PROXY_READY )
+      return ;
+    close() ;
+    m_filename = m_proxies->proxyPath(m_source) ;
+    if ( open() && has_video() ) {
+      fitFrames() ;
+      std::cerr << "Using proxy " << m_filename
+                << " (1/" << m_proxies->divisor() << ")\n" ;
+      m_proxy = true ;
+      m_input = newInput() ;
+      m_inputs.push_back(m_input) ;
+    } else {
+      std::cerr << "Failed to open proxy " << m_filename << "\n" ;
+      close() ;
+      m_filename = m_source ;
+      open() ;
+      fitFrames() ;
+      m_proxies = NULL ;
+    }
+    // The decoder is now at the start of the file
+    m_backward = false ;
+    m_prev     = NULL ;
+    m_reopened = true ;
+  }
+
+  double frameTime(AVFrame *frame) {
+    AVRational tb = videoTimeBase() ;
+    return double(frame->pts) * tb.num / tb.den - m_start ;
+  }
+
+  void show(AVFrame *frame) {
+    BLImageData data ;
+    m_image.makeMutable(&data) ;
+    m_conv.convertFrameToPacked(frame, data.pixelData, int(data.stride)) ;
+    m_time = frameTime(frame) ;
+    // Reminder: BLImage is reference counted so the next show() does
+    // not modify the cached frame.
+    FrameCache::Key key{m_input, frame->pts} ;
+    FrameCache::global().putImage(key, m_image) ;
+    m_frames[m_time] = key ;
+    while (m_frames.size() > 256) {
+      // Forget the farthest frame from m_time
+      if ( m_time - m_frames.begin()->first > m_frames.rbegin()->first - m_time )
+        m_frames.erase(m_frames.begin()) ;
+      else
+        m_frames.erase(std::prev(m_frames.end())) ;
+    }
+  }
+
+  // Get the frame displayed at time t from the cache. This is only
+  // possible when the frames before and after t are both known (so
+  // the frame before t is the one displayed at t).
+  bool cached(double t, BLImage &image) {
+    auto next = m_frames.upper_bound(t) ;
+    if ( next == m_frames.begin() || next == m_frames.end() )
+      return false ;
+    auto prev = std::prev(next) ;
+    if ( FrameCache::global().getImage(prev->second, image) )
+      return true ;
+    m_frames.erase(prev) ; // evicted
+    return false ;
+  }
+
+public:
+
+  FootagePlayer(const std::string &filename) :
+    VideoReaderBase(filename),
+    m_input(newInput()),
+    m_inputs{m_input},
+    m_source(filename)
+  {
+    m_trace = false ;
+    m_verbosity = 0 ;
+  }
+
+  ~FootagePlayer() {
+    for (int input : m_inputs)
+      FrameCache::global().erase(input) ;
+  }
+
+  // Open the file and fit its frames in w x h.
+  bool init(int w, int h) {
+    if ( !open() || !has_video() )
+      return false ;
+    double fit = std::min( double(w) / frameWidth(), double(h) / frameHeight() ) ;
+    m_fw = std::max(1, int(fit * frameWidth())) ;
+    m_fh = std::max(1, int(fit * frameHeight())) ;
+    m_image.create(m_fw, m_fh, BL_FORMAT_XRGB32) ;
+    fitFrames() ;
+    return true ;
+  }
+
+  // Request the proxy of the file and use it once it is built. 
+  void useProxies(ProxyBuilder *proxies) {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_proxies = proxies ;
+    m_proxies->request(m_source) ;
+  }
+
+  // Tell if the frames are decoded from the proxy.
+  bool proxy() const { return m_proxy ; }
+
+  double duration() {
+    if (m_format_ctxt->duration == AV_NOPTS_VALUE)
+      return 1e100 ;
+    return double(m_format_ctxt->duration) / AV_TIME_BASE ;
+  }
+
+  // Decode the frame at time t. 
+  void update(double t, double speed) {
+    checkProxy() ;
+    if (speed < 0) {
+      if ( !m_backward || t > m_last_t ) {
+        startBackward(t) ;
+        m_backward = true ;
+        m_reopened = false ;
+        m_prev = NULL ;
+      }
+      setKeyframesOnly( speed < -4.0 ) ;
+      while ( !m_prev || frameTime(m_prev) > t ) {
+        m_prev = previousFrame() ;
+        if (!m_prev)
+          break ; // The start was reached
+      }
+      if ( m_prev && frameTime(m_prev) != m_time )
+        show(m_prev) ;
+    } else {
+      bool fast   = speed > 4.0 ;
+      bool reseek = m_reopened || m_backward || fast != keyframesOnly() || t < m_last_t || t > m_time + 2.0 ;
+      if (reseek) {
+        stopBackward() ;
+        m_backward = false ;
+        m_prev = NULL ;
+        setKeyframesOnly(fast) ;
+        seek_before(m_start + t) ;
+        m_run_state = PSTATE_READ_PACKET ;
+        m_reopened = false ;
+      }
+      if ( reseek || m_time < t ) {
+        m_target = t ;
+        run() ;
+      }
+    }
+    m_last_t = t ;
+  }
+
+  // Decode the frame at time t ahead of its rendering (unless it is
+  // already in the cache).
+  void prefetch(double t, double speed) {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    BLImage image ;
+    if ( !cached(t, image) )
+      update(t, speed) ;
+  }
+
+  // The frame displayed at time t. A cached frame is used when the
+  // frame after t is known (for instance when the decoder went past
+  // t). Otherwise, the frame is decoded now.
+  BLImage frameAt(double t, double speed, bool &keyframes) {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    keyframes = keyframesOnly() ;
+    BLImage image ;
+    if ( cached(t, image) )
+      return image ;
+    update(t, speed) ;
+    return m_image ;
+  }
+
+protected:
+
+  // Keep the first frame at or after the target.
+  virtual run_proceed_t onReceiveVideoFrame(AVFrame *frame) override {
+    if ( frame->pts != AV_NOPTS_VALUE && frameTime(frame) + 1e-6 >= m_target ) {
+      show(frame) ;
+      return RUN_INTERRUPT ;
+    }
+    return RUN_CONTINUE ;
+  }
+} ;
+
+std::unique_ptr<FootagePlayer> footage ;
 std::optional<BLRgba32>  xx;
 inline void
 drawOutline( BLContext &ctx,
@@ -99,8 +355,10 @@ drawOutline( BLContext &ctx,
   ctx.fillUtf8Text(   BLPoint(x,y), font, text);
 }
 
+// Render the frame at time t. The image can be smaller than the window
+// when rendered at a lower scale (see AdaptiveScaler).
 void
-generate_image(BLImage &img, double t)
+generate_image(BLImage &img, double t, double scale=1.0)
 {
   BL_FATAL_DECLARE ;
   
@@ -108,10 +366,14 @@ generate_image(BLImage &img, double t)
   AutoTimer at2 ;
   BLResult err ;
 
-  int W = img.width();
-  int H = img.height();
+  int W = int( img.width()  / scale + 0.5 );
+  int H = int( img.height() / scale + 0.5 );
   
   BLContext ctx(img);
+
+  // Draw at the size W x H (as in VideoCommon::render_image)
+  ctx.scale(scale);
+  ctx.userToMeta();
   
   // ctx.translate(200,200);
 
@@ -192,6 +454,8 @@ generate_image(BLImage &img, double t)
   // Draw frame information
   {
     BLContext ctx(img);
+    ctx.scale(scale);
+    ctx.userToMeta();
 
     if (app.show_fps) 
     {
@@ -199,7 +463,7 @@ generate_image(BLImage &img, double t)
       // Draw FPS
 
       char buffer[20] ;
-      sprintf(buffer,"FPS: %-6.1f", app.fps);  
+      sprintf(buffer,"FPS: %-6.1f", app.fps.load());  
       if (0)
         {
           BLPoint fps_coord(w-120,30) ;
@@ -286,10 +550,78 @@ generate_image(BLImage &img, double t)
   return ;
 }
 
+// Render the frame of the video file (if any) or else the synthetic
+// content.
+void
+render_frame(BLImage &img, double t, double scale=1.0)
+{
+  if (!footage) {
+    generate_image(img, t, scale) ;
+    return ;
+  }
+  
+  bool keyframes ;
+  BLImage frame = footage->frameAt(t, app.speed, keyframes) ;
+  
+  int W = int( img.width()  / scale + 0.5 );
+  int H = int( img.height() / scale + 0.5 );
+  
+  BLContext ctx(img);
+  ctx.scale(scale);
+  ctx.userToMeta();
+  ctx.setCompOp(BL_COMP_OP_SRC_COPY);
+  ctx.setFillStyle(col::Black);
+  ctx.fillAll();
+  ctx.blitImage( BLPoint( (W-frame.width())/2, (H-frame.height())/2 ), frame ) ;
+
+  char buffer[64] ;
+  sprintf(buffer,"%.2fs  x%g%s%s", t, app.speed.load(),
+          keyframes ? " [keyframes]" : "", footage->proxy() ? " [proxy]" : "");  
+  ctx.setCompOp(BL_COMP_OP_SRC_OVER);
+  ctx.setFillStyle(col::Yellow3);
+  ctx.fillUtf8Text( BLPoint(30,30), app.info_font, buffer);
+  ctx.end();
+}
+
 int
 main(int argc, char* args[])
 {  
   BL_FATAL_DECLARE ;
+
+  // -e : render and present with a PlaybackEngine (at 60 fps) instead
+  //      of redrawing whenever the time changes.
+  // -s : display with the window surface (a surface allocation and a
+  //      software blit per frame) instead of a streaming texture.
+  // -a : adapt the render scale to keep the render time of a frame
+  //      below 1/60s. The full scale is restored when paused.
+  // -i FILE : play a video file instead of the synthetic content.
+  // -p DIR  : build a proxy of the video file in DIR and play it once
+  //           it is ready.
+  bool use_engine   = false ;
+  bool use_surface  = false ;
+  bool use_adaptive = false ;
+  const char *input = NULL ;
+  const char *proxy_dir = NULL ;
+  for (int i=1 ; i<argc ; i++) {
+    if ( strcmp(args[i],"-e") == 0 ) {
+      use_engine = true ;
+    } else if ( strcmp(args[i],"-s") == 0 ) {
+      use_surface = true ;
+    } else if ( strcmp(args[i],"-a") == 0 ) {
+      use_adaptive = true ;
+    } else if ( strcmp(args[i],"-i") == 0 && i+1<argc ) {
+      input = args[++i] ;
+    } else if ( strcmp(args[i],"-p") == 0 && i+1<argc ) {
+      proxy_dir = args[++i] ;
+    } else {
+      std::cerr << "Usage: " << args[0] << " [-e] [-s] [-a] [-i FILE [-p DIR]]\n" ;
+      return 1 ;
+    }
+  }
+  if ( use_adaptive && (use_engine || use_surface) ) {
+    std::cerr << "Option -a cannot be combined with -e or -s\n" ;
+    return 1 ;
+  }
   
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     fprintf(stderr, "could not initialize sdl2: %s\n", SDL_GetError());
@@ -311,16 +643,69 @@ main(int argc, char* args[])
                                       );
   assert(win);
   
-  SDL_Surface* win_surface = SDL_GetWindowSurface(win);
-  assert(win_surface);
+  // Reminder: The window surface cannot be used with a renderer.
+  SDL_Surface* win_surface = NULL ;
+  std::unique_ptr<SDLPresenter> presenter ;
+  if (use_surface) {
+    win_surface = SDL_GetWindowSurface(win);
+    assert(win_surface);
+  } else {
+    presenter = std::make_unique<SDLPresenter>(win, w, h) ;
+  }
   
   RealTimeControler rtc ;
   rtc.playAction() ;
+  app.speed = rtc.speed() ;
+
+  std::unique_ptr<ProxyBuilder> proxies ;
+  if (input) {
+    av_log_set_level( AV_LOG_ERROR );
+    footage = std::make_unique<FootagePlayer>(input) ;
+    if ( !footage->init(w,h) ) {
+      std::cerr << "No video in '" << input << "'\n" ;
+      return 1 ;
+    }
+    rtc.setEndTime( footage->duration() ) ;
+    if (proxy_dir) {
+      proxies = std::make_unique<ProxyBuilder>(proxy_dir) ;
+      footage->useProxies( proxies.get() ) ;
+    }
+  }
   
   BLImage image  ; 
   double  image_timestamp = -1.0 ; // when image was generated
   image.create(w,h,BL_FORMAT_XRGB32);
 
+  // In engine mode, the image currently displayed is owned by frame. 
+  std::unique_ptr<PlaybackEngine> engine ;
+  PlaybackEngine::Frame frame ;
+  BLImage *shown = &image ;
+  if (use_engine) {
+    engine = std::make_unique<PlaybackEngine>(w, h, 60, 1,
+                                              [](BLImage &img, const Timestamp &t) {
+                                                render_frame(img, t.eval()) ;
+                                              } ) ;
+    if (footage) {
+      engine->setDecoder( [](const Timestamp &t) {
+                            footage->prefetch(t.eval(), app.speed) ;
+                          } ) ;
+    }
+    engine->start() ;
+    engine->play( rtc.speed() ) ;
+  }
+
+  std::unique_ptr<AdaptiveScaler> scaler ;
+  if (use_adaptive)
+    scaler = std::make_unique<AdaptiveScaler>(1000.0/60) ;
+
+  // Keep the engine clock in sync with rtc
+  auto set_speed = [&](double speed) {
+    rtc.playAction(speed) ;
+    app.speed = rtc.speed() ;
+    if (engine)
+      engine->play( rtc.speed() ) ;
+  } ;
+
   BLImageCodec bmp_codec;
   bmp_codec.findByName("BMP") || bl_fatal ;
 
@@ -343,9 +728,26 @@ main(int argc, char* args[])
   while (!app.quit) {
 
     double tnow = rtc.now();
+
+    bool redraw ;
+    if (engine) {
+      redraw = engine->acquire(frame) ;
+      if (redraw) {
+        shown = &frame.image ;
+        image_timestamp = frame.time.eval() ;
+      }
+    } else {
+      // Render the still frame at full scale
+      if ( scaler && rtc.is_paused() && scaler->scale() < 1.0 ) {
+        scaler->idle() ;
+        image_timestamp = -1.0 ;
+        std::cerr << "render scale = " << scaler->scale() << "\n";
+      }
+      redraw = (tnow != image_timestamp) ;
+    }
    
     // Render and display
-    if (tnow != image_timestamp) {
+    if (redraw) {
       // Update FPS
       {
         Timer::time_point tp1 = Timer::now();
@@ -360,26 +762,57 @@ main(int argc, char* args[])
         fps_id++;
       }
       // 
-      generate_image(image,tnow) ;
-      image_timestamp = tnow ;
-      // Draw in SDL Window
-      SDL_Surface * surf = createSDLSurface(image);
-      SDL_Rect src  = { 0,0,w,h } ;
-      SDL_Rect dest = { std::max( 0, (win_surface->w - w)/2 ) ,
-                        std::max( 0, (win_surface->h - h)/2 ) ,
-                        0, 0
-      } ;      
-      SDL_BlitSurface(surf,
-                      &src,
-                      win_surface,
-                      &dest);
-      SDL_FreeSurface(surf);
-      SDL_UpdateWindowSurface(win);   
+      if (presenter) {
+        if (engine) {
+          presenter->upload(*shown) ;
+        } else {
+          // Draw directly in the texture 
+          double scale = scaler ? scaler->scale() : 1.0 ;
+          BLImage target ;
+          if ( presenter->lock(target, std::max(1, int(w*scale)), std::max(1, int(h*scale))) ) {
+            Timer::time_point t0 = Timer::now() ;
+            render_frame(target,tnow,scale) ;
+            presenter->unlock(target) ;
+            if (scaler) {
+              scaler->measure( elapsed_ms(Timer::now()-t0) ) ;
+              if (scaler->scale() != scale)
+                std::cerr << "render scale = " << scaler->scale() << "\n";
+            }
+          }
+          image_timestamp = tnow ;
+        }
+        presenter->present() ;
+      } else {
+        if (!engine) {
+          render_frame(image,tnow) ;
+          image_timestamp = tnow ;
+        }
+        // Draw in SDL Window
+        SDL_Surface * surf = createSDLSurface(*shown);
+        SDL_Rect src  = { 0,0,w,h } ;
+        SDL_Rect dest = { std::max( 0, (win_surface->w - w)/2 ) ,
+                          std::max( 0, (win_surface->h - h)/2 ) ,
+                          0, 0
+        } ;      
+        SDL_BlitSurface(surf,
+                        &src,
+                        win_surface,
+                        &dest);
+        SDL_FreeSurface(surf);
+        SDL_UpdateWindowSurface(win);   
+      }
     }
 
+    // The texture is write-only so the snapshots are rendered again.
+    auto snapshot = [&]() -> BLImage & {
+      if (presenter && !engine) 
+        render_frame(image, image_timestamp) ;
+      return *shown ;
+    } ;
+
     // Consume all events. 
     SDL_Event ev;
-    int wait_timeout = rtc.is_paused() ? 100 : 0 ;
+    int wait_timeout = rtc.is_paused() ? 100 : (engine ? 1 : 0) ;
     while( SDL_WaitEventTimeout(&ev, wait_timeout)) {
 
       switch( ev.type ){
@@ -390,7 +823,7 @@ main(int argc, char* args[])
         break;
         
       case SDL_WINDOWEVENT:
-        if (ev.window.event == SDL_WINDOWEVENT_RESIZED) {
+        if (ev.window.event == SDL_WINDOWEVENT_RESIZED && !presenter) {
           win_surface = SDL_GetWindowSurface(win);
         }
         break ;
@@ -415,7 +848,7 @@ main(int argc, char* args[])
             double current = std::min( speeds[speed_count-1], rtc.speed() ) ;
             for ( size_t i=1; i<speed_count ; i++) {
               if ( current <= speeds[i] ) {
-                rtc.playAction(speeds[i-1]);
+                set_speed(speeds[i-1]);
                 std::cerr << "speed = " << rtc.speed() << "\n";
                 break; 
               }
@@ -429,7 +862,7 @@ main(int argc, char* args[])
             for ( int i=speed_count-2 ; i>=0 ; i--) {
               if ( current >= speeds[i] ) {
                 std::cerr << "@" << current << " " << i << "\n";
-                rtc.playAction(speeds[i+1]);
+                set_speed(speeds[i+1]);
                 std::cerr << "speed = " << rtc.speed() << "\n";
                 break; 
               }
@@ -443,14 +876,14 @@ main(int argc, char* args[])
             char filename[30] ;
             sprintf(filename,"out-%.3f.bmp", image_timestamp) ;
             std::cout << "Snapshot " << filename << "\n";
-            image.writeToFile(filename, bmp_codec) || bl_fatal ;
+            snapshot().writeToFile(filename, bmp_codec) || bl_fatal ;
           }
           break;
 
         case SDLK_a: // Save a snapshot and open imvr
           {
             //            image.writeToFile("out.bmp", bmp_codec) || bl_fatal ;
-            image.writeToFile("out.bmp", bmp_codec) || bl_fatal ;
+            snapshot().writeToFile("out.bmp", bmp_codec) || bl_fatal ;
             system("imvr -b ff00ff -u nearest_neighbour out.bmp");
           }
           break;
@@ -463,7 +896,7 @@ main(int argc, char* args[])
           break ;
           
         case SDLK_p: // Play/Pause
-          rtc.playAction( rtc.is_paused() ? 1.0 : 0.0 ) ;
+          set_speed( rtc.is_paused() ? 1.0 : 0.0 ) ;
           break;
           
         }
@@ -478,6 +911,19 @@ main(int argc, char* args[])
     }
   }
   
+  if (engine) {
+    engine->stop() ;
+    PlaybackEngine::Stats stats = engine->stats() ;
+    std::cout << "Playback: "
+              << stats.rendered  << " rendered, "
+              << stats.presented << " presented, "
+              << stats.dropped   << " dropped, "
+              << stats.repeated  << " repeated, "
+              << "latency avg=" << stats.latency_avg_ms << "ms max=" << stats.latency_max_ms << "ms\n" ;
+  }
+  
+  presenter.reset() ;
+  footage.reset() ;
   SDL_DestroyWindow(win);
   SDL_Quit();
   return 0;
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <vex/Subtitles.h>
+#include <vex/IntervalTree.h>
+
+static void
+dump_time(const char *str)
+{
+  size_t pos = 0 ;
+  int64_t ms = -1 ;
+  bool ok = SubtitleTrack::parseTime(str, pos, ms) ;
+  std::cout << "parseTime(\"" << str << "\") = " ;
+  if (ok)
+    std::cout << ms << " ms (pos=" << pos << ")\n" ;
+  else
+    std::cout << "failed\n" ;
+}
+
+template <typename T>
+static std::ostream &
+operator<<(std::ostream &out, const std::vector<T> &v)
+{
+  out << "{" ;
+  for (size_t i=0 ; i<v.size() ; i++)
+    out << (i ? ", " : " ") << v[i] ;
+  return out << " }" ;
+}
+
+// Compare IntervalTree::query with a linear search on random intervals.
+static void
+check_tree(size_t n, unsigned seed)
+{
+  srand(seed) ;
+  std::vector<IntervalTree<int,size_t>::Interval> items ;
+  IntervalTree<int,size_t> tree ;
+  for (size_t i=0 ; i<n ; i++) {
+    int start = rand() % 1000 ;
+    int end   = start + 1 + rand() % 100 ;
+    items.push_back( {start, end, i} ) ;
+    tree.add(start, end, i) ;
+  }
+  tree.build() ;
+  size_t errors = 0 ;
+  size_t total = 0 ;
+  for (int point=-10 ; point<1110 ; point++) {
+    std::vector<size_t> found ;
+    tree.query(point, found) ;
+    // ordered by start (the build is a stable sort)
+    std::vector<IntervalTree<int,size_t>::Interval> matches ;
+    for (auto &it : items)
+      if (it.start<=point && point<it.end)
+        matches.push_back(it) ;
+    std::stable_sort(matches.begin(), matches.end(),
+                     [](const IntervalTree<int,size_t>::Interval &a,
+                        const IntervalTree<int,size_t>::Interval &b) { return a.start < b.start; } ) ;
+    std::vector<size_t> expected ;
+    for (auto &it : matches)
+      expected.push_back(it.value) ;
+    if (found != expected)
+      errors++ ;
+    total += found.size() ;
+  }
+  std::cout << "random tree of " << n << " intervals: " << total << " results, errors = " << errors << "\n" ;
+}
+
+int
+main(void)
+{
+  std::cout << "== parseTime\n" ;
+  dump_time("00:01:02,500") ;     // SRT
+  dump_time("00:01:02.500") ;     // WebVTT
+  dump_time("01:02.500") ;        // WebVTT without hours
+  dump_time("1:00:00.000") ;
+  dump_time("  00:00:03,4 --> 00:00:04,000") ;
+  dump_time("00:00:03.12345") ;
+  dump_time("00:05") ;
+  dump_time("12") ;
+  dump_time("ab:cd") ;
+  dump_time("00:00:01,") ;
+
+  std::cout << "== IntervalTree\n" ;
+  IntervalTree<int64_t,size_t> index ;
+  index.add(1000, 2500, 0) ;
+  index.add(2000, 4000, 1) ;
+  index.add(4000, 5000, 2) ;
+  index.add(0, 10000, 3) ;
+  index.build() ;
+  for (int64_t t : { -1, 0, 999, 1000, 2200, 2500, 3999, 4000, 9999, 10000 }) {
+    std::vector<size_t> found ;
+    index.query(t, found) ;
+    std::cout << "query(" << t << ") = " << found << "\n" ;
+  }
+  {
+    std::vector<size_t> found ;
+    index.query(2500, 4001, found) ;
+    std::cout << "query(2500,4001) = " << found << "\n" ;
+  }
+  check_tree(0, 1) ;
+  check_tree(1, 2) ;
+  check_tree(200, 3) ;
+
+  std::cout << "== SubtitleTrack\n" ;
+  SubtitleTrack track ;
+  size_t n = track.parse("WEBVTT\n"
+                         "\n"
+                         "1\n"
+                         "00:01.000 --> 00:03.000\n"
+                         "Hello\n"
+                         "\n"
+                         "00:02.500 --> 00:04.000 align:start\n"
+                         "<i>World</i>\n") ;
+  std::cout << "cues = " << n << "\n" ;
+  for (int64_t ms : { 500, 1000, 2700, 3000, 4000 }) {
+    std::vector<size_t> found ;
+    track.active(Timestamp::make_main(ms,1,1000), found) ;
+    std::cout << "active(" << ms << "ms) = " << found << "\n" ;
+  }
+}
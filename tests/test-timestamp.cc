@@ -2,6 +2,7 @@
 #include <iostream>
 #include <cstring>
 #include <vex/Timestamp.h>
+#include <vex/TimeMapper.h>
 
 #define MAIN_NUM 1001
 #define MAIN_DEN 30000
@@ -11,6 +12,34 @@
 
 #define DUMP(t) std::cout  << #t << " = " << (t) << " = " <<  (t).str(true)  << " = " << (t).str(false) << " = " << (t).human() << "\n"
 
+// Check TimeMapper::pts(), cursor() and map() against the exact
+// source time of the frames f0 to f0+count-1.
+static void
+check_mapper(const char *name, AVRational rate, AVRational tb, AVRational speed, const Timestamp &offset,
+             int64_t f0, size_t count)
+{
+  TimeMapper mapper(rate, tb, speed, offset) ;
+  std::vector<int64_t> mapped(count) ;
+  mapper.map(f0, count, mapped.data()) ;
+  TimeMapper::Cursor cur = mapper.cursor(f0) ;
+  size_t errors = 0 ;
+  for (size_t i=0 ; i<count ; i++, cur.next()) {
+    int64_t f = f0 + int64_t(i) ;
+    // offset + f * speed / rate 
+    Timestamp t = offset + Timestamp::make_local(f*speed.num, rate.den, int64_t(rate.num)*speed.den) ;
+    int64_t expected = t.rescale(tb.num, tb.den, Timestamp::round_down) ;
+    if ( mapper.pts(f) != expected || cur.pts() != expected || mapped[i] != expected ) {
+      if (errors==0)
+        std::cout << "  frame " << f << ": expected " << expected << " got " << mapper.pts(f)
+                  << " / " << cur.pts() << " / " << mapped[i] << "\n" ;
+      errors++ ;
+    }
+  }
+  std::cout << name << ": pts(" << f0 << ") = " << mapper.pts(f0)
+            << "  pts(" << f0+int64_t(count)-1 << ") = " << mapper.pts(f0+int64_t(count)-1)
+            << "  errors = " << errors << "\n" ;
+}
+
 
 int
 main(void)
@@ -53,5 +82,42 @@ main(void)
   DUMP("3h11m2.3335000s"_t) ;
   DUMP("3h11m2.3335001s"_t) ;
   DUMP("3h"_t) ;
+
+  std::cout  <<"== exact rescaling and comparisons\n";
+
+  // 1001 frames at 30000/1001 fps last 33.4000333... seconds
+  Timestamp t3 = Timestamp::make_main(1001,MAIN_NUM,MAIN_DEN) ;
+  DUMP(t3);
+  DUMP(t3.floor_to_ms());
+  DUMP(t3.ceil_to_ms());
+  std::cout << "t3 in 1/90000   = " << t3.rescale(1,90000) << "\n" ;
+  std::cout << "t3 frames @25   = " << t3.rescale(1,25,Timestamp::round_down) << "\n" ;
+  std::cout << "t3 frames @25^  = " << t3.rescale(1,25,Timestamp::round_up) << "\n" ;
+
+  // Different time bases can be compared
+  Timestamp t4 = Timestamp::make_main(3,1,90) ;          // 1/30 s
+  Timestamp t5 = Timestamp::make_main(1,1,30) ;          // 1/30 s
+  Timestamp t6 = Timestamp::make_local(1,1001,30000) ;   // slightly more than 1/30 s
+  std::cout << "t4==t5 " << (t4==t5) << "  t4<t6 " << (t4<t6) << "  t6>t5 " << (t6>t5) << "\n" ;
+  std::cout << "compare(t6,33_ms) = " << Timestamp::compare(t6,33_ms)
+            << "  compare(t6,34_ms) = " << Timestamp::compare(t6,34_ms) << "\n" ;
+
+  // and added when the conversion is exact
+  DUMP((t4+t5));
+
+  std::cout  <<"== time mapper\n";
+
+  // C=1 (table)
+  check_mapper("25fps from 1/90000 at x0.5 from 12s",
+               AVRational{25,1}, AVRational{1,90000}, AVRational{1,2}, 12_s, 0, 1000) ;
+  // C=80 (table)
+  check_mapper("23.976fps from 1/44100 at x7/13",
+               AVRational{24000,1001}, AVRational{1,44100}, AVRational{7,13}, 1500_ms, -200, 1000) ;
+  // Reverse playback 
+  check_mapper("29.97fps from 1/25 at x-1.5 from 1h",
+               AVRational{30000,1001}, AVRational{1,25}, AVRational{-3,2}, 3600_s, 0, 1000) ;
+  // C=100000 (no table so Cursor)
+  check_mapper("29.97fps from 1/44100 at x0.997",
+               AVRational{30000,1001}, AVRational{1,44100}, AVRational{997,1000}, 333_ms, 99000, 3000) ;
 }
 
@@ -20,6 +20,11 @@
 #include <vex/TextBox.h>
 #include <vex/Color.h>
 #include <vex/ArgManager.h>
+#include <vex/Scene.h>
+#include <vex/LayerCache.h>
+#include <vex/TileCompositor.h>
+#include <vex/Subtitles.h>
+#include <vex/Timeline.h>
 
 #include <fontconfig/fontconfig.h>
 
@@ -109,6 +114,8 @@ public:
   virtual void render(BLContext &ctx, int framenum, Timestamp &ts)=0;
   virtual int  width()=0;
   virtual int  height()=0;
+  // The duration of the animation (so 100 frames in PAL)
+  virtual Timestamp duration() { return 4_s; }
 };
 
 // Common fetures of all animations in this demo
@@ -119,6 +126,8 @@ public:
   BLBox  fullBoxI;
   BLRect fullRect; 
   BLRect fullRectI; 
+
+  LayerCache layers;
     
   VideoCommon(video::Size s) {
     fullRect  = BLRect(0,0,s.w,s.h);
@@ -176,6 +185,13 @@ public:
       btb::registerFont("mono-XXL",    face_mono, XXL);
       btb::registerFont("mono-XXXL",   face_mono, XXXL);
       
+      // Symbols such as the check marks
+      BLFontFace face_symbols ;
+      btb::createFaceFromFcPattern(face_symbols,":charset=2714");
+      btb::registerFont("symb-M",     face_symbols, M);
+      btb::registerFont("symb-L",     face_symbols, L);
+      btb::registerFont("symb-XL",    face_symbols, XL);
+      
       // Provide a few alternative names
       btb::registerFont("default", "M");
       btb::registerFont("bold",    "bold-M");
@@ -200,14 +216,22 @@ public:
     double scale_x = double(actual_w) / width();
     double scale_y = double(actual_h) / height();
 
+    ctx.save();
     ctx.scale(scale_x,scale_y);
     ctx.userToMeta();
 
     ctx.save();
     this->render(ctx,framenum,ts);
     ctx.restore();
+    ctx.restore();
 
-    this->draw_grid(ctx);
+    // The grid only depends on the frame size so it is rendered once
+    // and then blitted.
+    layers.blit(ctx, LayerCache::key("grid", actual_w, actual_h), actual_w, actual_h,
+                [&](BLContext &c) {
+                  c.scale(scale_x,scale_y);
+                  this->draw_grid(c);
+                } ) ;
       
     ctx.end();
   }
@@ -275,12 +299,6 @@ public:
       btb::createFaceFromFcPattern(face_unifont,"Unifont");
       btb::registerFont("unifont-L",   face_unifont, L);
       
-      BLFontFace face_symbols ;
-      btb::createFaceFromFcPattern(face_symbols,":charset=2714");
-      btb::registerFont("symb-M",     face_symbols, M);
-      btb::registerFont("symb-L",     face_symbols, L);
-      btb::registerFont("symb-XL",    face_symbols, XL);
-      
       // Egyptian hieroglyphs
       BLFontFace face_egypt;
       btb::createFaceFromFcPattern(face_egypt,":charset=0x13200");
@@ -429,6 +447,138 @@ public:
 
 
 
+//
+// A lower-third with a ticker implemented with a Scene.
+//
+// Most of the frame is static so only the ticker and the clock 
+// are redrawn at each frame.
+//
+class VideoLowerThird : public VideoCommon {
+public:
+
+  static constexpr auto VSIZE = video::Size_HD;
+
+  static constexpr int WIDTH  = VSIZE.w;
+  static constexpr int HEIGHT = VSIZE.h;
+
+  // The optional compositor of the scene (so declared before it)
+  std::unique_ptr<TileCompositor> compositor ;
+  
+  Scene scene{WIDTH,HEIGHT};
+
+  std::shared_ptr<Timeline> timeline = std::make_shared<Timeline>() ;
+
+  std::shared_ptr<TextBoxNode> clock;
+  btb::TextBoxBase::BlockRef clock_digits ;
+  int clock_seconds = -1 ; 
+
+  // Optional subtitles (SRT or WebVTT)
+  std::string subtitles_file ;
+  
+  VideoLowerThird() : VideoCommon(VSIZE) {
+  }
+
+  virtual void init() override {
+    this->VideoCommon::init() ;
+
+    scene.add( std::make_shared<SolidBackgroundNode>(col::DodgerBlue4 - 0.5) ) ;
+
+    // The grid never changes so it is drawn once in a cached layer.
+    auto grid = std::make_shared<FunctionNode>(
+      [this]() { return this->fullBox ; },
+      [this](BLContext &ctx) { this->draw_grid(ctx) ; } ) ;
+    auto statics = std::make_shared<CachedLayerNode>() ;
+    statics->add(grid) ;
+    statics->setKey( LayerCache::key("grid", WIDTH, HEIGHT) ) ;
+    scene.add(statics) ;
+
+    // The titles are scheduled in a timeline.
+    size_t titles = timeline->addTrack("titles") ;
+    const char * title_texts[] = { "Breaking News", "Live from the scene graph" } ;
+    for (int i=0 ; i<2 ; i++) {
+      auto title = std::make_shared<TextBoxNode>("bold-XL", 100, HEIGHT-260) ;
+      title->textbox().setFillColor(col::White) ;
+      title->textbox().setBoxFillColor(col::Firebrick4 % 0.8) ;
+      title->textbox().setBorder(20,10,20,10) ;
+      title->textbox().append(title_texts[i]) ;
+      TimelineClip clip ;
+      clip.track = titles ;
+      clip.in    = Timestamp::make_ms(i*2000) ;
+      clip.out   = Timestamp::make_ms((i+1)*2000) ;
+      clip.node  = title ;
+      timeline->add(clip) ;
+    }
+    scene.add( std::make_shared<TimelineNode>(timeline) ) ;
+
+    clock = std::make_shared<TextBoxNode>("mono-XL", WIDTH-400, 60) ;
+    clock->textbox().setFillColor(col::Yellow) ;
+    clock_digits = clock->textbox().mark() ;
+    clock->textbox().append("00:00:00") ;
+    scene.add(clock) ;
+    
+    // The ticker scrolls from right to left in a band at the bottom. 
+    auto ticker = std::make_shared<btb::SimpleTextBox>("L") ;
+    ticker->setFillColor(col::White) ;
+    ticker->setGlyphAtlas(true) ; // the same glyphs are drawn at every frame
+    ticker->append("vex ^F[symb-L]✓^R scene graph ^F[symb-L]✓^R dirty regions ^F[symb-L]✓^R partial re-render") ;
+    auto ticker_x = std::make_shared<double>(WIDTH) ;
+    double band_y0 = HEIGHT-140 ;
+    double band_y1 = HEIGHT-80 ; 
+    auto band = std::make_shared<FunctionNode>(
+      [=]() { return BLBox(0, band_y0, WIDTH, band_y1) ; },
+      [=](BLContext &ctx) {
+        ctx.setFillStyle(col::Black % 0.7) ;
+        ctx.fillBox(BLBox(0, band_y0, WIDTH, band_y1)) ;
+        ticker->draw(ctx, *ticker_x, band_y0+10) ;
+      } ) ;
+    band->prepare_fn = [=](const Timestamp &ts) {
+      double t = Timestamp(ts).eval() ;
+      double w = ticker->width() ;
+      *ticker_x = WIDTH - std::fmod(t*300.0, WIDTH+w) ;
+    } ; 
+    scene.add(band) ;
+
+    if (!subtitles_file.empty()) {
+      auto track = std::make_shared<SubtitleTrack>() ;
+      if (!track->load(subtitles_file))
+        exit(1) ;
+      auto subtitles = std::make_shared<SubtitleNode>(track, "L", WIDTH/2, band_y0-20) ;
+      subtitles->setItalicFont("italic-L") ;
+      subtitles->setBoldFont("bold-L") ;
+      subtitles->setBoxFillColor(col::Black % 0.6) ;
+      subtitles->setWrapWidth(WIDTH*0.6) ;
+      subtitles->preload() ;
+      scene.add(subtitles) ;
+    }
+  }
+
+  virtual void render_image(BLImage &frame, int framenum, Timestamp &ts) override {
+    int seconds = int(ts.eval()) ;
+    if (seconds != clock_seconds) {
+      clock_seconds = seconds ;
+      char buffer[32] ;
+      sprintf(buffer, "00:%02d:%02d", seconds/60, seconds%60) ;
+      // Only the digits are shaped again.
+      clock->textbox().replaceBlockText(clock_digits, buffer) ;
+    }
+    
+    const BLImage &img = scene.render(frame.width(), frame.height(), ts) ;
+    
+    BLContext ctx(frame);
+    ctx.setCompOp(BL_COMP_OP_SRC_COPY);
+    ctx.blitImage(BLPointI(0,0), img);
+    ctx.end();
+  }
+  
+  virtual void render(BLContext &ctx, int framenum, Timestamp &ts) override {
+  }
+
+  virtual Timestamp duration() override { return timeline->duration(); }
+  
+} ;
+
+
+
 void init_resources()
 {
   using namespace fontsize ;
@@ -636,6 +786,7 @@ main(int argc, char **argv)
 
   bool show_help = false;
   std::string output_file = "demo1.mkv"  ;
+  std::string preset = "fast"  ;
   
   enum Scale {
     scale_native,
@@ -659,6 +810,22 @@ main(int argc, char **argv)
   };
   
   Scale scale = scale_native ;
+
+  enum Anim {
+    anim_textbox,
+    anim_lowerthird,
+  };
+
+  std::map<std::string, Anim> anim_values = {
+    { "textbox"    , anim_textbox },
+    { "lowerthird" , anim_lowerthird },
+  };
+
+  Anim anim_id = anim_textbox ;
+
+  bool use_tiles = false ;
+
+  std::string subtitles_file ;
     
   av_log_set_level(true ? AV_LOG_DEBUG : AV_LOG_ERROR);
 
@@ -667,9 +834,24 @@ main(int argc, char **argv)
   amgr.parse("-o =FILE ", output_file).
     help("Set the output video file (default \"" + output_file + "\")");
 
+  amgr.parse("-p =PRESET ", preset).
+    help("Set the video-encoder preset (default \"" + preset + "\"). Use 'alpha' for a transparent output");
+
   amgr.select("-S =SCALE", scale, scale_values)
     .help("Scale the output video (native, tiny, small, dvd, hd, 4k)")
     ;
+
+  amgr.select("-V =VIDEO", anim_id, anim_values)
+    .help("Select the video (textbox, lowerthird)")
+    ;
+
+  amgr.assign("-t --tiles", use_tiles, true)
+    .help("Render the scene with a parallel tile compositor (lowerthird only)")
+    ;
+
+  amgr.parse("-u =FILE ", subtitles_file)
+    .help("Burn the subtitles from a SRT or WebVTT file (lowerthird only)")
+    ;
   
   amgr.process(argc,argv);
 
@@ -679,9 +861,25 @@ main(int argc, char **argv)
   }
     
   // init_resources() ;
-  Video *anim = NULL;
+  std::unique_ptr<Video> anim ;
  
-  anim = new VideoTextBox ;
+  switch (anim_id) {
+  case anim_lowerthird:
+    {
+      VideoLowerThird *lt = new VideoLowerThird ;
+      anim.reset(lt) ;
+      if (use_tiles) {
+        lt->compositor.reset(new TileCompositor) ;
+        lt->scene.setCompositor(lt->compositor.get()) ;
+      }
+      lt->subtitles_file = subtitles_file ;
+    }
+    break;
+  default:
+  case anim_textbox:
+    anim.reset(new VideoTextBox) ;
+    break;
+  }
 
   video::Size vsize ;
   
@@ -712,13 +910,19 @@ main(int argc, char **argv)
   
   AVRational framerate = FRAMERATE_PAL ;
   VideoWriter writer ;  
-  writer.open( "fast", vsize.w, vsize.h, AV_PIX_FMT_BGRA, framerate, output_file );
+  writer.open( preset, vsize.w, vsize.h, AV_PIX_FMT_BGRA, framerate, output_file );
+  // Blend2D produces premultiplied pixels (BL_FORMAT_PRGB32) 
+  writer.set_premultiplied(true);
   
   BLImage frame(vsize.w, vsize.h, BL_FORMAT_PRGB32);
 
-  for (int f=0 ; f<100 ; f++) {     
+  Timestamp duration = anim->duration() ;
+
+  for (int f=0 ; ; f++) {     
 
     Timestamp ts = Timestamp::make_main(f, framerate.den, framerate.num); 
+    if (ts >= duration)
+      break ;
     
     anim->render_image(frame, f,ts);
       
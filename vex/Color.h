@@ -3,28 +3,158 @@
 
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "PixelOps.h"
 
-// The class Color represents a color. 
 //
-// The constructor
-// 
+// The storage policies of BasicColor.
+//
+// A policy describes how the 4 components of a straight (so not
+// premultiplied) color are stored and provides the constexpr
+// conversions from and to the 8 and 16 bit packed formats used by
+// Blend2D (BLRgba32 and BLRgba64) and to floats in [0,1].
+//
+// All conversions between packed formats are branch-free.
+//
 
-class Color {
-public:
+// 8 bits per component packed as 0xAARRGGBB (so the same as BLRgba32)
+struct ColorStorage8 {
+  typedef uint32_t type ;
+  typedef uint8_t  component_type ;
 
-  // The actual type used to store the color components.
-  // Warning: The storage type may change in future versions
-  // (e.g. 16 bit vs 8bit per component)
+  static constexpr component_type CMAX = 0xFF ;
 
-#if 0
-  // Store 8 bits per component
-  typedef uint32_t storage_type ;
-  typedef uint8_t  component_type ;
-#else
-  // Store 16 bits per component
-  typedef uint64_t storage_type ;
+  static constexpr type pack(component_type r, component_type g, component_type b, component_type a) {
+    return (type(a) << 24) | (type(r) << 16) | (type(g) << 8) | type(b) ;
+  }
+  static constexpr component_type a(type v) { return component_type(v >> 24) ; }
+  static constexpr component_type r(type v) { return component_type(v >> 16) ; }
+  static constexpr component_type g(type v) { return component_type(v >> 8) ; }
+  static constexpr component_type b(type v) { return component_type(v) ; }
+
+  static constexpr type withAlpha(type v, component_type a) {
+    return (v & 0x00FFFFFFu) | (type(a) << 24) ;
+  }
+
+  static constexpr type fromArgb8(uint32_t v) { return v ; }
+
+  static constexpr type fromArgb16(uint64_t v) {
+    // Keep the high byte of each component
+    uint64_t x = (v >> 8) & 0x00FF00FF00FF00FFull ;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull ;
+    return type( (x | (x >> 16)) & 0xFFFFFFFFull ) ;
+  }
+
+  static constexpr uint32_t toArgb8(type v) { return v ; }
+
+  static constexpr uint64_t toArgb16(type v) {
+    // Spread the bytes and replicate them (0xAB -> 0xABAB)
+    uint64_t x = v ;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull ;
+    x = (x | (x << 8))  & 0x00FF00FF00FF00FFull ;
+    return x * 0x0101 ;
+  }
+
+  static constexpr uint8_t  to8(component_type c)   { return c ; }
+  static constexpr uint16_t to16(component_type c)  { return uint16_t(c * 0x0101) ; }
+  static constexpr float    toUnit(component_type c) { return float(c) / float(CMAX) ; }
+  // Reminder: x must be in [0,1]
+  static constexpr component_type fromUnit(double x) { return component_type(x * CMAX) ; }
+} ;
+
+// 16 bits per component packed as 0xAAAARRRRGGGGBBBB (so the same as BLRgba64)
+struct ColorStorage16 {
+  typedef uint64_t type ;
   typedef uint16_t component_type ;
-#endif
+
+  static constexpr component_type CMAX = 0xFFFF ;
+
+  static constexpr type pack(component_type r, component_type g, component_type b, component_type a) {
+    return (type(a) << 48) | (type(r) << 32) | (type(g) << 16) | type(b) ;
+  }
+  static constexpr component_type a(type v) { return component_type(v >> 48) ; }
+  static constexpr component_type r(type v) { return component_type(v >> 32) ; }
+  static constexpr component_type g(type v) { return component_type(v >> 16) ; }
+  static constexpr component_type b(type v) { return component_type(v) ; }
+
+  static constexpr type withAlpha(type v, component_type a) {
+    return (v & 0x0000FFFFFFFFFFFFull) | (type(a) << 48) ;
+  }
+
+  static constexpr type fromArgb8(uint32_t v)  { return ColorStorage8::toArgb16(v) ; }
+  static constexpr type fromArgb16(uint64_t v) { return v ; }
+  static constexpr uint32_t toArgb8(type v)    { return ColorStorage8::fromArgb16(v) ; }
+  static constexpr uint64_t toArgb16(type v)   { return v ; }
+
+  static constexpr uint8_t  to8(component_type c)   { return uint8_t(c >> 8) ; }
+  static constexpr uint16_t to16(component_type c)  { return c ; }
+  static constexpr float    toUnit(component_type c) { return float(c) / float(CMAX) ; }
+  static constexpr component_type fromUnit(double x) { return component_type(x * CMAX) ; }
+} ;
+
+// A float in [0,1] per component.
+//
+// The conversions to integer formats are rounded to the nearest value.
+struct ColorStorageFloat {
+  struct type {
+    float b, g, r, a ;
+  } ;
+  typedef float component_type ;
+
+  static constexpr float CMAX = 1.0f ;
+
+  static constexpr type pack(float r, float g, float b, float a) {
+    return type{ b, g, r, a } ;
+  }
+  static constexpr float a(type v) { return v.a ; }
+  static constexpr float r(type v) { return v.r ; }
+  static constexpr float g(type v) { return v.g ; }
+  static constexpr float b(type v) { return v.b ; }
+
+  static constexpr type withAlpha(type v, float a) {
+    return type{ v.b, v.g, v.r, a } ;
+  }
+
+  static constexpr type fromArgb8(uint32_t v) {
+    return type{ float(v & 0xFF)/255.0f, float((v >> 8) & 0xFF)/255.0f,
+                 float((v >> 16) & 0xFF)/255.0f, float(v >> 24)/255.0f } ;
+  }
+  static constexpr type fromArgb16(uint64_t v) {
+    return type{ float(v & 0xFFFF)/65535.0f, float((v >> 16) & 0xFFFF)/65535.0f,
+                 float((v >> 32) & 0xFFFF)/65535.0f, float(v >> 48)/65535.0f } ;
+  }
+
+  static constexpr uint8_t  to8(float c)  { return uint8_t(std::min(std::max(c,0.0f),1.0f) * 255.0f + 0.5f) ; }
+  static constexpr uint16_t to16(float c) { return uint16_t(std::min(std::max(c,0.0f),1.0f) * 65535.0f + 0.5f) ; }
+
+  static constexpr uint32_t toArgb8(type v) {
+    return (uint32_t(to8(v.a)) << 24) | (uint32_t(to8(v.r)) << 16) | (uint32_t(to8(v.g)) << 8) | to8(v.b) ;
+  }
+  static constexpr uint64_t toArgb16(type v) {
+    return (uint64_t(to16(v.a)) << 48) | (uint64_t(to16(v.r)) << 32) | (uint64_t(to16(v.g)) << 16) | to16(v.b) ;
+  }
+
+  static constexpr float toUnit(float c)    { return c ; }
+  static constexpr float fromUnit(double x) { return float(x) ; }
+} ;
+
+
+// The class BasicColor represents a straight (non-premultiplied) color
+// with a storage selected at compile time (see the aliases Color8,
+// Color16 and ColorF below).
+//
+// Color is the default (16 bit per component).
+//
+template <typename Storage>
+class BasicColor {
+public:
+
+  typedef Storage                          storage_policy ;
+  typedef typename Storage::type           storage_type ;
+  typedef typename Storage::component_type component_type ;
   
 private:
 
@@ -37,142 +167,63 @@ private:
   
   storage_type storage;
 
-  static constexpr bool storage_is_argb8  = sizeof(storage_type) == 4 ;
-  static constexpr bool storage_is_argb16 = sizeof(storage_type) == 8 ;
-    
-  // Number of bits per storage components (8 or 16)
-  static constexpr unsigned CBIT = sizeof(component_type) * 8 ;
-
-  // Maximum value of storage components (0xFF or 0xFFFF)
-  static constexpr unsigned CMAX = (1<<CBIT)-1 ; 
- 
-  static constexpr storage_type SHIFT_A = 3*CBIT; 
-  static constexpr storage_type SHIFT_R = 2*CBIT; 
-  static constexpr storage_type SHIFT_G = 1*CBIT; 
-  static constexpr storage_type SHIFT_B = 0*CBIT; 
-   
-  static constexpr storage_type MASK_A = storage_type(CMAX) << SHIFT_A ;
-  static constexpr storage_type MASK_R = storage_type(CMAX) << SHIFT_R ;
-  static constexpr storage_type MASK_G = storage_type(CMAX) << SHIFT_G ;
-  static constexpr storage_type MASK_B = storage_type(CMAX) << SHIFT_B ;
-  
-private:
-
-  // Pack R, G,B and A components to the storage type.
-  static inline constexpr
-  storage_type
-  pack_rgba( component_type r,
-             component_type g,
-             component_type b,
-             component_type a)
-    {    
-      return
-        ( storage_type(a) << SHIFT_A) |
-        ( storage_type(r) << SHIFT_R) |
-        ( storage_type(g) << SHIFT_G) |
-        ( storage_type(b) << SHIFT_B) ;      
-    }
-
-  // Pack 8-bit R, G, B and A components to the storage type
-  static inline constexpr
-  storage_type
-  pack_rgba_8( uint8_t r,
-               uint8_t g,
-               uint8_t b,
-               uint8_t a)
-    {
-      if constexpr ( CBIT==8 ) {
-        return pack_rgba(r,g,b,a); 
-      } else {
-        return pack_rgba(r*0x0101,
-                         g*0x0101,
-                         b*0x0101,
-                         a*0x0101); 
-      }      
-    }
+  static constexpr component_type CMAX = Storage::CMAX ;
 
-  // Pack 16-bit R, G, B and A components to the storage type
-  static inline constexpr
-  storage_type
-  pack_rgba_16( uint16_t r,
-                uint16_t g,
-                uint16_t b,
-                uint16_t a)
-    {
-      if constexpr ( CBIT==16 ) {
-        return pack_rgba(r,g,b,a); 
-      } else {
-        return pack_rgba(r>>8,
-                         g>>8,
-                         b>>8,
-                         a>>8);
-      }      
-    }
-  
 public:
 
-  inline Color() noexcept =default ; 
-  constexpr Color(const Color &) noexcept =default ; 
+  inline BasicColor() noexcept =default ; 
+  constexpr BasicColor(const BasicColor &) noexcept =default ; 
+  BasicColor & operator=(const BasicColor &) noexcept =default ; 
 
   // First constructor: Define the color as 0xAARRGGBB  
   constexpr inline
-  Color( uint32_t argb ) noexcept :
-    storage(0) 
+  BasicColor( uint32_t argb ) noexcept :
+    storage( Storage::fromArgb8(argb) ) 
   {
-    if ( storage_is_argb8 )
-      storage = argb;
-    else
-      storage = pack_rgba_8( argb>>16 , argb>>8, argb, argb>>24 );
   }  
 
   // Second constructor: Define the color as percentages of Red, Green, Blue
   // and Alpha.
   constexpr inline
-  Color ( double r_pc, double g_pc, double b_pc, double a_pc=100.0 ) noexcept :
+  BasicColor ( double r_pc, double g_pc, double b_pc, double a_pc=100.0 ) noexcept :
     // Remark: Using *2.55 instead if *255/100 does not work well because of
     // rounding errors: An input value of 100.0 would produce 254 instead of 255.
     // The division in the current implementation are probably a bit expensive
     // but that should not matter much since that constructor shall be mostly
     // used in constexpr contexts. 
-    storage( pack_rgba( (clamp(0.0,r_pc,100.0)*CMAX)/100,
-                        (clamp(0.0,g_pc,100.0)*CMAX)/100,
-                        (clamp(0.0,b_pc,100.0)*CMAX)/100,
-                        (clamp(0.0,a_pc,100.0)*CMAX)/100))
+    storage( Storage::pack( component_type((clamp(0.0,r_pc,100.0)*CMAX)/100),
+                            component_type((clamp(0.0,g_pc,100.0)*CMAX)/100),
+                            component_type((clamp(0.0,b_pc,100.0)*CMAX)/100),
+                            component_type((clamp(0.0,a_pc,100.0)*CMAX)/100)))
     {
     }    
+
+  // Conversion between storages.
+  template <typename Other>
+  explicit constexpr inline
+  BasicColor( const BasicColor<Other> &other ) noexcept :
+    storage( Storage::fromArgb16(other.argb16()) )
+  {
+  }
   
   // Convenient constructor when using Blend2D.
   constexpr inline
-  Color( const BLRgba32 &col ) noexcept :
-    storage(0)
+  BasicColor( const BLRgba32 &col ) noexcept :
+    storage( Storage::fromArgb8(col.value) )
   {
-    // NOTE: Assuming that BLRgba32 storage is argb8 
-    uint32_t argb = col.value;
-    if ( storage_is_argb8 )
-      storage = argb;
-    else
-      storage = pack_rgba_8( argb>>16 , argb>>8, argb, argb>>24 );
   }  
   
   // Convenient constructor when using Blend2D.
   constexpr inline
-  Color( const BLRgba64 &col ) noexcept :
-    storage(0)
+  BasicColor( const BLRgba64 &col ) noexcept :
+    storage( Storage::fromArgb16(col.value) )
   {
-    // NOTE: Assuming that BLRgba64 storage is argb16
-    uint64_t argb = col.value;
-    if ( storage_is_argb16 )
-      storage = argb;
-    else
-      storage = pack_rgba_16( argb>>32 , argb>>16, argb, argb>>48 );
   }  
 
-  
   constexpr inline
   operator BLRgba32() const {
     return BLRgba32( this->argb8() );
   }
-
   
   // The Blend2d API often allows both BLRgba32 and BLRgba64.
   // Allowing both casts to be implicit would cause ambiguities
@@ -183,90 +234,50 @@ public:
   }
 
   constexpr bool isOpaque() const noexcept {
-    return (storage & MASK_A) == MASK_A ;
+    return Storage::a(storage) == CMAX ;
   }
 
   constexpr bool isTransparent() const noexcept {
-    return (storage & MASK_A) == 0 ;
+    return Storage::a(storage) == 0 ;
   }
 
   // Return the 8bit A, R, G, and B components encoded in a
   // 32 unsigned storage as 0xAARRGGBB.     
   constexpr uint32_t argb8() const noexcept {
-    if (storage_is_argb8) 
-      return storage ; 
-    uint32_t v = a8() ;
-    v <<= 8 ;
-    v |= r8() ;
-    v <<= 8 ;
-    v |= g8() ;
-    v <<= 8 ;
-    v |= b8() ;
-    return v;
+    return Storage::toArgb8(storage) ;
   }
-  
     
   // Return the 16bit A, R, G, and B components encoded in a
   // 64 unsigned storage as 0xAAAARRRRGGGGBBBB.     
   constexpr uint64_t argb16() const noexcept {
-    if (storage_is_argb16)
-      return storage ;     
-    uint64_t v = a16() ;
-    v <<= 16 ;
-    v |= r16() ;
-    v <<= 16 ;
-    v |= g16() ;
-    v <<= 16 ;
-    v |= b16() ;
-    return v;
+    return Storage::toArgb16(storage) ;
   }
 
   // Build a Color from 8bit R, G, B and A components
-  static constexpr inline Color 
+  static constexpr inline BasicColor 
   rgba8(uint8_t r, uint8_t g, uint8_t b, uint8_t a=0xFF ) {
-    return Color::makeStorage( pack_rgba_8(r,g,b,a) ) ;      
+    return BasicColor( (uint32_t(a) << 24) | (uint32_t(r) << 16) | (uint32_t(g) << 8) | uint32_t(b) ) ;
   }  
 
   // Build a Color from R, G, B and A components in range [0,1] 
-  static constexpr inline Color 
+  static constexpr inline BasicColor 
   rgba1( double r, double g, double b, double a=1.0 ) {
-    return Color::makeStorage( pack_rgba( (clamp(0.0,r,1.0) * CMAX),
-                                          (clamp(0.0,g,1.0) * CMAX),
-                                          (clamp(0.0,b,1.0) * CMAX),
-                                          (clamp(0.0,a,1.0) * CMAX)));
+    return BasicColor::makeStorage( Storage::pack( Storage::fromUnit(clamp(0.0,r,1.0)),
+                                                   Storage::fromUnit(clamp(0.0,g,1.0)),
+                                                   Storage::fromUnit(clamp(0.0,b,1.0)),
+                                                   Storage::fromUnit(clamp(0.0,a,1.0)) ));
   }  
 
-    
   // Return the 8bit R, G, and B components encoded in a
   // 32 unsigned storage as 0x00RRGGBB.     
   constexpr uint32_t rgb8() const noexcept {
-    if constexpr (storage_is_argb8) {
-      return storage && ~MASK_A ;
-    } else {
-      uint32_t v = 0;
-      v <<= 8 ;
-      v |= r8() ;
-      v <<= 8 ;
-      v |= g8() ;
-      v <<= 8 ;
-      v |= b8() ;
-      return v;
-    }
+    return argb8() & 0x00FFFFFFu ;
   }
 
+  // Return the 16bit R, G, and B components encoded in a
+  // 64 unsigned storage as 0x0000RRRRGGGGBBBB.     
   constexpr uint64_t rgb16() const noexcept {
-    if constexpr (storage_is_argb16) {
-      return storage && ~MASK_A ;
-    } else { 
-      uint64_t v = 0;
-      v <<= 16 ;
-      v |= r16() ;
-      v <<= 16 ;
-      v |= g16() ;
-      v <<= 16 ;
-      v |= b16() ;
-      return v;
-    }
+    return argb16() & 0x0000FFFFFFFFFFFFull ;
   }
 
   // Provide the actual storage.
@@ -276,43 +287,27 @@ public:
 
   // Build from a storage value. 
   static inline constexpr
-  Color makeStorage( storage_type v) {
-    Color c(0) ;
+  BasicColor makeStorage( storage_type v) {
+    BasicColor c(0u) ;
     c.storage = v;
     return c; 
   }
-
-  
-private:
-
-  // Get the component in either 8 ot 16 bit format
-  constexpr inline component_type getA() const { return storage >> SHIFT_A; }
-  constexpr inline component_type getR() const { return storage >> SHIFT_R; }
-  constexpr inline component_type getG() const { return storage >> SHIFT_G; }
-  constexpr inline component_type getB() const { return storage >> SHIFT_B; }  
-  
-  // Provide conversion between 8 bit and 16bit components
-  static constexpr inline uint8_t  convert8(uint8_t v)   { return v; }
-  static constexpr inline uint8_t  convert8(uint16_t v)  { return v>>8; }
-  static constexpr inline uint16_t convert16(uint8_t v)  { return v*0x0101; }
-  static constexpr inline uint16_t convert16(uint16_t v) { return v; }
   
 public:
-  constexpr inline uint8_t a8() const { return convert8( this->getA() ) ; }
-  constexpr inline uint8_t r8() const { return convert8( this->getR() ) ; }
-  constexpr inline uint8_t g8() const { return convert8( this->getG() ) ; }
-  constexpr inline uint8_t b8() const { return convert8( this->getB() ) ; }
+  constexpr inline uint8_t a8() const { return Storage::to8( Storage::a(storage) ) ; }
+  constexpr inline uint8_t r8() const { return Storage::to8( Storage::r(storage) ) ; }
+  constexpr inline uint8_t g8() const { return Storage::to8( Storage::g(storage) ) ; }
+  constexpr inline uint8_t b8() const { return Storage::to8( Storage::b(storage) ) ; }
   
-  constexpr inline uint16_t a16() const { return convert16( this->getA() ) ; }
-  constexpr inline uint16_t r16() const { return convert16( this->getA() ) ; }
-  constexpr inline uint16_t g16() const { return convert16( this->getA() ) ; }
-  constexpr inline uint16_t b16() const { return convert16( this->getA() ) ; }
-
-  constexpr inline float a1() const { return float(getA()) / float(CMAX); }
-  constexpr inline float r1() const { return float(getR()) / float(CMAX); }
-  constexpr inline float g1() const { return float(getG()) / float(CMAX); }
-  constexpr inline float b1() const { return float(getB()) / float(CMAX); }  
+  constexpr inline uint16_t a16() const { return Storage::to16( Storage::a(storage) ) ; }
+  constexpr inline uint16_t r16() const { return Storage::to16( Storage::r(storage) ) ; }
+  constexpr inline uint16_t g16() const { return Storage::to16( Storage::g(storage) ) ; }
+  constexpr inline uint16_t b16() const { return Storage::to16( Storage::b(storage) ) ; }
 
+  constexpr inline float a1() const { return Storage::toUnit( Storage::a(storage) ) ; }
+  constexpr inline float r1() const { return Storage::toUnit( Storage::r(storage) ) ; }
+  constexpr inline float g1() const { return Storage::toUnit( Storage::g(storage) ) ; }
+  constexpr inline float b1() const { return Storage::toUnit( Storage::b(storage) ) ; }
 
   // Convert RGB Color to HSL 
   //
@@ -361,7 +356,7 @@ public:
   //  - lum in [0..1]
   //  - alpha in [0..1]
   //  
-  static constexpr inline Color
+  static constexpr inline BasicColor
   fromHSL6(double hue, double  sat, double lum, double alpha=1.0) {
     // See https://en.wikipedia.org/wiki/HSL_and_HSV#HSL_to_RGB
 
@@ -392,7 +387,7 @@ public:
     default:  rr = c ; gg = 0 ; bb = x ; break; // 5 but also 6 when hue==6.0 
     }
     float m = lum - c/2 ;
-    return Color::rgba1( m+rr, m+gg, m+bb, alpha ); 
+    return BasicColor::rgba1( m+rr, m+gg, m+bb, alpha ); 
   }
 
   
@@ -403,10 +398,10 @@ public:
   // Formula: 
   //    R = S + D*(1 - Sa)  
   //
-  constexpr inline Color
-  over(Color D) const
+  constexpr inline BasicColor
+  over(BasicColor D) const
   {
-    const Color &S = *this; 
+    const BasicColor &S = *this; 
     if ( S.isOpaque() ) {
       // Fully opaque source
       return S; 
@@ -419,7 +414,7 @@ public:
       float Rr = ( (S.r1()-D.r1())*Sa + D.r1() ) ;
       float Rg = ( (S.g1()-D.g1())*Sa + D.g1() ) ;
       float Rb = ( (S.b1()-D.b1())*Sa + D.b1() ) ;      
-      return Color::rgba1( Rr, Rg, Rb, 1.0 );
+      return BasicColor::rgba1( Rr, Rg, Rb, 1.0 );
     } else {      
       float Sa = S.a1(); // normalized S alpha [0..1]
       float Da = D.a1(); // normalized D alpha [0..1]          
@@ -427,23 +422,23 @@ public:
       float Rr = ( (S.r1()-D.r1()*Da)*Sa + D.r1()*Da ) / Ra ;
       float Rg = ( (S.g1()-D.g1()*Da)*Sa + D.g1()*Da ) / Ra ;
       float Rb = ( (S.b1()-D.b1()*Da)*Sa + D.b1()*Da ) / Ra ;
-      return Color::rgba1( Rr, Rg, Rb, Ra );     
+      return BasicColor::rgba1( Rr, Rg, Rb, Ra );     
     }    
   }
   
 
   
-  constexpr inline Color
+  constexpr inline BasicColor
   desaturate(double coef=0.0 ) const {
     coef = clamp(0.0,coef,1.0) ;
     double hue=0;
     double sat=0;
     double lum=0;
     this->toHSL6(hue,sat,lum);
-    return Color::fromHSL6(hue, sat*coef, lum, this->a1() ) ;
+    return BasicColor::fromHSL6(hue, sat*coef, lum, this->a1() ) ;
   }
   
-  constexpr inline Color
+  constexpr inline BasicColor
   adjustLuminance(double coef=0.0 ) const {
     coef = clamp(-1.0,coef,1.0) ;
     double hue=0;
@@ -455,23 +450,22 @@ public:
     } else {
       lum = lum+((1-lum)*coef) ; // Brighten 
     } 
-    return Color::fromHSL6( hue, sat, lum, this->a1() ) ;
+    return BasicColor::fromHSL6( hue, sat, lum, this->a1() ) ;
   }
 
-  constexpr inline Color
+  constexpr inline BasicColor
   invertLuminance() const {
     double hue=0;
     double sat=0;
     double lum=0;
     this->toHSL6(hue,sat,lum);
-    return Color::fromHSL6( hue, sat, 1.0-lum, this->a1() ) ;
+    return BasicColor::fromHSL6( hue, sat, 1.0-lum, this->a1() ) ;
   }
 
-  constexpr inline Color
+  constexpr inline BasicColor
   setAlpha1(double alpha1) const {
-    storage_type a = clamp(0.0,alpha1,1.0) * CMAX;
-    return Color::makeStorage( 
-      (this->getStorage() & ~MASK_A) | ( a << SHIFT_A)
+    return BasicColor::makeStorage( 
+      Storage::withAlpha(storage, Storage::fromUnit(clamp(0.0,alpha1,1.0)))
       ) ;
   }
   
@@ -482,7 +476,7 @@ public:
   // With a coef value of 0.0, the original alpha is preserved. 
   // With a coef value of 1.0, the alpha is 1.0 (fully opaque). 
   //
-  constexpr inline Color
+  constexpr inline BasicColor
   opacify(double coef) const {
     return this->setAlpha1(coef*this->a1()) ;
   }
@@ -493,13 +487,20 @@ public:
   // With a coef value of 0.0, the alpha is 0.0 (fully transparent). 
   // With a coef value of 1.0, the original alpha is preserved.
   //
-  constexpr inline Color
+  constexpr inline BasicColor
   fade(double coef) const {
     return this->setAlpha1(coef*this->a1()) ;
   }
     
 };
 
+typedef BasicColor<ColorStorage8>     Color8 ;
+typedef BasicColor<ColorStorage16>    Color16 ;
+typedef BasicColor<ColorStorageFloat> ColorF ;
+
+// The default color type.
+typedef Color16 Color ;
+
 #if 1
 namespace colors
 {
@@ -1171,8 +1172,9 @@ namespace colors
 //
 // Operator || provides the Porter-Duff SRC_OVER operation. 
 //
-inline Color
-operator||(const Color &S, const Color &D)
+template <typename Storage>
+inline BasicColor<Storage>
+operator||(const BasicColor<Storage> &S, const BasicColor<Storage> &D)
 {
   return S.over(D);
 }
@@ -1185,14 +1187,16 @@ operator||(const Color &S, const Color &D)
 // For example "Color(10,20,30,44) * 0.25" is equivalent
 // to "Color(10,20,30,11)".
 // 
-inline Color
-operator*(const Color &in, float coef)
+template <typename Storage>
+inline BasicColor<Storage>
+operator*(const BasicColor<Storage> &in, float coef)
 {
   return in.fade(coef);
 }
 
-inline Color
-operator*(float coef, const Color &in)
+template <typename Storage>
+inline BasicColor<Storage>
+operator*(float coef, const BasicColor<Storage> &in)
 {
   return in.fade(coef);
 }
@@ -1203,7 +1207,9 @@ operator*(float coef, const Color &in)
 // For example "Color(45,23,11) % 0.25" is equivalent
 // to "Color(45,23,11,25)".
 //
-inline Color operator%(const Color &in, float alpha1)
+template <typename Storage>
+inline BasicColor<Storage>
+operator%(const BasicColor<Storage> &in, float alpha1)
 {
   return in.setAlpha1(alpha1);
 }
@@ -1213,7 +1219,9 @@ inline Color operator%(const Color &in, float alpha1)
 // For example "Color(45,23,11) % 0.25" is equivalent
 // to "Color(45,23,11,25)".
 //
-inline Color operator%(float alpha1, const Color &in)
+template <typename Storage>
+inline BasicColor<Storage>
+operator%(float alpha1, const BasicColor<Storage> &in)
 {
   return in.setAlpha1(alpha1);
 }
@@ -1221,7 +1229,9 @@ inline Color operator%(float alpha1, const Color &in)
 
 // Operator / provides desaturation
 
-inline Color operator/(const Color &in, float coef)
+template <typename Storage>
+inline BasicColor<Storage>
+operator/(const BasicColor<Storage> &in, float coef)
 {
   return in.desaturate(coef);
 }
@@ -1231,37 +1241,247 @@ inline Color operator/(const Color &in, float coef)
 // The floating-point coefficient must be between -1.0 and +1.0
 //
 
-inline Color operator+(const Color &in, float coef)
+template <typename Storage>
+inline BasicColor<Storage>
+operator+(const BasicColor<Storage> &in, float coef)
 {
   return in.adjustLuminance(coef);
 }
 
-inline Color operator+(float coef, const Color &in)
+template <typename Storage>
+inline BasicColor<Storage>
+operator+(float coef, const BasicColor<Storage> &in)
 {
   return in.adjustLuminance(coef);
 }
 
-inline Color operator-(const Color &in, float coef)
+template <typename Storage>
+inline BasicColor<Storage>
+operator-(const BasicColor<Storage> &in, float coef)
 {
   return in.adjustLuminance(-coef);
 }
 
 // Invert Luminance but keep Hue, Saturation and Alpha.
 
-inline Color operator!(const Color &in)
+template <typename Storage>
+inline BasicColor<Storage>
+operator!(const BasicColor<Storage> &in)
 {
   return in.invertLuminance();
 }
 
 // Invert R, G & B components but keep Alpha.
 
-inline Color operator~(const Color &in)
+template <typename Storage>
+inline BasicColor<Storage>
+operator~(const BasicColor<Storage> &in)
 {
   return in;
   // TODO: return in.invert();
 }
 
-std::ostream & operator<<( std::ostream &s, const Color c) {  
+//
+// Span operations on arrays of colors (gradients, palettes, ...).
+//
+// They are equivalent to the scalar operators but are applied to whole
+// arrays using SSE2 when available. The SIMD versions compute with
+// floats and round to the nearest value so the results may differ by
+// one unit (of the 16 bit components) from the scalar operators.
+//
+// See also PixelOps.h for the operations on PRGB32 pixels.
+//
+namespace colorspan
+{
+#if defined(__SSE2__)
+  static_assert(sizeof(Color)==8, "colorspan expects 16 bit components") ;
+
+  // The SIMD loops process 4 colors per iteration. 
+
+  // Load 4 colors as 4 vectors of floats in [0,1] (B, G, R, A)
+  inline void load4_ps(const Color *c, __m128 &c0, __m128 &c1, __m128 &c2, __m128 &c3)
+  {
+    const __m128  k    = _mm_set1_ps(1.0f/65535.0f) ;
+    const __m128i zero = _mm_setzero_si128() ;
+    __m128i v01 = _mm_loadu_si128((const __m128i*)(c)) ;
+    __m128i v23 = _mm_loadu_si128((const __m128i*)(c+2)) ;
+    c0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v01, zero)), k) ;
+    c1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v01, zero)), k) ;
+    c2 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v23, zero)), k) ;
+    c3 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v23, zero)), k) ;
+  }
+
+  // Clamp and round to 16 bit integers
+  inline __m128i to_epi32(__m128 f)
+  {
+    f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(1.0f)) ;
+    f = _mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(65535.0f)), _mm_set1_ps(0.5f)) ;
+    // SSE2 has no unsigned 32 to 16 bit pack
+    return _mm_sub_epi32(_mm_cvttps_epi32(f), _mm_set1_epi32(32768)) ;
+  }
+
+  // Store 4 colors given as 4 vectors of floats (B, G, R, A)
+  inline void store4_ps(Color *c, __m128 c0, __m128 c1, __m128 c2, __m128 c3)
+  {
+    const __m128i bias = _mm_set1_epi16(-32768) ;
+    __m128i v01 = _mm_add_epi16(_mm_packs_epi32(to_epi32(c0), to_epi32(c1)), bias) ;
+    __m128i v23 = _mm_add_epi16(_mm_packs_epi32(to_epi32(c2), to_epi32(c3)), bias) ;
+    _mm_storeu_si128((__m128i*)(c),   v01) ;
+    _mm_storeu_si128((__m128i*)(c+2), v23) ;
+  }
+#endif
+
+  // R[i] = S[i] || D[i] (so Porter-Duff SRC_OVER)
+  inline void over(const Color *S, const Color *D, Color *R, size_t n)
+  {
+    size_t i=0 ;
+#if defined(__SSE2__)
+    const __m128 one  = _mm_set1_ps(1.0f) ;
+    const __m128 zero = _mm_setzero_ps() ;
+    for ( ; i+4<=n ; i+=4) {
+      // Transposed so each vector holds one component of the 4 colors
+      __m128 sb, sg, sr, sa ;
+      __m128 db, dg, dr, da ;
+      load4_ps(S+i, sb, sg, sr, sa) ;
+      load4_ps(D+i, db, dg, dr, da) ;
+      _MM_TRANSPOSE4_PS(sb, sg, sr, sa) ;
+      _MM_TRANSPOSE4_PS(db, dg, dr, da) ;
+      __m128 dw = _mm_mul_ps(da, _mm_sub_ps(one,sa)) ;
+      __m128 ra = _mm_add_ps(sa, dw) ;
+      // 1/ra or 0 when the result is fully transparent
+      __m128 inv = _mm_and_ps(_mm_div_ps(one, ra), _mm_cmpneq_ps(ra,zero)) ;
+      __m128 rb = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(sb,sa), _mm_mul_ps(db,dw)), inv) ;
+      __m128 rg = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(sg,sa), _mm_mul_ps(dg,dw)), inv) ;
+      __m128 rr = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(sr,sa), _mm_mul_ps(dr,dw)), inv) ;
+      _MM_TRANSPOSE4_PS(rb, rg, rr, ra) ;
+      store4_ps(R+i, rb, rg, rr, ra) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      R[i] = S[i].over(D[i]) ;
+    }
+  }
+
+  // out[i] = in[i].fade(coef)
+  inline void fade(const Color *in, Color *out, size_t n, float coef)
+  {
+    size_t i=0 ;
+#if defined(__SSE2__)
+    coef = std::max(0.0f, coef) ;
+    const __m128 k = _mm_set_ps(coef, 1.0f, 1.0f, 1.0f) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128 c0, c1, c2, c3 ;
+      load4_ps(in+i, c0, c1, c2, c3) ;
+      store4_ps(out+i,
+                _mm_mul_ps(c0,k), _mm_mul_ps(c1,k),
+                _mm_mul_ps(c2,k), _mm_mul_ps(c3,k)) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      out[i] = in[i].fade(coef) ;
+    }
+  }
+
+  // Component-wise linear interpolation R[i] = A[i]*(1-t) + B[i]*t
+  inline void lerp(const Color *A, const Color *B, Color *R, size_t n, float t)
+  {
+    size_t i=0 ;
+#if defined(__SSE2__)
+    const __m128 kt = _mm_set1_ps(t) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128 a0, a1, a2, a3 ;
+      __m128 b0, b1, b2, b3 ;
+      load4_ps(A+i, a0, a1, a2, a3) ;
+      load4_ps(B+i, b0, b1, b2, b3) ;
+      store4_ps(R+i,
+                _mm_add_ps(a0, _mm_mul_ps(_mm_sub_ps(b0,a0), kt)),
+                _mm_add_ps(a1, _mm_mul_ps(_mm_sub_ps(b1,a1), kt)),
+                _mm_add_ps(a2, _mm_mul_ps(_mm_sub_ps(b2,a2), kt)),
+                _mm_add_ps(a3, _mm_mul_ps(_mm_sub_ps(b3,a3), kt))) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      R[i] = Color::rgba1( A[i].r1() + (B[i].r1()-A[i].r1())*t,
+                           A[i].g1() + (B[i].g1()-A[i].g1())*t,
+                           A[i].b1() + (B[i].b1()-A[i].b1())*t,
+                           A[i].a1() + (B[i].a1()-A[i].a1())*t ) ;
+    }
+  }
+
+  // Convert to straight 8 bit pixels 0xAARRGGBB (so Color::argb8())
+  inline void toARGB32(const Color *in, uint32_t *out, size_t n)
+  {
+    size_t i=0 ;
+#if defined(__SSE2__)
+    for ( ; i+4<=n ; i+=4) {
+      __m128i lo = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(in+i)),   8) ;
+      __m128i hi = _mm_srli_epi16(_mm_loadu_si128((const __m128i*)(in+i+2)), 8) ;
+      _mm_storeu_si128((__m128i*)(out+i), _mm_packus_epi16(lo,hi)) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      out[i] = in[i].argb8() ;
+    }
+  }
+
+  // Convert to premultiplied 8 bit pixels (so BL_FORMAT_PRGB32)
+  inline void toPRGB32(const Color *in, uint32_t *out, size_t n)
+  {
+    toARGB32(in, out, n) ;
+    pixops::premultiply_row(out, out, int(n)) ;
+  }
+
+  //
+  // The scalar versions for the other storages. 
+  //
+
+  template <typename Storage>
+  inline void over(const BasicColor<Storage> *S, const BasicColor<Storage> *D, BasicColor<Storage> *R, size_t n)
+  {
+    for (size_t i=0 ; i<n ; i++) {
+      R[i] = S[i].over(D[i]) ;
+    }
+  }
+
+  template <typename Storage>
+  inline void fade(const BasicColor<Storage> *in, BasicColor<Storage> *out, size_t n, float coef)
+  {
+    for (size_t i=0 ; i<n ; i++) {
+      out[i] = in[i].fade(coef) ;
+    }
+  }
+
+  template <typename Storage>
+  inline void lerp(const BasicColor<Storage> *A, const BasicColor<Storage> *B, BasicColor<Storage> *R, size_t n, float t)
+  {
+    for (size_t i=0 ; i<n ; i++) {
+      R[i] = BasicColor<Storage>::rgba1( A[i].r1() + (B[i].r1()-A[i].r1())*t,
+                                   A[i].g1() + (B[i].g1()-A[i].g1())*t,
+                                   A[i].b1() + (B[i].b1()-A[i].b1())*t,
+                                   A[i].a1() + (B[i].a1()-A[i].a1())*t ) ;
+    }
+  }
+
+  // Reminder: For Color8, that is a plain copy.
+  template <typename Storage>
+  inline void toARGB32(const BasicColor<Storage> *in, uint32_t *out, size_t n)
+  {
+    for (size_t i=0 ; i<n ; i++) {
+      out[i] = in[i].argb8() ;
+    }
+  }
+
+  template <typename Storage>
+  inline void toPRGB32(const BasicColor<Storage> *in, uint32_t *out, size_t n)
+  {
+    toARGB32(in, out, n) ;
+    pixops::premultiply_row(out, out, int(n)) ;
+  }
+
+} // of namespace colorspan
+
+template <typename Storage>
+std::ostream & operator<<( std::ostream &s, const BasicColor<Storage> c) {  
   s << "#" << std::hex << std::setfill('0') 
     << std::setw(8) << c.argb8() 
     << std::setfill(' ');
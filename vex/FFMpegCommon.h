@@ -3,6 +3,10 @@
 
 #include <iostream>
 #include <cassert>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -18,6 +22,9 @@ extern "C" {
 #include <libswscale/swscale.h>
 }
 
+#include "PixelOps.h"
+#include "ThreadPool.h"
+
 static const AVRational FRAMERATE_NTSC{30000,1001} ; // 'ntsc' ~= 29.970 fps
 static const AVRational FRAMERATE_PAL{25,1} ;        // 'pal'  = 25 fps
 static const AVRational FRAMERATE_FILM{24,1} ;       // 'film' = 24 fps
@@ -28,6 +35,25 @@ inline std::ostream & operator<<(std::ostream &s, const AVRational & v)
    return s ; 
 }
 
+// Tell if the pixel format is a single plane 32bit format with 8bit
+// components and the alpha channel in the last byte (e.g.
+// AV_PIX_FMT_BGRA or AV_PIX_FMT_RGBA). Those are the formats
+// supported by the premultiply/unpremultiply kernels of PixelOps.h
+inline bool
+pix_fmt_has_trailing_alpha8(AVPixelFormat fmt)
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt) ;
+  if (!desc) return false ;
+  if (!(desc->flags & AV_PIX_FMT_FLAG_ALPHA)) return false ;
+  if (desc->nb_components != 4) return false ;
+  if (av_pix_fmt_count_planes(fmt) != 1) return false ;
+  for (int i=0;i<4;i++) {
+    if (desc->comp[i].depth != 8 || desc->comp[i].step != 4)
+      return false ;
+  }
+  return desc->comp[3].offset == 3 ;
+}
+
 #if 0
 inline std::string
 AV_ERROR_TEXT(int errnum)
@@ -111,10 +137,14 @@ public:
 // provides easy conversion to, from and
 // between AVFrame.
 //
+// By default, the alpha channel (if any) is assumed to be straight
+// in both the source and the destination. See setPremultiplied() to
+// exchange premultiplied pixels with Blend2D (BL_FORMAT_PRGB32).
+//
 class FFMpegFrameConverter
 {
 public:
-  SwsContext *  ctx{0} ;
+  SwsContext *  ctx{0} ;             // Owned by the converter
   int           srcW{0} ; 
   int           srcH{0} ; 
   AVPixelFormat srcFormat{AV_PIX_FMT_NONE}  ;
@@ -123,10 +153,103 @@ public:
   AVPixelFormat dstFormat{AV_PIX_FMT_NONE} ;
   int           srcPlanes{0};
   int           dstPlanes{0};
+  bool          srcPremultiplied{false};
+  bool          dstPremultiplied{false};
+private:
+  // Scratch image used to unpremultiply the source
+  std::vector<uint32_t> scratch ;
+
+  // The arguments of sws_getContext() are kept to create the
+  // additional contexts used by convertBatch().
+  int           flags{0} ;
+  SwsFilter *   srcFilter{0} ;
+  SwsFilter *   dstFilter{0} ;
+  bool          hasParam{false} ;
+  double        param[2]{0,0} ;
+
+  // The additional SwsContexts (and scratch images) used by the extra
+  // tasks of convertBatch().
+  //
+  // They belong to a single converter: a copy starts without contexts
+  // and creates its own ones when needed.
+  struct Workers {
+    std::vector<std::unique_ptr<SwsContext,void(*)(SwsContext*)>> contexts ;
+    std::vector<std::vector<uint32_t>> scratches ;
+    Workers() { }
+    Workers(const Workers &) { }
+    Workers & operator=(const Workers &) {
+      contexts.clear() ;
+      scratches.clear() ;
+      return *this ;
+    }
+  } ;
+  Workers workers ;
+
+  // Copy everything except the contexts and the scratch images.
+  void copyParams(const FFMpegFrameConverter &other)
+  {
+    srcW             = other.srcW ;
+    srcH             = other.srcH ;
+    srcFormat        = other.srcFormat ;
+    dstW             = other.dstW ;
+    dstH             = other.dstH ;
+    dstFormat        = other.dstFormat ;
+    srcPlanes        = other.srcPlanes ;
+    dstPlanes        = other.dstPlanes ;
+    srcPremultiplied = other.srcPremultiplied ;
+    dstPremultiplied = other.dstPremultiplied ;
+    flags            = other.flags ;
+    srcFilter        = other.srcFilter ;
+    dstFilter        = other.dstFilter ;
+    hasParam         = other.hasParam ;
+    param[0]         = other.param[0] ;
+    param[1]         = other.param[1] ;
+  }
+  
 public:
 
   FFMpegFrameConverter() {
   }
+
+  // A copy creates its own SwsContext so a converter and its copies
+  // can be used by different threads.
+  FFMpegFrameConverter(const FFMpegFrameConverter &other)
+  {
+    copyParams(other) ;
+    if (other.ctx)
+      this->ctx = this->createContext() ;
+  }
+
+  FFMpegFrameConverter(FFMpegFrameConverter &&other)
+  {
+    copyParams(other) ;
+    std::swap(this->ctx, other.ctx) ;
+    std::swap(this->workers.contexts, other.workers.contexts) ;
+    std::swap(this->workers.scratches, other.workers.scratches) ;
+  }
+
+  FFMpegFrameConverter & operator=(const FFMpegFrameConverter &other)
+  {
+    if (this != &other) 
+      *this = FFMpegFrameConverter(other) ;
+    return *this ;
+  }
+
+  FFMpegFrameConverter & operator=(FFMpegFrameConverter &&other)
+  {
+    if (this != &other) {
+      copyParams(other) ;
+      std::swap(this->ctx, other.ctx) ;
+      std::swap(this->workers.contexts, other.workers.contexts) ;
+      std::swap(this->workers.scratches, other.workers.scratches) ;
+    }
+    return *this ;
+  }
+
+  ~FFMpegFrameConverter() {
+    if (ctx)
+      sws_freeContext(ctx) ;
+  }
   
   FFMpegFrameConverter( int  	            srcW,
                         int  	            srcH,
@@ -144,79 +267,252 @@ public:
     srcFormat(srcFormat),
     dstW(dstW),
     dstH(dstH),
-    dstFormat(dstFormat)
+    dstFormat(dstFormat),
+    flags(flags),
+    srcFilter(srcFilter),
+    dstFilter(dstFilter)
   {    
     this->srcPlanes = av_pix_fmt_count_planes(srcFormat) ;
     this->dstPlanes = av_pix_fmt_count_planes(dstFormat) ;
-    this->ctx = sws_getContext(srcW,
-                               srcH,
-                               srcFormat,
-                               dstW,
-                               dstH,
-                               dstFormat,
-                               flags,
-                               srcFilter,
-                               dstFilter,
-                               param
-                               ) ;
+    if (param) {
+      this->hasParam = true ;
+      this->param[0] = param[0] ;
+      this->param[1] = param[1] ;
+    }
+    this->ctx = this->createContext() ;
   }
   
 public:
-      
-  inline bool convertFrameToPacked(AVFrame *srcFrame, void *dstData, int dstStride)
+
+  // Indicate that the alpha channel of the source and/or of the
+  // destination is premultiplied (e.g. a BLImage in BL_FORMAT_PRGB32
+  // described as AV_PIX_FMT_BGRA).
+  //
+  // A premultiplied side must use a format accepted by
+  // pix_fmt_has_trailing_alpha8(). The source is unpremultiplied
+  // into an internal scratch image before the conversion and the
+  // destination is premultiplied in place after the conversion.
+  //
+  void setPremultiplied(bool src, bool dst)
   {
-    assert( this->srcFormat == AVPixelFormat(srcFrame->format) ) ;
-    assert( this->srcW == srcFrame->width ) ;
-    assert( this->srcH == srcFrame->height ) ;
-    assert( this->dstPlanes == 1) ;
+    if ( src && !pix_fmt_has_trailing_alpha8(srcFormat) ) {
+      std::cerr << "ERROR: Premultiplied alpha is not supported for source format "
+                << av_get_pix_fmt_name(srcFormat) << "\n" ;
+      std::exit(1);
+    }
+    if ( dst && !pix_fmt_has_trailing_alpha8(dstFormat) ) {
+      std::cerr << "ERROR: Premultiplied alpha is not supported for destination format "
+                << av_get_pix_fmt_name(dstFormat) << "\n" ;
+      std::exit(1);
+    }
+    this->srcPremultiplied = src ;
+    this->dstPremultiplied = dst ;
+  }
 
-    int n = sws_scale( this->ctx,
-                       srcFrame->data,
-                       srcFrame->linesize,
+  // Allocate a frame suitable as destination of the conversion
+  // (so with dstW, dstH and dstFormat).
+  //
+  // The result should be released with av_frame_free().
+  AVFrame * allocDstFrame(int align=0) const
+  {
+    AVFrame *frame = av_frame_alloc() ;
+    if (!frame) {
+      std::cerr << "ERROR: Failed to allocate frame\n" ;
+      std::exit(1);
+    }
+    frame->width  = dstW ;
+    frame->height = dstH ;
+    frame->format = dstFormat ;
+    if ( av_frame_get_buffer(frame, align) < 0 ) {
+      std::cerr << "ERROR: Failed to allocate frame buffers\n" ;
+      std::exit(1);
+    }
+    return frame ; 
+  }
+  
+private:
+
+  SwsContext * createContext() const
+  {
+    return sws_getContext(srcW,
+                          srcH,
+                          srcFormat,
+                          dstW,
+                          dstH,
+                          dstFormat,
+                          flags,
+                          srcFilter,
+                          dstFilter,
+                          hasParam ? param : NULL
+                          ) ;
+  }
+
+  // The core of all conversions.
+  //
+  // Only the first plane is concerned by the premultiplied alpha
+  // since that is only supported for single plane formats.
+  inline bool convertWith(SwsContext *sws,
+                          std::vector<uint32_t> &tmp,
+                          const uint8_t * const srcData[],
+                          const int srcStride[],
+                          uint8_t * const dstData[],
+                          const int dstStride[])
+  {
+    const uint8_t * src[4] = { 0, 0, 0, 0 } ;
+    int srcLinesize[4] = { 0, 0, 0, 0 } ;
+    for (int i=0 ; i<srcPlanes ; i++) {
+      src[i] = srcData[i] ;
+      srcLinesize[i] = srcStride[i] ;
+    }
+    
+    if (this->srcPremultiplied) {
+      tmp.resize( size_t(srcW)*srcH ) ;
+      pixops::unpremultiply_image(src[0], srcLinesize[0],
+                                  tmp.data(), 4*srcW,
+                                  srcW, srcH) ;
+      src[0] = (const uint8_t*) tmp.data() ;
+      srcLinesize[0] = 4*srcW ;
+    }
+    
+    int n = sws_scale( sws,
+                       src,
+                       srcLinesize,
                        0, this->srcH,
-                       (uint8_t**) &dstData,
-                       &dstStride
+                       dstData,
+                       dstStride
                        );
-    return (n==this->srcH) ;
-                       
+    
+    if (this->dstPremultiplied) {
+      pixops::premultiply_image(dstData[0], dstStride[0],
+                                dstData[0], dstStride[0],
+                                dstW, dstH) ;
+    }
+    
+    // sws_scale() returns the height of the output slice. 
+    return (n==this->dstH) ;
+  }
+
+  inline void checkSrcFrame(const AVFrame *srcFrame) const
+  {
+    assert( this->srcFormat == AVPixelFormat(srcFrame->format) ) ;
+    assert( this->srcW == srcFrame->width ) ;
+    assert( this->srcH == srcFrame->height ) ;
   }
   
-  inline bool convertPackedToFrame(void *srcData, int srcStride, AVFrame *dstFrame)
+  inline void checkDstFrame(const AVFrame *dstFrame) const
   {
     assert( this->dstFormat == AVPixelFormat(dstFrame->format) ) ;
     assert( this->dstW == dstFrame->width ) ;
     assert( this->dstH == dstFrame->height ) ;
+  }
+  
+public:
+      
+  inline bool convertFrameToPacked(AVFrame *srcFrame, void *dstData, int dstStride)
+  {
+    checkSrcFrame(srcFrame) ;
+    assert( this->dstPlanes == 1) ;
+    uint8_t *dst = (uint8_t*) dstData ;
+    return convertWith(this->ctx, scratch, srcFrame->data, srcFrame->linesize, &dst, &dstStride) ;
+  }
+  
+  inline bool convertPackedToFrame(void *srcData, int srcStride, AVFrame *dstFrame)
+  {
+    checkDstFrame(dstFrame) ;
     assert( this->srcPlanes == 1) ;
-            
-    int n = sws_scale( this->ctx,
-                       (uint8_t**) &srcData,
-                       &srcStride,
-                       0, this->srcH,
-                       dstFrame->data,
-                       dstFrame->linesize
-                       );
-    return (n==this->srcH) ;
+    const uint8_t *src = (const uint8_t*) srcData ;
+    return convertWith(this->ctx, scratch, &src, &srcStride, dstFrame->data, dstFrame->linesize) ;
+  }
+
+  // Convert a frame to an arbitrary destination described by
+  // per-plane arrays (as in sws_scale). Only the first dstPlanes
+  // entries of dstData and dstStride are used.
+  //
+  // This is typically used to obtain planar YUV data without
+  // going through an intermediate RGB image.
+  inline bool convertFrameToPlanes(AVFrame *srcFrame, uint8_t * const dstData[], const int dstStride[])
+  {
+    checkSrcFrame(srcFrame) ;
+    return convertWith(this->ctx, scratch, srcFrame->data, srcFrame->linesize, dstData, dstStride) ;
+  }
+
+  // Convert from an arbitrary source described by per-plane
+  // arrays to a frame. Only the first srcPlanes entries of
+  // srcData and srcStride are used.
+  inline bool convertPlanesToFrame(const uint8_t * const srcData[], const int srcStride[], AVFrame *dstFrame)
+  {
+    checkDstFrame(dstFrame) ;
+    return convertWith(this->ctx, scratch, srcData, srcStride, dstFrame->data, dstFrame->linesize) ;
   }
   
   inline bool convertFrameToFrame(AVFrame *srcFrame, AVFrame *dstFrame)
   {
-    assert( this->srcFormat == AVPixelFormat(srcFrame->format) ) ;
-    assert( this->srcW == srcFrame->width ) ;
-    assert( this->srcH == srcFrame->height ) ;
+    checkSrcFrame(srcFrame) ;
+    checkDstFrame(dstFrame) ;
+    return convertWith(this->ctx, scratch, srcFrame->data, srcFrame->linesize, dstFrame->data, dstFrame->linesize) ;
+  }
 
-    assert( this->dstFormat == AVPixelFormat(dstFrame->format) ) ;
-    assert( this->dstW == dstFrame->width ) ;
-    assert( this->dstH == dstFrame->height ) ;
-    
-    int n = sws_scale( this->ctx,
-                       srcFrame->data,
-                       srcFrame->linesize,
-                       0, this->srcH,
-                       dstFrame->data,
-                       dstFrame->linesize
-                       );
+  //
+  // Convert srcFrames[i] into dstFrames[i] for all i.
+  //
+  // The frames are distributed over ntasks tasks executed by the
+  // ThreadPool (0 means one per worker of the pool). An SwsContext
+  // cannot be used concurrently so each extra task uses its own
+  // context. Those are created on the first call and reused by the
+  // next ones.
+  //
+  // As for the other conversion methods, a converter must not be used
+  // by two threads at the same time (but its copies can since each of
+  // them owns its contexts).
+  //
+  // Reminder: if the converter was created with filters then they
+  // must remain valid as long as the converter is used. 
+  //
+  // Return true if all conversions were successful.
+  //
+  bool convertBatch(const std::vector<AVFrame*> &srcFrames,
+                    const std::vector<AVFrame*> &dstFrames,
+                    int ntasks=0,
+                    ThreadPool &pool = ThreadPool::global())
+  {
+    assert( srcFrames.size() == dstFrames.size() ) ;
+    int count = int(srcFrames.size()) ;
+    if (ntasks<=0)
+      ntasks = pool.size() ;
+    ntasks = std::min(ntasks, count) ;
+
+    // Create the missing contexts
+    while ( int(workers.contexts.size()) < ntasks-1 ) {
+      SwsContext *sws = createContext() ;
+      if (!sws) {
+        std::cerr << "ERROR: Failed to create SWS context\n" ;
+        std::exit(1);
+      }
+      workers.contexts.emplace_back(sws, sws_freeContext) ;
+    }
+    if ( int(workers.scratches.size()) < ntasks-1 )
+      workers.scratches.resize(ntasks-1) ;
     
-    return (n==this->srcH) ;
+    std::atomic<bool> ok{true} ;
+
+    // Task k converts a contiguous range of frames. The first task
+    // uses the main context.
+    pool.parallel_for(ntasks, [&](int k) {
+        SwsContext *sws = (k==0) ? this->ctx : workers.contexts[k-1].get() ;
+        std::vector<uint32_t> &tmp = (k==0) ? this->scratch : workers.scratches[k-1] ;
+        int first = (count*k)/ntasks ;
+        int last  = (count*(k+1))/ntasks ;
+        for (int i=first ; i<last ; i++) {
+          checkSrcFrame(srcFrames[i]) ;
+          checkDstFrame(dstFrames[i]) ;
+          if (!convertWith(sws, tmp,
+                           srcFrames[i]->data, srcFrames[i]->linesize,
+                           dstFrames[i]->data, dstFrames[i]->linesize))
+            ok = false ;
+        }
+      } ) ;
+
+    return ok ;
   }
 
 };
@@ -0,0 +1,205 @@
+#include <algorithm>
+
+#include <vex/FrameCache.h>
+
+// The memory used by the buffers of a frame.
+static size_t
+frame_bytes(const AVFrame *frame)
+{
+  size_t n = 0 ;
+  for (int i=0 ; i<AV_NUM_DATA_POINTERS ; i++) {
+    if (frame->buf[i])
+      n += frame->buf[i]->size ;
+  }
+  return n ;
+}
+
+static size_t
+image_bytes(const BLImage &image)
+{
+  BLImageData data ;
+  if (image.getData(&data) != BL_SUCCESS)
+    return 0 ;
+  return size_t(data.stride < 0 ? -data.stride : data.stride) * size_t(data.size.h) ;
+}
+
+FrameCache &
+FrameCache::global()
+{
+  static FrameCache cache ;
+  return cache ;
+}
+
+void
+FrameCache::setBudget(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  m_budget = bytes ;
+  evict() ;
+}
+
+// Reminder: m_mutex must be locked
+FrameCache::List::iterator
+FrameCache::lookup(const Key &key)
+{
+  auto it = m_index.find(key) ;
+  if (it == m_index.end())
+    return m_lru.end() ;
+  // Move to the front (most recent)
+  m_lru.splice(m_lru.begin(), m_lru, it->second) ;
+  return it->second ;
+}
+
+// Reminder: m_mutex must be locked
+void
+FrameCache::insert(Node &&node)
+{
+  auto it = m_index.find(node.key) ;
+  if (it != m_index.end()) {
+    m_bytes -= it->second->bytes ;
+    m_lru.erase(it->second) ;
+    m_index.erase(it) ;
+  }
+  m_bytes += node.bytes ;
+  m_lru.push_front(std::move(node)) ;
+  m_index[m_lru.front().key] = m_lru.begin() ;
+  evict() ;
+}
+
+// Reminder: m_mutex must be locked
+//
+// The most recent frame is always kept even if it exceeds the budget.
+void
+FrameCache::evict()
+{
+  while ( m_bytes > m_budget && m_lru.size() > 1 ) {
+    Node &node = m_lru.back() ;
+    m_bytes -= node.bytes ;
+    m_index.erase(node.key) ;
+    m_lru.pop_back() ;
+    m_stats.evictions++ ;
+  }
+}
+
+void
+FrameCache::putFrame(const Key &key, const AVFrame *frame)
+{
+  AVFrame *clone = av_frame_clone(frame) ;
+  if (!clone)
+    return ;
+  Node node ;
+  node.key   = key ;
+  node.frame = std::shared_ptr<AVFrame>(clone, [](AVFrame *f) { av_frame_free(&f); } ) ;
+  node.bytes = frame_bytes(clone) ;
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  insert(std::move(node)) ;
+}
+
+void
+FrameCache::putImage(const Key &key, const BLImage &image)
+{
+  Node node ;
+  node.key   = key ;
+  node.image = image ;
+  node.bytes = image_bytes(image) ;
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  insert(std::move(node)) ;
+}
+
+std::shared_ptr<AVFrame>
+FrameCache::getFrame(const Key &key)
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  auto it = lookup(key) ;
+  if (it == m_lru.end() || !it->frame) {
+    m_stats.misses++ ;
+    return NULL ;
+  }
+  m_stats.hits++ ;
+  return it->frame ;
+}
+
+bool
+FrameCache::getImage(const Key &key, BLImage &image, bool allow_proxy)
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  int last = allow_proxy ? MAX_LEVEL : key.level ;
+  for (int level = key.level ; level <= last ; level++) {
+    auto it = lookup( key.proxy(level) ) ;
+    if (it == m_lru.end() || it->image.empty())
+      continue ;
+    if (level == key.level)
+      m_stats.hits++ ;
+    else
+      m_stats.proxy_hits++ ;
+    image = it->image ;
+    return true ;
+  }
+  m_stats.misses++ ;
+  return false ;
+}
+
+bool
+FrameCache::contains(const Key &key) const
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  return m_index.count(key) != 0 ;
+}
+
+void
+FrameCache::erase(int input)
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  for (auto it = m_lru.begin() ; it != m_lru.end() ; ) {
+    if (it->key.input == input) {
+      m_bytes -= it->bytes ;
+      m_index.erase(it->key) ;
+      it = m_lru.erase(it) ;
+    } else {
+      ++it ;
+    }
+  }
+}
+
+void
+FrameCache::clear()
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  m_index.clear() ;
+  m_lru.clear() ;
+  m_bytes = 0 ;
+}
+
+size_t
+FrameCache::size() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  return m_lru.size() ;
+}
+
+size_t
+FrameCache::bytes() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  return m_bytes ;
+}
+
+FrameCache::Stats
+FrameCache::stats() const
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  return m_stats ;
+}
+
+BLImage
+FrameCache::downscale(const BLImage &image, int level)
+{
+  int w = std::max(1, image.width()  >> level) ;
+  int h = std::max(1, image.height() >> level) ;
+  BLImage out(w, h, image.format()) ;
+  BLContext ctx(out) ;
+  ctx.setCompOp(BL_COMP_OP_SRC_COPY) ;
+  ctx.blitImage( BLRect(0, 0, w, h), image ) ;
+  ctx.end() ;
+  return out ;
+}
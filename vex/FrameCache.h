@@ -0,0 +1,147 @@
+#ifndef VEX_FRAME_CACHE_H
+#define VEX_FRAME_CACHE_H 1
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <blend2d.h>
+
+#include "FFMpegCommon.h"
+
+//
+// A cache of decoded frames shared by all inputs.
+//
+// A frame is identified by the id of its input, its pts and its level
+// (0 for the full resolution or n for a proxy downscaled by 2^n). The
+// cache can hold decoded frames (AVFrame) and converted frames (BLImage).
+// Both are reference counted so an entry is never copied: a hit only
+// adds a reference.
+//
+// The cache has a global budget in bytes. The least recently used
+// frames are evicted first when the budget is exceeded.
+//
+// All methods are thread-safe so the cache can be filled by the decoding
+// threads (see Prefetcher) and used by the rendering thread.
+//
+// Example:
+//
+//    FrameCache &cache = FrameCache::global() ;
+//    FrameCache::Key key{input, pts} ;
+//    BLImage img ;
+//    if (!cache.getImage(key, img)) {
+//      img = decode_and_convert(...) ;
+//      cache.putImage(key, img) ;
+//      cache.putImage(key.proxy(2), FrameCache::downscale(img,2)) ;
+//    }
+//
+class FrameCache {
+public:
+
+  struct Key {
+    int      input ;
+    int64_t  pts ;
+    int      level{0} ;
+
+    Key proxy(int n) const { return Key{input, pts, n} ; }
+
+    bool operator==(const Key &other) const {
+      return input==other.input && pts==other.pts && level==other.level ;
+    }
+  } ;
+
+  struct Stats {
+    uint64_t hits{0} ;
+    uint64_t proxy_hits{0} ;  // A proxy was used instead of the full frame
+    uint64_t misses{0} ;
+    uint64_t evictions{0} ;
+  } ;
+
+  // The maximum proxy level searched by getImage()
+  static constexpr int MAX_LEVEL = 4 ;
+
+private:
+
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      uint64_t h = uint64_t(k.pts) * 0x9E3779B97F4A7C15ull ;
+      h ^= (uint64_t(uint32_t(k.input)) << 8) ^ uint64_t(k.level) ;
+      return size_t(h ^ (h >> 29)) ;
+    }
+  } ;
+
+  struct Node {
+    Key                       key ;
+    std::shared_ptr<AVFrame>  frame ;
+    BLImage                   image ;
+    size_t                    bytes ;
+  } ;
+
+  typedef std::list<Node> List ;
+
+  mutable std::mutex                              m_mutex ;
+  List                                            m_lru ;     // most recent first
+  std::unordered_map<Key, List::iterator, KeyHash> m_index ;
+  size_t                                          m_budget ;
+  size_t                                          m_bytes{0} ;
+  Stats                                           m_stats ;
+
+public:
+
+  explicit FrameCache(size_t budget = size_t(512) << 20) : m_budget(budget) { }
+
+  FrameCache(const FrameCache &) = delete ;
+  FrameCache & operator=(const FrameCache &) = delete ;
+
+  // Change the budget (in bytes) and evict as needed.
+  void setBudget(size_t bytes) ;
+
+  size_t budget() const {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    return m_budget ;
+  }
+
+  // Store a new reference to a decoded frame (so the caller keeps its own
+  // reference).
+  void putFrame(const Key &key, const AVFrame *frame) ;
+
+  // Store a converted frame.
+  void putImage(const Key &key, const BLImage &image) ;
+
+  // Get a decoded frame or NULL if it is not in the cache.
+  std::shared_ptr<AVFrame> getFrame(const Key &key) ;
+
+  // Get a converted frame. If allow_proxy is set and the frame is not
+  // available at the requested level then the closest proxy with a
+  // higher level is provided instead.
+  //
+  // Return false if nothing was found.
+  bool getImage(const Key &key, BLImage &image, bool allow_proxy=false) ;
+
+  // Tell if the key is in the cache (without updating the LRU order).
+  bool contains(const Key &key) const ;
+
+  // Discard all the frames of an input.
+  void erase(int input) ;
+
+  void clear() ;
+
+  size_t size() const ;
+  size_t bytes() const ;
+  Stats stats() const ;
+
+  // Create a proxy of an image downscaled by 2^level.
+  static BLImage downscale(const BLImage &image, int level) ;
+
+  // A cache shared by the whole application (created at first use).
+  static FrameCache & global() ;
+
+private:
+
+  void insert(Node &&node) ;
+  void evict() ;
+  List::iterator lookup(const Key &key) ;
+} ;
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef VEX_INTERVAL_TREE_H
+#define VEX_INTERVAL_TREE_H 1
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+//
+// A static index of half-open intervals [start,end) for the stabbing
+// queries (i.e. find all intervals containing a given point) in
+// O(log n + k) where k is the number of results.
+//
+// The intervals are sorted by start and the sorted array is used as an
+// implicit balanced binary search tree (the root of a range is its middle
+// element) augmented with the maximum end in each subtree.
+//
+// The intervals are first added and the index must then be built before
+// any query. Adding more intervals requires another build.
+//
+// Example:
+//
+//    IntervalTree<int64_t,size_t> index ;
+//    index.add(1000, 2500, 0) ;
+//    index.add(2000, 4000, 1) ;
+//    index.build() ;
+//    std::vector<size_t> found ;
+//    index.query(2200, found) ;   // found = { 0, 1 }
+//
+template <typename Key, typename Value>
+class IntervalTree {
+public:
+
+  struct Interval {
+    Key   start ;
+    Key   end ;    // excluded
+    Value value ;
+  } ;
+
+private:
+
+  std::vector<Interval> m_items ;
+  std::vector<Key>      m_max_end ;   // the max end in the subtree rooted at each index
+  bool                  m_built{true} ;
+
+public:
+
+  void clear() {
+    m_items.clear() ;
+    m_max_end.clear() ;
+    m_built = true ;
+  }
+
+  void add(Key start, Key end, Value value) {
+    m_items.push_back( Interval{start, end, value} ) ;
+    m_built = false ;
+  }
+
+  bool built() const { return m_built; }
+
+  size_t size() const { return m_items.size(); }
+
+  // Sort the intervals and compute the subtree bounds.
+  void build() {
+    std::stable_sort(m_items.begin(), m_items.end(),
+                     [](const Interval &a, const Interval &b) { return a.start < b.start; } ) ;
+    m_max_end.resize(m_items.size()) ;
+    if (!m_items.empty())
+      compute(0, m_items.size()) ;
+    m_built = true ;
+  }
+
+  // Append the values of all intervals containing point to out
+  // (ordered by start).
+  void query(const Key &point, std::vector<Value> &out) const {
+    check_built() ;
+    query(0, m_items.size(), point, point, true, out) ;
+  }
+
+  // Append the values of all intervals overlapping [a,b) to out
+  // (ordered by start).
+  void query(const Key &a, const Key &b, std::vector<Value> &out) const {
+    check_built() ;
+    query(0, m_items.size(), a, b, false, out) ;
+  }
+
+private:
+
+  void check_built() const {
+    if (!m_built) {
+      std::cerr << "ERROR: IntervalTree queried before build()\n" ;
+      exit(1) ;
+    }
+  }
+
+  Key compute(size_t lo, size_t hi) {
+    size_t mid = lo + (hi-lo)/2 ;
+    Key m = m_items[mid].end ;
+    if (lo < mid)
+      m = std::max(m, compute(lo, mid)) ;
+    if (mid+1 < hi)
+      m = std::max(m, compute(mid+1, hi)) ;
+    m_max_end[mid] = m ;
+    return m ;
+  }
+
+  // With point=true, search the intervals containing a (b is ignored).
+  void query(size_t lo, size_t hi, const Key &a, const Key &b, bool point,
+             std::vector<Value> &out) const {
+    if (lo >= hi)
+      return ;
+    size_t mid = lo + (hi-lo)/2 ;
+    // Nothing in that subtree ends after a.
+    if ( !(a < m_max_end[mid]) )
+      return ;
+    query(lo, mid, a, b, point, out) ;
+    const Interval &it = m_items[mid] ;
+    // The intervals in the right subtree do not start before it.
+    bool before = point ? !(a < it.start) : (it.start < b) ;
+    if (before) {
+      if (a < it.end)
+        out.push_back(it.value) ;
+      query(mid+1, hi, a, b, point, out) ;
+    }
+  }
+
+} ;
+
+#endif
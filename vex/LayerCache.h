@@ -0,0 +1,135 @@
+#ifndef VEX_LAYER_CACHE_H
+#define VEX_LAYER_CACHE_H 1
+
+#include <map>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+
+#include <blend2d.h>
+
+//
+// A cache of pre-rendered layers.
+//
+// A layer is a time-invariant drawing (a background, a grid, a static
+// logo, ...) rendered once into a BLImage and then composited with a
+// single blit.
+//
+// Each layer is identified by a key built from all the parameters
+// that affect its appearance (typically the frame size plus a few
+// application specific values). A new key means a new layer so there
+// is no need for an explicit invalidation.
+//
+// Example:
+//
+//    LayerCache cache;
+//    ...
+//    std::string key = LayerCache::key("grid", w, h);
+//    cache.blit(ctx, key, w, h, [&](BLContext &c) { draw_grid(c,w,h); });
+//
+class LayerCache {
+public:
+
+  typedef std::function<void(BLContext &)> DrawFn ;
+
+private:
+
+  struct Layer {
+    BLImage  image;
+    uint64_t last_use;
+  } ;
+
+  std::map<std::string, Layer> m_layers;
+  size_t   m_max_layers{8};
+  uint64_t m_clock{0};
+
+  static void append(std::ostringstream &) { }
+
+  template <typename T, typename... Args>
+  static void append(std::ostringstream &out, const T &v, const Args&... args) {
+    out << '|' << v ;
+    append(out, args...) ;
+  }
+
+public:
+
+  // Build a key from an arbitrary list of printable values.
+  template <typename... Args>
+  static std::string key(const Args&... args) {
+    std::ostringstream out ;
+    out << std::setprecision(17) ;
+    append(out, args...) ;
+    return out.str() ;
+  }
+
+  // Limit the number of layers kept in the cache. The least
+  // recently used layers are discarded first.
+  void setMaxLayers(size_t n) {
+    m_max_layers = std::max(size_t(1),n) ;
+    evict() ;
+  }
+
+  // Provide the w x h layer associated to key.
+  //
+  // If the layer is not in the cache then it is created (in
+  // BL_FORMAT_PRGB32, initially transparent) and drawn by fn.
+  const BLImage & get(const std::string &key, int w, int h, const DrawFn &fn)
+  {
+    auto it = m_layers.find(key) ;
+    if ( it == m_layers.end() || it->second.image.width()!=w || it->second.image.height()!=h ) {
+      Layer &layer = m_layers[key] ;
+      layer.image.create(w, h, BL_FORMAT_PRGB32) ;
+      BLContext ctx(layer.image) ;
+      ctx.clearAll() ;
+      fn(ctx) ;
+      ctx.end() ;
+      it = m_layers.find(key) ;
+    }
+    it->second.last_use = ++m_clock ;
+    evict(&it->first) ;
+    return it->second.image ;
+  }
+
+  // Composite the w x h layer associated to key at the specified
+  // position (in the current coordinate system of ctx).
+  void blit(BLContext &ctx, const std::string &key, int w, int h, const DrawFn &fn,
+            const BLPointI &at = BLPointI(0,0) )
+  {
+    ctx.blitImage(at, get(key,w,h,fn)) ;
+  }
+
+  void invalidate(const std::string &key) {
+    m_layers.erase(key) ;
+  }
+
+  void clear() {
+    m_layers.clear() ;
+  }
+
+  size_t size() const {
+    return m_layers.size() ;
+  }
+
+private:
+
+  // Discard the least recently used layers (except keep).
+  void evict(const std::string *keep=nullptr)
+  {
+    while ( m_layers.size() > m_max_layers ) {
+      auto oldest = m_layers.end() ;
+      for (auto it=m_layers.begin() ; it!=m_layers.end() ; ++it) {
+        if (keep && it->first == *keep)
+          continue ;
+        if (oldest==m_layers.end() || it->second.last_use < oldest->second.last_use)
+          oldest = it ;
+      }
+      if (oldest==m_layers.end())
+        break ;
+      m_layers.erase(oldest) ;
+    }
+  }
+
+} ;
+
+#endif
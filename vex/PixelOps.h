@@ -0,0 +1,308 @@
+#ifndef VEX_PIXEL_OPS_H
+#define VEX_PIXEL_OPS_H 1
+
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//
+// Low level pixel kernels operating on rows of packed 32bit pixels
+// with 8bit components and the alpha channel stored in the last byte
+// of each pixel (so BL_FORMAT_PRGB32 on a little endian host and the
+// FFMpeg formats AV_PIX_FMT_BGRA and AV_PIX_FMT_RGBA).
+//
+// Blend2D renders premultiplied pixels (BL_FORMAT_PRGB32) while most
+// FFMpeg formats with alpha are straight. Those kernels provide the
+// conversions in both directions.
+//
+// The SSE2 implementation processes 4 pixels at a time and produces
+// exactly the same results as the scalar fallback. Blocks of fully
+// opaque pixels are detected and left untouched since both conversions
+// are the identity when alpha is 255.
+//
+// All kernels accept src==dst (in-place conversion).
+//
+namespace pixops {
+
+  // Exact rounded division by 255 of a value in [0,255*255]
+  inline uint32_t div255(uint32_t v)
+  {
+    v += 128 ;
+    return (v + (v >> 8)) >> 8 ;
+  }
+
+  // Straight to premultiplied alpha (scalar version for a single pixel).
+  inline uint32_t premultiply_pixel(uint32_t p)
+  {
+    uint32_t a = p >> 24 ;
+    if (a==255) return p ;
+    uint32_t c0 = div255(( p        & 0xFF) * a) ;
+    uint32_t c1 = div255(((p >>  8) & 0xFF) * a) ;
+    uint32_t c2 = div255(((p >> 16) & 0xFF) * a) ;
+    return (a << 24) | (c2 << 16) | (c1 << 8) | c0 ;
+  }
+
+  // Premultiplied to straight alpha (scalar version for a single pixel).
+  //
+  // The computation is done with floats in order to match the SIMD
+  // version bit for bit. A fully transparent pixel becomes 0.
+  inline uint32_t unpremultiply_pixel(uint32_t p)
+  {
+    uint32_t a = p >> 24 ;
+    if (a==255) return p ;
+    if (a==0)   return 0 ;
+    float scale = 255.0f / float(a) ;
+    uint32_t c[3] ;
+    for (int i=0;i<3;i++) {
+      float v = float((p >> (8*i)) & 0xFF) * scale + 0.5f ;
+      c[i] = (v >= 255.0f) ? 255 : uint32_t(v) ;
+    }
+    return (a << 24) | (c[2] << 16) | (c[1] << 8) | c[0] ;
+  }
+
+  // Convert n pixels from straight to premultiplied alpha.
+  inline void premultiply_row(const uint32_t *src, uint32_t *dst, int n)
+  {
+    int i=0;
+#if defined(__SSE2__)
+    const __m128i zero    = _mm_setzero_si128() ;
+    const __m128i amask8  = _mm_set1_epi32(0xFF000000) ;
+    const __m128i cmask16 = _mm_set_epi16(0,-1,-1,-1, 0,-1,-1,-1) ;
+    const __m128i a255_16 = _mm_set_epi16(255,0,0,0, 255,0,0,0) ;
+    const __m128i k128    = _mm_set1_epi16(128) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src+i)) ;
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v,amask8),amask8)) == 0xFFFF) {
+        if (src!=dst) _mm_storeu_si128((__m128i*)(dst+i), v) ;
+        continue ;
+      }
+      __m128i lo = _mm_unpacklo_epi8(v,zero) ;
+      __m128i hi = _mm_unpackhi_epi8(v,zero) ;
+      // Broadcast the alpha of each pixel to its 4 lanes but multiply
+      // the alpha lane itself by 255 so that it is preserved.
+      __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo,_MM_SHUFFLE(3,3,3,3)),_MM_SHUFFLE(3,3,3,3)) ;
+      __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi,_MM_SHUFFLE(3,3,3,3)),_MM_SHUFFLE(3,3,3,3)) ;
+      alo = _mm_or_si128(_mm_and_si128(alo,cmask16),a255_16) ;
+      ahi = _mm_or_si128(_mm_and_si128(ahi,cmask16),a255_16) ;
+      lo = _mm_add_epi16(_mm_mullo_epi16(lo,alo),k128) ;
+      hi = _mm_add_epi16(_mm_mullo_epi16(hi,ahi),k128) ;
+      lo = _mm_srli_epi16(_mm_add_epi16(lo,_mm_srli_epi16(lo,8)),8) ;
+      hi = _mm_srli_epi16(_mm_add_epi16(hi,_mm_srli_epi16(hi,8)),8) ;
+      _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(lo,hi)) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      dst[i] = premultiply_pixel(src[i]) ;
+    }
+  }
+
+  // Convert n pixels from premultiplied to straight alpha.
+  inline void unpremultiply_row(const uint32_t *src, uint32_t *dst, int n)
+  {
+    int i=0;
+#if defined(__SSE2__)
+    const __m128i zero    = _mm_setzero_si128() ;
+    const __m128i amask8  = _mm_set1_epi32(0xFF000000) ;
+    const __m128  k255    = _mm_set1_ps(255.0f) ;
+    const __m128  khalf   = _mm_set1_ps(0.5f) ;
+    const __m128  kzero   = _mm_setzero_ps() ;
+    // Scale applied to the alpha lane (so alpha is preserved)
+    const __m128  alane   = _mm_castsi128_ps(_mm_set_epi32(-1,0,0,0)) ;
+    const __m128  kone    = _mm_set1_ps(1.0f) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src+i)) ;
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v,amask8),amask8)) == 0xFFFF) {
+        if (src!=dst) _mm_storeu_si128((__m128i*)(dst+i), v) ;
+        continue ;
+      }
+      __m128i lo = _mm_unpacklo_epi8(v,zero) ;
+      __m128i hi = _mm_unpackhi_epi8(v,zero) ;
+      __m128i px[4] = {
+        _mm_unpacklo_epi16(lo,zero),
+        _mm_unpackhi_epi16(lo,zero),
+        _mm_unpacklo_epi16(hi,zero),
+        _mm_unpackhi_epi16(hi,zero)
+      } ;
+      for (int k=0;k<4;k++) {
+        __m128 f = _mm_cvtepi32_ps(px[k]) ;
+        __m128 a = _mm_shuffle_ps(f,f,_MM_SHUFFLE(3,3,3,3)) ;
+        __m128 s = _mm_div_ps(k255,a) ;
+        // alpha==0 produces a fully transparent black pixel
+        s = _mm_and_ps(s, _mm_cmpneq_ps(a,kzero)) ;
+        s = _mm_or_ps(_mm_andnot_ps(alane,s), _mm_and_ps(alane,kone)) ;
+        f = _mm_add_ps(_mm_mul_ps(f,s),khalf) ;
+        f = _mm_min_ps(f,k255) ;
+        px[k] = _mm_cvttps_epi32(f) ;
+      }
+      lo = _mm_packs_epi32(px[0],px[1]) ;
+      hi = _mm_packs_epi32(px[2],px[3]) ;
+      _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(lo,hi)) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      dst[i] = unpremultiply_pixel(src[i]) ;
+    }
+  }
+
+  //
+  // Compositing kernels on premultiplied pixels (BL_FORMAT_PRGB32).
+  //
+  // As above, the SSE2 versions process 4 pixels at a time and match
+  // the scalar versions bit for bit.
+  //
+
+  // Porter-Duff SRC_OVER of a single premultiplied pixel: s + d*(1-sa)
+  inline uint32_t over_pixel(uint32_t s, uint32_t d)
+  {
+    uint32_t ia = 255 - (s >> 24) ;
+    uint32_t r = 0 ;
+    for (int i=0;i<32;i+=8) {
+      // Reminder: The saturation only matters for invalid premultiplied pixels. 
+      uint32_t c = ((s >> i) & 0xFF) + div255(((d >> i) & 0xFF) * ia) ;
+      r |= (c > 255 ? 255 : c) << i ;
+    }
+    return r ;
+  }
+
+  // Multiply all the components of a premultiplied pixel by alpha/255.
+  inline uint32_t fade_pixel(uint32_t p, uint32_t alpha)
+  {
+    uint32_t r = 0 ;
+    for (int i=0;i<32;i+=8) {
+      r |= div255(((p >> i) & 0xFF) * alpha) << i ;
+    }
+    return r ;
+  }
+
+  // Linear interpolation between two pixels with t in [0,255].
+  inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t t)
+  {
+    uint32_t r = 0 ;
+    for (int i=0;i<32;i+=8) {
+      r |= div255(((a >> i) & 0xFF) * (255-t) + ((b >> i) & 0xFF) * t) << i ;
+    }
+    return r ;
+  }
+
+#if defined(__SSE2__)
+  // The SSE2 version of div255() for 8 lanes of 16bit.
+  inline __m128i div255_epi16(__m128i v)
+  {
+    v = _mm_add_epi16(v,_mm_set1_epi16(128)) ;
+    return _mm_srli_epi16(_mm_add_epi16(v,_mm_srli_epi16(v,8)),8) ;
+  }
+
+  // Broadcast the alpha of 2 pixels unpacked to 16bit lanes.
+  inline __m128i alpha_epi16(__m128i v)
+  {
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v,_MM_SHUFFLE(3,3,3,3)),_MM_SHUFFLE(3,3,3,3)) ;
+  }
+#endif
+
+  // Composite n src pixels over the dst pixels (dst = src OVER dst).
+  inline void over_row(const uint32_t *src, uint32_t *dst, int n)
+  {
+    int i=0;
+#if defined(__SSE2__)
+    const __m128i zero    = _mm_setzero_si128() ;
+    const __m128i amask8  = _mm_set1_epi32(0xFF000000) ;
+    const __m128i k255    = _mm_set1_epi16(255) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128i s = _mm_loadu_si128((const __m128i*)(src+i)) ;
+      __m128i sa = _mm_and_si128(s,amask8) ;
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(sa,zero)) == 0xFFFF) 
+        continue ; // fully transparent source
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(sa,amask8)) == 0xFFFF) {
+        _mm_storeu_si128((__m128i*)(dst+i), s) ;
+        continue ; // fully opaque source
+      }
+      __m128i d = _mm_loadu_si128((const __m128i*)(dst+i)) ;
+      __m128i slo = _mm_unpacklo_epi8(s,zero) ;
+      __m128i shi = _mm_unpackhi_epi8(s,zero) ;
+      __m128i dlo = _mm_unpacklo_epi8(d,zero) ;
+      __m128i dhi = _mm_unpackhi_epi8(d,zero) ;
+      dlo = div255_epi16(_mm_mullo_epi16(dlo,_mm_sub_epi16(k255,alpha_epi16(slo)))) ;
+      dhi = div255_epi16(_mm_mullo_epi16(dhi,_mm_sub_epi16(k255,alpha_epi16(shi)))) ;
+      __m128i r = _mm_packus_epi16(_mm_add_epi16(slo,dlo),_mm_add_epi16(shi,dhi)) ;
+      _mm_storeu_si128((__m128i*)(dst+i), r) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      dst[i] = over_pixel(src[i],dst[i]) ;
+    }
+  }
+
+  // Multiply n premultiplied pixels by alpha/255 (alpha in [0,255]).
+  inline void fade_row(const uint32_t *src, uint32_t *dst, int n, uint32_t alpha)
+  {
+    int i=0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128() ;
+    const __m128i ka   = _mm_set1_epi16(short(alpha)) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src+i)) ;
+      __m128i lo = div255_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(v,zero),ka)) ;
+      __m128i hi = div255_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(v,zero),ka)) ;
+      _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(lo,hi)) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      dst[i] = fade_pixel(src[i],alpha) ;
+    }
+  }
+
+  // Linear interpolation dst = a*(1-t) + b*t with t in [0,255].
+  inline void lerp_row(const uint32_t *a, const uint32_t *b, uint32_t *dst, int n, uint32_t t)
+  {
+    int i=0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128() ;
+    const __m128i kt   = _mm_set1_epi16(short(t)) ;
+    const __m128i kit  = _mm_set1_epi16(short(255-t)) ;
+    for ( ; i+4<=n ; i+=4) {
+      __m128i va = _mm_loadu_si128((const __m128i*)(a+i)) ;
+      __m128i vb = _mm_loadu_si128((const __m128i*)(b+i)) ;
+      // Reminder: 255*255 fits in an unsigned 16bit lane
+      __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va,zero),kit),
+                                 _mm_mullo_epi16(_mm_unpacklo_epi8(vb,zero),kt)) ;
+      __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va,zero),kit),
+                                 _mm_mullo_epi16(_mm_unpackhi_epi8(vb,zero),kt)) ;
+      _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(div255_epi16(lo),div255_epi16(hi))) ;
+    }
+#endif
+    for ( ; i<n ; i++) {
+      dst[i] = lerp_pixel(a[i],b[i],t) ;
+    }
+  }
+
+  // Apply premultiply_row() to all rows of an image.
+  // The strides are in bytes.
+  inline void premultiply_image(const void *src, int srcStride,
+                                void *dst, int dstStride,
+                                int w, int h)
+  {
+    const uint8_t *s = (const uint8_t *) src ;
+    uint8_t *d = (uint8_t *) dst ;
+    for (int y=0;y<h;y++, s+=srcStride, d+=dstStride) {
+      premultiply_row((const uint32_t*)s, (uint32_t*)d, w) ;
+    }
+  }
+
+  // Apply unpremultiply_row() to all rows of an image.
+  // The strides are in bytes.
+  inline void unpremultiply_image(const void *src, int srcStride,
+                                  void *dst, int dstStride,
+                                  int w, int h)
+  {
+    const uint8_t *s = (const uint8_t *) src ;
+    uint8_t *d = (uint8_t *) dst ;
+    for (int y=0;y<h;y++, s+=srcStride, d+=dstStride) {
+      unpremultiply_row((const uint32_t*)s, (uint32_t*)d, w) ;
+    }
+  }
+
+} // of namespace pixops
+
+#endif
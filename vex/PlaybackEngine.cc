@@ -0,0 +1,260 @@
+#include <cmath>
+#include <iostream>
+
+#include <vex/PlaybackEngine.h>
+
+PlaybackEngine::PlaybackEngine(int width, int height,
+                               int rate_num, int rate_den,
+                               Renderer renderer,
+                               size_t queue_size,
+                               uint32_t format) :
+  m_width(width),
+  m_height(height),
+  m_format(format),
+  m_rate_num(rate_num),
+  m_rate_den(rate_den),
+  m_queue_size(std::max(size_t(1), queue_size)),
+  m_renderer(renderer)
+{
+  if ( rate_num <= 0 || rate_den <= 0 ) {
+    std::cerr << "Invalid playback frame rate " << rate_num << "/" << rate_den << "\n" ;
+    exit(1) ;
+  }
+}
+
+PlaybackEngine::~PlaybackEngine()
+{
+  stop() ;
+}
+
+void
+PlaybackEngine::start()
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  if (!m_stop)
+    return ;
+  m_stop = false ;
+  m_render_thread = std::thread( [this] { renderLoop(); } ) ;
+  if (m_decoder)
+    m_decode_thread = std::thread( [this] { decodeLoop(); } ) ;
+}
+
+void
+PlaybackEngine::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_stop = true ;
+  }
+  m_cv.notify_all() ;
+  if (m_render_thread.joinable())
+    m_render_thread.join() ;
+  if (m_decode_thread.joinable())
+    m_decode_thread.join() ;
+}
+
+int64_t
+PlaybackEngine::frameAt(double t) const
+{
+  // The epsilon avoids showing the previous frame at the exact time of
+  // a frame because of the rounding errors.
+  return int64_t( std::floor( t * m_rate_num / m_rate_den + 1e-9 ) ) ;
+}
+
+// Discard the queued frames and the frame being rendered (if any).
+void
+PlaybackEngine::flush()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_generation++ ;
+    for (Frame &frame : m_ready)
+      m_free.push_back( std::move(frame.image) ) ;
+    m_ready.clear() ;
+    m_last_rendered = -1 ;
+    m_last_due = -1 ;
+  }
+  m_cv.notify_all() ;
+}
+
+void
+PlaybackEngine::play(double speed)
+{
+  m_clock.play(speed) ;
+  flush() ;
+}
+
+void
+PlaybackEngine::pause()
+{
+  m_clock.pause() ;
+  flush() ;
+}
+
+void
+PlaybackEngine::seek(double t)
+{
+  m_clock.seek(t) ;
+  flush() ;
+}
+
+// Reminder: m_mutex must be locked
+//
+// Find the next frame to render (if any). The frames already late are
+// skipped.
+bool
+PlaybackEngine::nextIndex(int64_t &index)
+{
+  if ( m_ready.size() >= m_queue_size )
+    return false ;
+
+  double  speed = m_clock.speed() ;
+  int64_t due   = frameAt( m_clock.now() ) ;
+
+  if (speed == 0) {
+    if (m_last_rendered == due)
+      return false ;
+    index = due ;
+    return true ;
+  }
+
+  if (m_last_rendered < 0) {
+    index = due ;
+  } else if (speed > 0) {
+    index = m_last_rendered + 1 ;
+    if (index < due) {
+      m_stats.dropped += due - index ;
+      index = due ;
+    }
+  } else {
+    index = m_last_rendered - 1 ;
+    if (index > due) {
+      m_stats.dropped += index - due ;
+      index = due ;
+    }
+  }
+  return index >= 0 ;
+}
+
+void
+PlaybackEngine::renderLoop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex) ;
+  while (!m_stop) {
+    int64_t index ;
+    if (!nextIndex(index)) {
+      // Also wake up from time to time to follow the clock
+      m_cv.wait_for(lock, std::chrono::milliseconds(5)) ;
+      continue ;
+    }
+
+    Frame frame ;
+    frame.index      = index ;
+    frame.time       = frameTime(index) ;
+    frame.generation = m_generation ;
+    if (!m_free.empty()) {
+      frame.image = std::move(m_free.back()) ;
+      m_free.pop_back() ;
+    }
+    m_last_rendered = index ;
+    // The decoder prepares the frame that will be rendered once the
+    // queue is full again (in the playing direction).
+    if (m_decoder) {
+      double speed = m_clock.speed() ;
+      int64_t ahead = (speed > 0) ? int64_t(m_queue_size) : (speed < 0) ? -int64_t(m_queue_size) : 0 ;
+      m_decode_index = std::max(int64_t(0), index + ahead) ;
+    }
+    m_cv.notify_all() ;
+    lock.unlock() ;
+
+    if (frame.image.empty())
+      frame.image.create(m_width, m_height, m_format) ;
+    frame.started = Clock::now() ;
+    m_renderer(frame.image, frame.time) ;
+
+    lock.lock() ;
+    if (frame.generation != m_generation) {
+      // A clock action happened during the rendering
+      m_free.push_back( std::move(frame.image) ) ;
+      continue ;
+    }
+    m_stats.rendered++ ;
+    m_ready.push_back( std::move(frame) ) ;
+  }
+}
+
+// The decoder only follows the most recent lookahead frame so it never
+// lags behind the render thread by more than one call.
+void
+PlaybackEngine::decodeLoop()
+{
+  std::unique_lock<std::mutex> lock(m_mutex) ;
+  int64_t done = -1 ;
+  while (true) {
+    m_cv.wait(lock, [&] { return m_stop || m_decode_index != done; } ) ;
+    if (m_stop)
+      break ;
+    done = m_decode_index ;
+    lock.unlock() ;
+    m_decoder( frameTime(done) ) ;
+    lock.lock() ;
+  }
+}
+
+bool
+PlaybackEngine::acquire(Frame &frame)
+{
+  std::unique_lock<std::mutex> lock(m_mutex) ;
+
+  double  speed = m_clock.speed() ;
+  int64_t due   = frameAt( m_clock.now() ) ;
+
+  // Take the most recent frame that is due (or the paused frame)
+  bool  found = false ;
+  Frame best ;
+  while (!m_ready.empty()) {
+    Frame &next = m_ready.front() ;
+    if ( speed > 0 && next.index > due )
+      break ;
+    if ( speed < 0 && next.index < due )
+      break ;
+    if (found) {
+      m_stats.dropped++ ;
+      m_free.push_back( std::move(best.image) ) ;
+    }
+    best  = std::move(next) ;
+    found = true ;
+    m_ready.pop_front() ;
+  }
+
+  if (!found) {
+    if ( speed != 0 && due != m_last_due && due != frame.index )
+      m_stats.repeated++ ;
+    m_last_due = due ;
+    return false ;
+  }
+  m_last_due = due ;
+
+  double latency = std::chrono::duration<double,std::milli>(Clock::now() - best.started).count() ;
+  m_latency_sum += latency ;
+  m_stats.latency_max_ms = std::max(m_stats.latency_max_ms, latency) ;
+  m_stats.presented++ ;
+
+  if (!frame.image.empty())
+    m_free.push_back( std::move(frame.image) ) ;
+  frame = std::move(best) ;
+
+  lock.unlock() ;
+  m_cv.notify_all() ;
+  return true ;
+}
+
+PlaybackEngine::Stats
+PlaybackEngine::stats()
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  Stats stats = m_stats ;
+  if (stats.presented > 0)
+    stats.latency_avg_ms = m_latency_sum / stats.presented ;
+  return stats ;
+}
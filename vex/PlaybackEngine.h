@@ -0,0 +1,231 @@
+#ifndef VEX_PLAYBACK_ENGINE_H
+#define VEX_PLAYBACK_ENGINE_H 1
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <blend2d.h>
+
+#include "Timestamp.h"
+
+//
+// The master clock of a playback.
+//
+// The clock provides the playback time in seconds. It advances at the
+// playback speed (negative for a reverse playback and 0 when paused)
+// and never goes below 0.
+//
+// All methods are thread-safe.
+//
+class PlaybackClock {
+public:
+  typedef std::chrono::steady_clock Clock ;
+
+private:
+  mutable std::mutex  m_mutex ;
+  Clock::time_point   m_ref_point ;   // The real time point reference
+  double              m_ref_time{0} ; // The playback time at m_ref_point
+  double              m_speed{0} ;
+
+  double at(const Clock::time_point &tp) const {
+    double dt = std::chrono::duration<double>(tp - m_ref_point).count() ;
+    return std::max(0.0, m_ref_time + m_speed * dt) ;
+  }
+
+public:
+
+  PlaybackClock() : m_ref_point(Clock::now()) { }
+
+  // The current playback time.
+  double now() const {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    return at(Clock::now()) ;
+  }
+
+  double speed() const {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    return m_speed ;
+  }
+
+  bool paused() const { return speed() == 0.0 ; }
+
+  // Continue from the current time at a new speed.
+  void play(double speed = 1.0) {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    Clock::time_point tp = Clock::now() ;
+    m_ref_time  = at(tp) ;
+    m_ref_point = tp ;
+    m_speed     = speed ;
+  }
+
+  void pause() { play(0.0) ; }
+
+  // Jump to a new time (keeping the speed).
+  void seek(double t) {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_ref_point = Clock::now() ;
+    m_ref_time  = std::max(0.0, t) ;
+  }
+} ;
+
+
+//
+// A real-time playback engine producing the frames of a composition at
+// a fixed frame rate.
+//
+// The work is split over three threads:
+//   - the decode thread calls the decoder (if any) with the time of the
+//     frame queue_size frames after the one being rendered (in the
+//     playing direction). This is typically Prefetcher::update() so
+//     the readers are opened and warmed ahead of the rendering.
+//   - the render thread calls the renderer for the next frames and
+//     queues them. It renders ahead of the clock until the queue is full.
+//   - the presenter (the caller of acquire(), usually the main thread
+//     because of the display API) takes the frame due at the clock time.
+//
+// The PlaybackClock is the master: the frames are never presented early
+// and the engine catches up when it is late. The render thread skips
+// the frames whose time is already past and acquire() discards the
+// queued frames superseded by a more recent one (both are counted as
+// dropped). If no new frame is ready when the clock reaches a new frame
+// then the previous one stays on screen (counted as repeated).
+//
+// The images are recycled: acquire() gives back the previous image of
+// the frame so the engine does not allocate once the queue is full.
+//
+// Example:
+//
+//    PlaybackEngine engine(1920, 1080, 30, 1,
+//                          [&](BLImage &img, const Timestamp &t) { render(img,t); } ) ;
+//    engine.setDecoder( [&](const Timestamp &t) { prefetcher.update(t); } ) ;
+//    engine.start() ;
+//    engine.play(1.0) ;
+//    PlaybackEngine::Frame frame ;
+//    while (...) {
+//      if (engine.acquire(frame))
+//        display(frame.image) ;
+//      ...
+//    }
+//    engine.stop() ;
+//
+class PlaybackEngine {
+public:
+
+  typedef PlaybackClock::Clock Clock ;
+
+  // Render the frame at time t in the image (of the engine size and format).
+  typedef std::function<void(BLImage &, const Timestamp &)> Renderer ;
+
+  // Prepare the inputs for the time t.
+  typedef std::function<void(const Timestamp &)> Decoder ;
+
+  struct Frame {
+    BLImage            image ;
+    int64_t            index{-1} ;  // The frame number
+    Timestamp          time ;       // index * frame duration
+    Clock::time_point  started ;    // When its rendering started
+    uint64_t           generation{0} ;
+  } ;
+
+  struct Stats {
+    uint64_t rendered{0} ;
+    uint64_t presented{0} ;
+    uint64_t dropped{0} ;        // Skipped or rendered but never presented
+    uint64_t repeated{0} ;       // A frame was due but not ready
+    double   latency_avg_ms{0} ; // From the start of the rendering to the presentation
+    double   latency_max_ms{0} ;
+  } ;
+
+private:
+
+  int                      m_width ;
+  int                      m_height ;
+  uint32_t                 m_format ;
+  int                      m_rate_num ;
+  int                      m_rate_den ;
+  size_t                   m_queue_size ;
+  Renderer                 m_renderer ;
+  Decoder                  m_decoder ;
+
+  PlaybackClock            m_clock ;
+
+  std::mutex               m_mutex ;
+  std::condition_variable  m_cv ;          // for the render thread and the decode thread
+  std::deque<Frame>        m_ready ;       // The rendered frames in playing order
+  std::vector<BLImage>     m_free ;        // Recycled images
+  uint64_t                 m_generation{0} ; // Changed by each clock action
+  int64_t                  m_last_rendered{-1} ;
+  int64_t                  m_decode_index{-1} ;
+  int64_t                  m_last_due{-1} ;
+  bool                     m_stop{true} ;
+
+  Stats                    m_stats ;
+  double                   m_latency_sum{0} ;
+
+  std::thread              m_render_thread ;
+  std::thread              m_decode_thread ;
+
+public:
+
+  // The frame rate is rate_num/rate_den frames per second. The render
+  // thread can be at most queue_size frames ahead of the presenter.
+  PlaybackEngine(int width, int height,
+                 int rate_num, int rate_den,
+                 Renderer renderer,
+                 size_t queue_size = 3,
+                 uint32_t format = BL_FORMAT_XRGB32) ;
+
+  // Stop the threads (see stop()).
+  ~PlaybackEngine() ;
+
+  PlaybackEngine(const PlaybackEngine &) = delete ;
+  PlaybackEngine & operator=(const PlaybackEngine &) = delete ;
+
+  // Set the decode stage. Must be called before start().
+  void setDecoder(Decoder decoder) { m_decoder = decoder ; }
+
+  // Start the decode and render threads. The clock is initially paused.
+  void start() ;
+
+  // Stop the threads after the completion of the current render.
+  void stop() ;
+
+  // The clock actions. The queued frames are discarded.
+  void play(double speed = 1.0) ;
+  void pause() ;
+  void seek(double t) ;
+
+  const PlaybackClock & clock() const { return m_clock ; }
+
+  // The time of a frame and the frame displayed at time t.
+  Timestamp frameTime(int64_t index) const {
+    return Timestamp::make_main(index, m_rate_den, m_rate_num) ;
+  }
+  int64_t frameAt(double t) const ;
+
+  // Called by the presenter to get the frame due at the current clock
+  // time.
+  //
+  // Return true if a new frame was stored in frame. The previous image
+  // of frame is recycled by the engine so it must not be used anymore.
+  //
+  // Return false if frame is still the one to display.
+  bool acquire(Frame &frame) ;
+
+  Stats stats() ;
+
+private:
+
+  void flush() ;
+  bool nextIndex(int64_t &index) ;
+  void renderLoop() ;
+  void decodeLoop() ;
+} ;
+
+#endif
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <iostream>
+
+#include <vex/Prefetcher.h>
+
+PrefetchedReader::PrefetchedReader(const std::string &filename, int divisor) :
+  VideoReaderBase(filename),
+  m_divisor(std::max(1,divisor))
+{
+  m_verbosity = 0 ;
+  m_trace = false ;
+}
+
+PrefetchedReader::~PrefetchedReader()
+{
+  close() ;
+}
+
+void
+PrefetchedReader::close()
+{
+  if (m_frame) {
+    av_frame_free(&m_frame) ;
+  }
+  m_ready = false ;
+  VideoReaderBase::close() ;
+}
+
+bool
+PrefetchedReader::prepare(const Timestamp &source_time)
+{
+  m_ready = false ;
+  if (!isOpen()) {
+    if (!open() || !has_video())
+      return false ;
+  }
+  if (!m_frame) {
+    m_frame = av_frame_alloc() ;
+  }
+  av_frame_unref(m_frame) ;
+
+  AVRational tb = videoTimeBase() ;
+  m_target_pts = source_time.rescale(tb.num, tb.den, Timestamp::round_down) ;
+  if (m_video_stream->start_time != AV_NOPTS_VALUE)
+    m_target_pts += m_video_stream->start_time ;
+
+  // Avoid a seek at the very start of the file (e.g. most clips
+  // starting at their beginning).
+  if ( source_time.sign() > 0 )
+    seek_before( source_time.eval() ) ;
+  m_run_state = PSTATE_READ_PACKET ;
+
+  run() ;
+  m_ready = (m_frame->data[0] != NULL) ;
+  return m_ready ;
+}
+
+Timestamp
+PrefetchedReader::frameTime(const AVFrame *frame)
+{
+  AVRational tb = videoTimeBase() ;
+  int64_t pts = frame->pts ;
+  if (m_video_stream->start_time != AV_NOPTS_VALUE)
+    pts -= m_video_stream->start_time ;
+  return Timestamp::make_local(pts, tb.num, tb.den) ;
+}
+
+VideoReaderBase::run_proceed_t
+PrefetchedReader::onReceiveVideoFrame(AVFrame *frame)
+{
+  if ( frame->pts == AV_NOPTS_VALUE || frame->pts >= m_target_pts ) {
+    av_frame_ref(m_frame, frame) ;
+    av_frame_unref(frame) ;
+    return RUN_INTERRUPT ;
+  }
+  // Skip the frames before the target
+  av_frame_unref(frame) ;
+  return RUN_CONTINUE ;
+}
+
+
+Prefetcher::Prefetcher(std::shared_ptr<Timeline> timeline,
+                       const Timestamp &lookahead,
+                       ThreadPool &pool) :
+  m_timeline(timeline),
+  m_lookahead(lookahead),
+  m_pool(pool)
+{
+}
+
+Prefetcher::~Prefetcher()
+{
+  // The tasks are referencing the entries so they must complete.
+  for (auto &it : m_entries)
+    wait(*it.second) ;
+  for (auto &entry : m_retired)
+    wait(*entry) ;
+}
+
+void
+Prefetcher::wait(Entry &entry)
+{
+  std::unique_lock<std::mutex> lock(entry.mutex) ;
+  entry.cv.wait(lock, [&]() { return entry.done; } ) ;
+}
+
+bool
+Prefetcher::done(Entry &entry)
+{
+  std::lock_guard<std::mutex> lock(entry.mutex) ;
+  return entry.done ;
+}
+
+// Reminder: m_mutex must be locked
+//
+// The reader can be closed when its task is complete and when it is
+// not used anymore (i.e. only referenced by its entry).
+bool
+Prefetcher::closable(Entry &entry)
+{
+  return done(entry) && entry.reader.use_count() == 1 ;
+}
+
+void
+Prefetcher::prepare(const std::shared_ptr<Entry> &entry, const Timestamp &source_time)
+{
+  bool ok = entry->reader->prepare(source_time) ;
+  std::lock_guard<std::mutex> lock(entry->mutex) ;
+  entry->ok   = ok ;
+  entry->done = true ;
+  entry->cv.notify_all() ;
+}
+
+// Reminder: m_mutex must be locked
+//
+// If async is false then the caller shall call prepare() (without
+// holding m_mutex).
+std::shared_ptr<Prefetcher::Entry>
+Prefetcher::start(size_t clip, const Timestamp &source_time, bool async)
+{
+  const std::string &source = m_timeline->clip(clip).source ;
+  std::string file = m_proxies ? m_proxies->resolve(source) : source ;
+  int divisor = (file != source) ? m_proxies->divisor() : 1 ;
+  auto entry = std::make_shared<Entry>() ;
+  entry->reader = std::make_shared<PrefetchedReader>(file, divisor) ;
+  entry->target = source_time ;
+  m_entries[clip] = entry ;
+  m_stats.opened++ ;
+  if (async)
+    m_pool.submit( [entry,source_time]() { prepare(entry, source_time); } ) ;
+  return entry ;
+}
+
+void
+Prefetcher::update(const Timestamp &t)
+{
+  std::vector<size_t> wanted ;
+  m_timeline->active(t, wanted) ;
+  m_timeline->starting(t, m_lookahead, wanted) ;
+  wanted.erase( std::remove_if(wanted.begin(), wanted.end(),
+                               [this](size_t id) { return m_timeline->clip(id).source.empty(); } ),
+                wanted.end() ) ;
+  std::sort(wanted.begin(), wanted.end()) ;
+  wanted.erase( std::unique(wanted.begin(), wanted.end()), wanted.end() ) ;
+
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+
+  // Close the readers that are no longer needed. Those still running
+  // or still in use are retired until they can be closed.
+  for (auto it = m_entries.begin() ; it != m_entries.end() ; ) {
+    if ( std::binary_search(wanted.begin(), wanted.end(), it->first) ) {
+      ++it ;
+      continue ;
+    }
+    if (closable(*it->second)) {
+      it->second->reader->close() ;
+      m_stats.closed++ ;
+    } else {
+      m_retired.push_back(it->second) ;
+    }
+    it = m_entries.erase(it) ;
+  }
+  for (auto it = m_retired.begin() ; it != m_retired.end() ; ) {
+    if (closable(**it)) {
+      (*it)->reader->close() ;
+      m_stats.closed++ ;
+      it = m_retired.erase(it) ;
+    } else {
+      ++it ;
+    }
+  }
+
+  if (m_proxies) {
+    for (size_t id : wanted)
+      m_proxies->request( m_timeline->clip(id).source ) ;
+  }
+
+  // Start the new ones
+  for (size_t id : wanted) {
+    if (m_entries.count(id))
+      continue ;
+    const TimelineClip &clip = m_timeline->clip(id) ;
+    start(id, clip.sourceTime( max(t, clip.in) ), true) ;
+  }
+}
+
+std::shared_ptr<PrefetchedReader>
+Prefetcher::acquire(size_t clip, const Timestamp &t)
+{
+  const TimelineClip &c = m_timeline->clip(clip) ;
+  if (c.source.empty())
+    return NULL ;
+
+  Timestamp source_time = c.sourceTime(t) ;
+  std::shared_ptr<Entry> entry ;
+  bool miss = false ;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    auto it = m_entries.find(clip) ;
+    if (it == m_entries.end()) {
+      m_stats.misses++ ;
+      entry = start(clip, source_time, false) ;
+      miss  = true ;
+    } else {
+      entry = it->second ;
+      if (!done(*entry)) {
+        m_stats.waits++ ;
+      } else if ( source_time < entry->target && closable(*entry) ) {
+        // The reader is past t so prepare it again (the other
+        // threads calling acquire() wait for the completion). 
+        m_stats.misses++ ;
+        std::lock_guard<std::mutex> elock(entry->mutex) ;
+        entry->done   = false ;
+        entry->target = source_time ;
+        miss = true ;
+      } else {
+        m_stats.hits++ ;
+      }
+    }
+  }
+  if (miss)
+    prepare(entry, source_time) ;
+  else
+    wait(*entry) ;
+  return entry->ok ? entry->reader : NULL ;
+}
@@ -0,0 +1,179 @@
+#ifndef VEX_PREFETCHER_H
+#define VEX_PREFETCHER_H 1
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "VideoReader.h"
+#include "Timestamp.h"
+#include "Timeline.h"
+#include "ThreadPool.h"
+#include "ProxyBuilder.h"
+
+//
+// A video reader that is opened, seeked and decoded up to a target
+// time in advance.
+//
+// After prepare(), the decoder is warm and the first frame at or after
+// the target time is kept in frame().
+//
+// The reader may open the proxy of the source instead of the source
+// itself (see Prefetcher::setProxies()). The frames of a proxy are about
+// divisor() times smaller and their pts are in the time base of the
+// proxy so frameTime() shall be used instead of the pts.
+//
+class PrefetchedReader : public VideoReaderBase {
+private:
+  AVFrame *  m_frame{NULL} ;     // The first frame at or after the target
+  int64_t    m_target_pts{0} ;
+  bool       m_ready{false} ;
+  int        m_divisor ;
+public:
+
+  // A divisor greater than 1 indicates that filename is a proxy.
+  PrefetchedReader(const std::string &filename, int divisor=1) ;
+  ~PrefetchedReader() ;
+
+  // Open the file (if needed), seek before source_time and decode until
+  // the first frame at or after source_time.
+  //
+  // Return false if the file cannot be read or if no such frame exists.
+  bool prepare(const Timestamp &source_time) ;
+
+  // Tell if prepare() succeeded.
+  bool ready() const { return m_ready; }
+
+  // The frame found by prepare() (owned by the reader).
+  AVFrame * frame() { return m_frame; }
+
+  // The time of a frame of this reader relative to the start of the
+  // video stream (so the same for a proxy and its source).
+  Timestamp frameTime(const AVFrame *frame) ;
+
+  // Tell if the reader opened a proxy of the source.
+  bool isProxy() const { return m_divisor > 1; }
+
+  // The size of the source frames divided by the size of the frames
+  // of this reader (1 if this is not a proxy).
+  int divisor() const { return m_divisor; }
+
+  virtual void close() override ;
+
+protected:
+  virtual run_proceed_t onReceiveVideoFrame(AVFrame *frame) override ;
+} ;
+
+
+//
+// Open, seek and warm the readers of the clips of a Timeline ahead of
+// their use.
+//
+// update() shall be called for each rendered frame. It looks ahead on
+// the timeline and prepares the readers of the clips with a source
+// that are active or that become active within the lookahead. That is
+// done by tasks in a ThreadPool so a cut to a new clip does not stall
+// on the open+probe+seek+decode latency. The readers of the clips that
+// are no longer needed are closed once they are released by all their
+// users.
+//
+// update() and acquire() can be called from different threads (e.g.
+// the decode and render threads of a PlaybackEngine).
+//
+// Example:
+//
+//    Prefetcher prefetcher(timeline, 2_s) ;
+//    for (...) {
+//      prefetcher.update(ts) ;
+//      std::vector<size_t> active ;
+//      timeline->active(ts, active) ;
+//      for (size_t id : active) {
+//        auto reader = prefetcher.acquire(id, ts) ;
+//        ...
+//      }
+//    }
+//
+class Prefetcher {
+public:
+
+  struct Stats {
+    int opened{0} ;   // Number of readers prepared
+    int closed{0} ;   // Number of readers closed
+    int hits{0} ;     // Number of acquire() with a ready reader
+    int waits{0} ;    // Number of acquire() that waited for a pending task
+    int misses{0} ;   // Number of acquire() that prepared a reader synchronously
+  } ;
+
+private:
+
+  struct Entry {
+    std::shared_ptr<PrefetchedReader> reader ;
+    Timestamp                         target ;   // The source time of the preparation
+    std::mutex                        mutex ;
+    std::condition_variable           cv ;
+    bool                              done{false} ;
+    bool                              ok{false} ;
+  } ;
+
+  mutable std::mutex                         m_mutex ;     // protect the entries and the stats
+  std::shared_ptr<Timeline>                  m_timeline ;
+  Timestamp                                  m_lookahead ;
+  ThreadPool &                               m_pool ;
+  ProxyBuilder *                             m_proxies{NULL} ;
+  std::map<size_t, std::shared_ptr<Entry>>   m_entries ;   // by clip id
+  std::vector<std::shared_ptr<Entry>>        m_retired ;   // still running or in use
+  Stats                                      m_stats ;
+
+public:
+
+  Prefetcher(std::shared_ptr<Timeline> timeline,
+             const Timestamp &lookahead,
+             ThreadPool &pool = ThreadPool::global()) ;
+
+  // Wait for the pending tasks.
+  ~Prefetcher() ;
+
+  Prefetcher(const Prefetcher &) = delete ;
+  Prefetcher & operator=(const Prefetcher &) = delete ;
+
+  // Start the preparation of the clips needed within [t, t+lookahead)
+  // and close the others.
+  void update(const Timestamp &t) ;
+
+  // The reader of a clip. Wait if the reader is still being prepared
+  // and prepare it synchronously for the time t if it was not
+  // prefetched.
+  //
+  // A prefetched reader is prepared for the time given to update() (or
+  // the start of the clip) so usually a bit before t: the caller is
+  // expected to decode forward from its frame(). It is prepared again
+  // for the time t only when t is before that time and when the reader
+  // is not used elsewhere.
+  //
+  // Return NULL if the clip has no source or if it cannot be read.
+  std::shared_ptr<PrefetchedReader> acquire(size_t clip, const Timestamp &t) ;
+
+  Stats stats() const {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    return m_stats ;
+  }
+
+  // Use the proxies of the sources when they are ready (so for an
+  // interactive preview). The proxies of the needed clips are requested
+  // by update(). 
+  //
+  // Use NULL (the default) for the final output.
+  void setProxies(ProxyBuilder *proxies) { m_proxies = proxies; }
+
+private:
+
+  std::shared_ptr<Entry> start(size_t clip, const Timestamp &source_time, bool async) ;
+  static void prepare(const std::shared_ptr<Entry> &entry, const Timestamp &source_time) ;
+  static void wait(Entry &entry) ;
+  static bool done(Entry &entry) ;
+  static bool closable(Entry &entry) ;
+} ;
+
+#endif
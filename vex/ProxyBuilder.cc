@@ -0,0 +1,249 @@
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <csignal>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <vex/ProxyBuilder.h>
+#include <vex/VideoReader.h>
+#include <vex/VideoWriter.h>
+
+//
+// A reader writing each decoded frame, downscaled, to a VideoWriter.
+//
+// The proxy has a constant frame rate: the proxy frame n shows the
+// last source frame whose time (relatively to the start of the stream)
+// is at most n/rate. The source frames are thus duplicated or dropped
+// according to their pts.
+//
+class ProxyTranscoder : public VideoReaderBase {
+private:
+  int                    m_divisor ;
+  std::atomic<bool> &    m_stop ;
+  FFMpegFrameConverter   m_conv ;
+  VideoWriter            m_writer ;
+  std::vector<uint8_t>   m_data ;          // The last converted frame
+  int                    m_stride{0} ;
+  bool                   m_held{false} ;   // m_data contains a frame not written yet
+  int64_t                m_held_index{0} ; // The first proxy frame showing it
+  int64_t                m_next{0} ;       // The next proxy frame to write
+  AVRational             m_rate ;
+  bool                   m_failed{false} ;
+
+public:
+
+  ProxyTranscoder(const std::string &source, int divisor, std::atomic<bool> &stop) :
+    VideoReaderBase(source),
+    m_divisor(divisor),
+    m_stop(stop)
+  {
+    m_verbosity = 0 ;
+    m_trace = false ;
+    m_writer.exit_on_error = false ;
+    m_writer.verbose = false ;
+  }
+
+  bool transcode(const std::string &output)
+  {
+    if ( !open() || !has_video() )
+      return false ;
+    // The encoders usually require an even size.
+    int w = std::max(2, (frameWidth()  / m_divisor) & ~1) ;
+    int h = std::max(2, (frameHeight() / m_divisor) & ~1) ;
+    m_rate   = frameRate() ;
+    if (m_rate.num <= 0 || m_rate.den <= 0) {
+      close() ;
+      return false ;
+    }
+    m_conv   = frameScaler(w, h, AV_PIX_FMT_BGRA, SWS_FAST_BILINEAR) ;
+    m_stride = 4*w ;
+    m_data.resize( size_t(m_stride)*h ) ;
+    if ( !m_writer.open("proxy", w, h, AV_PIX_FMT_BGRA, m_rate, output) ) {
+      close() ;
+      return false ;
+    }
+    run_proceed_t status = run() ;
+    // The last frame is shown once.
+    if ( status == RUN_EOF && m_held )
+      write_until( std::max(m_next, m_held_index) + 1 ) ;
+    bool closed = m_writer.close() ;
+    close() ;
+    return status == RUN_EOF && closed && !m_failed && !m_stop ;
+  }
+
+protected:
+
+  // Write the held frame up to the proxy frame end (excluded).
+  void write_until(int64_t end)
+  {
+    for ( ; m_next < end && !m_failed ; m_next++) {
+      if (!m_writer.add_frame(m_data.data(), m_stride))
+        m_failed = true ;
+    }
+  }
+
+  virtual run_proceed_t onReceiveVideoFrame(AVFrame *frame) override
+  {
+    if (m_stop) {
+      av_frame_unref(frame) ;
+      return RUN_INTERRUPT ;
+    }
+
+    // The first proxy frame at or after the frame time.
+    int64_t index ;
+    int64_t pts = frame->best_effort_timestamp ;
+    if (pts == AV_NOPTS_VALUE) {
+      index = m_held ? m_held_index+1 : m_next ;
+    } else {
+      if (m_video_stream->start_time != AV_NOPTS_VALUE)
+        pts -= m_video_stream->start_time ;
+      index = av_rescale_q_rnd(pts, videoTimeBase(), av_inv_q(m_rate), AV_ROUND_UP) ;
+    }
+
+    // The held frame is shown until that frame (so it is dropped if it
+    // is replaced before its first proxy frame).
+    if (m_held)
+      write_until(index) ;
+    m_conv.convertFrameToPacked(frame, m_data.data(), m_stride) ;
+    m_held       = true ;
+    m_held_index = index ;
+    av_frame_unref(frame) ;
+    return m_failed ? RUN_INTERRUPT : RUN_CONTINUE ;
+  }
+} ;
+
+static bool
+file_mtime(const std::string &filename, time_t &mtime)
+{
+  struct stat st ;
+  if ( stat(filename.c_str(), &st) != 0 )
+    return false ;
+  mtime = st.st_mtime ;
+  return true ;
+}
+
+
+ProxyBuilder::ProxyBuilder(const std::string &dir, int divisor) :
+  m_dir(dir),
+  m_divisor(std::max(1,divisor))
+{
+  mkdir( m_dir.c_str(), 0755 ) ;
+  m_worker = std::thread( [this] { run(); } ) ;
+}
+
+ProxyBuilder::~ProxyBuilder()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_stop = true ;
+  }
+  m_cv.notify_all() ;
+  m_worker.join() ;
+}
+
+// The proxy name contains a hash of the full source path to avoid
+// conflicts between sources with the same basename.
+std::string
+ProxyBuilder::proxyPath(const std::string &source) const
+{
+  size_t slash = source.find_last_of('/') ;
+  std::string base = (slash == std::string::npos) ? source : source.substr(slash+1) ;
+  std::ostringstream out ;
+  out << m_dir << "/" << base << "-"
+      << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(source)
+      << std::dec << ".d" << m_divisor << ".mkv" ;
+  return out.str() ;
+}
+
+void
+ProxyBuilder::request(const std::string &source)
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  state_t &state = m_states[source] ;
+  if (state == PROXY_READY || state == PROXY_PENDING)
+    return ;
+  // Reuse a proxy more recent than its source
+  time_t src_time, proxy_time ;
+  if ( file_mtime(source, src_time) &&
+       file_mtime(proxyPath(source), proxy_time) &&
+       proxy_time >= src_time ) {
+    state = PROXY_READY ;
+    return ;
+  }
+  state = PROXY_PENDING ;
+  m_queue.push_back(source) ;
+  m_cv.notify_all() ;
+}
+
+ProxyBuilder::state_t
+ProxyBuilder::state(const std::string &source)
+{
+  std::lock_guard<std::mutex> lock(m_mutex) ;
+  auto it = m_states.find(source) ;
+  return (it == m_states.end()) ? PROXY_NONE : it->second ;
+}
+
+std::string
+ProxyBuilder::resolve(const std::string &source)
+{
+  if (state(source) == PROXY_READY)
+    return proxyPath(source) ;
+  return source ;
+}
+
+void
+ProxyBuilder::wait()
+{
+  std::unique_lock<std::mutex> lock(m_mutex) ;
+  m_cv.wait(lock, [this] { return m_stop || (m_queue.empty() && !m_busy); } ) ;
+}
+
+void
+ProxyBuilder::run()
+{
+  // An encoder that dies would raise SIGPIPE in the writing thread and
+  // so terminate the application. Blocked, the write fails with EPIPE
+  // instead and the proxy is marked as failed.
+  sigset_t sigs ;
+  sigemptyset(&sigs) ;
+  sigaddset(&sigs, SIGPIPE) ;
+  pthread_sigmask(SIG_BLOCK, &sigs, NULL) ;
+
+  std::unique_lock<std::mutex> lock(m_mutex) ;
+  while (true) {
+    m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); } ) ;
+    if (m_stop)
+      break ;
+    std::string source = m_queue.front() ;
+    m_queue.pop_front() ;
+    m_busy = true ;
+    lock.unlock() ;
+
+    std::string proxy = proxyPath(source) ;
+    bool ok = build(source, proxy) ;
+
+    lock.lock() ;
+    m_busy = false ;
+    m_states[source] = ok ? PROXY_READY : PROXY_FAILED ;
+    m_cv.notify_all() ;
+  }
+}
+
+bool
+ProxyBuilder::build(const std::string &source, const std::string &proxy)
+{
+  // Reminder: the extension tells the output format to ffmpeg
+  std::string tmp = proxy + ".tmp.mkv" ;
+  ProxyTranscoder transcoder(source, m_divisor, m_stop) ;
+  bool ok = transcoder.transcode(tmp) ;
+  if (ok)
+    ok = ( std::rename(tmp.c_str(), proxy.c_str()) == 0 ) ;
+  if (!ok) {
+    std::remove(tmp.c_str()) ;
+    if (!m_stop)
+      std::cerr << "Failed to build the proxy of '" << source << "'\n" ;
+  }
+  return ok ;
+}
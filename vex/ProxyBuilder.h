@@ -0,0 +1,106 @@
+#ifndef VEX_PROXY_BUILDER_H
+#define VEX_PROXY_BUILDER_H 1
+
+#include <map>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+//
+// Build low resolution intra-only proxies of the input videos for the
+// interactive previews.
+//
+// Seeking in a long-GOP source (e.g. 4K HEVC) requires decoding from the
+// previous keyframe. A proxy is a copy of the source downscaled by an
+// integer factor and encoded with the 'proxy' preset of the video
+// encoder (MJPEG, so every frame is a keyframe) which makes seeking and
+// decoding cheap.
+//
+// The proxies are transcoded by a background thread, one at a time, and
+// written in the proxy directory. A proxy is first written to a
+// temporary file and renamed when complete so an existing proxy file
+// is always valid. Proxies more recent than their source are reused.
+//
+// The proxy frames are written at the frame rate of the source starting
+// at time 0 so the time t in the source is the time t-start_time in the
+// proxy. The source frames are duplicated or dropped according to their
+// pts so that remains true for a variable frame rate (to a proxy frame
+// duration).
+//
+// A proxy that cannot be built (e.g. the encoder failed) is marked as
+// PROXY_FAILED and the source is used instead.
+//
+// resolve() provides the file to open: the proxy if it is ready or else
+// the original source. The final output shall always use the original
+// (see Prefetcher::setProxies()).
+//
+// Example:
+//
+//    ProxyBuilder proxies("/tmp/vex-proxies", 4) ;
+//    proxies.request("input.mp4") ;
+//    ...
+//    reader = VideoReader( proxies.resolve("input.mp4") ) ;
+//
+class ProxyBuilder {
+public:
+
+  enum state_t {
+    PROXY_NONE,       // Not requested
+    PROXY_PENDING,    // Queued or being transcoded
+    PROXY_READY,      // The proxy file can be used
+    PROXY_FAILED      // The transcoding failed
+  } ;
+
+private:
+
+  std::string                     m_dir ;
+  int                             m_divisor ;
+
+  std::mutex                      m_mutex ;
+  std::condition_variable         m_cv ;
+  std::map<std::string, state_t>  m_states ;    // by source
+  std::deque<std::string>         m_queue ;
+  bool                            m_busy{false} ;
+  std::atomic<bool>               m_stop{false} ;
+  std::thread                     m_worker ;
+
+public:
+
+  // The proxies are written in dir (created if needed) with a size
+  // divided by divisor.
+  ProxyBuilder(const std::string &dir, int divisor=4) ;
+
+  // Stop the background thread. The proxy being transcoded is
+  // abandoned.
+  ~ProxyBuilder() ;
+
+  ProxyBuilder(const ProxyBuilder &) = delete ;
+  ProxyBuilder & operator=(const ProxyBuilder &) = delete ;
+
+  int divisor() const { return m_divisor; }
+
+  // Queue the transcoding of a source (if its proxy is not already
+  // ready or pending).
+  void request(const std::string &source) ;
+
+  state_t state(const std::string &source) ;
+
+  // The name of the proxy file of a source.
+  std::string proxyPath(const std::string &source) const ;
+
+  // The proxy of source if it is ready or else source.
+  std::string resolve(const std::string &source) ;
+
+  // Wait until all requested proxies are built (or failed).
+  void wait() ;
+
+private:
+
+  void run() ;
+  bool build(const std::string &source, const std::string &proxy) ;
+} ;
+
+#endif
@@ -0,0 +1,252 @@
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include <vex/Scene.h>
+
+static inline bool
+box_empty(const BLBoxI &b)
+{
+  return b.x1 <= b.x0 || b.y1 <= b.y0 ;
+}
+
+static inline bool
+box_same(const BLBoxI &a, const BLBoxI &b)
+{
+  return a.x0==b.x0 && a.y0==b.y0 && a.x1==b.x1 && a.y1==b.y1 ;
+}
+
+static inline bool
+box_intersects(const BLBoxI &a, const BLBoxI &b)
+{
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1 ;
+}
+
+static inline BLBoxI
+box_union(const BLBoxI &a, const BLBoxI &b)
+{
+  return BLBoxI( std::min(a.x0,b.x0), std::min(a.y0,b.y0),
+                 std::max(a.x1,b.x1), std::max(a.y1,b.y1) ) ;
+}
+
+static inline double
+box_area(const BLBoxI &b)
+{
+  return double(b.x1-b.x0) * double(b.y1-b.y0) ;
+}
+
+
+Scene::Scene(double width, double height) :
+  m_width(width),
+  m_height(height)
+{
+}
+
+void
+Scene::add(std::shared_ptr<SceneNode> node)
+{
+  m_entries.push_back( Entry{ node, BLBoxI(), false } ) ;
+}
+
+void
+Scene::remove(const std::shared_ptr<SceneNode> &node)
+{
+  auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                         [&](const Entry &e) { return e.node==node; } ) ;
+  if (it==m_entries.end())
+    return ;
+  if (it->drawn)
+    m_pending.push_back(it->prev) ;
+  m_entries.erase(it) ;
+}
+
+// Convert a box in design coordinates to the smallest box of pixels
+// containing it. One extra pixel is added on each side to account for
+// the antialiasing.
+BLBoxI
+Scene::toPixels(const BLBox &box, double sx, double sy, int w, int h) const
+{
+  if ( box.x1 <= box.x0 || box.y1 <= box.y0 )
+    return BLBoxI() ;
+  BLBoxI out( int(std::max(std::floor(box.x0*sx) - 1, 0.0)),
+              int(std::max(std::floor(box.y0*sy) - 1, 0.0)),
+              int(std::min(std::ceil(box.x1*sx) + 1, double(w))),
+              int(std::min(std::ceil(box.y1*sy) + 1, double(h))) ) ;
+  if (box_empty(out))
+    return BLBoxI() ;
+  return out ;
+}
+
+void
+Scene::addDirty(const BLBoxI &box)
+{
+  if (!box_empty(box))
+    m_dirty.push_back(box) ;
+}
+
+// Merge the overlapping dirty rectangles as well as those for which
+// the union is not significantly larger than the two parts (redrawing
+// a few extra pixels is cheaper than drawing all the nodes twice).
+void
+Scene::mergeDirty()
+{
+  bool merged = true ;
+  while (merged) {
+    merged = false ;
+    for (size_t i=0 ; i<m_dirty.size() && !merged ; i++) {
+      for (size_t j=i+1 ; j<m_dirty.size() ; j++) {
+        BLBoxI u = box_union(m_dirty[i], m_dirty[j]) ;
+        if ( box_intersects(m_dirty[i], m_dirty[j]) ||
+             box_area(u) <= 1.25 * (box_area(m_dirty[i]) + box_area(m_dirty[j])) ) {
+          m_dirty[i] = u ;
+          m_dirty.erase(m_dirty.begin()+j) ;
+          merged = true ;
+          break ;
+        }
+      }
+    }
+  }
+
+  if ( int(m_dirty.size()) > m_max_rects ) {
+    BLBoxI u = m_dirty[0] ;
+    for (const BLBoxI &b : m_dirty)
+      u = box_union(u,b) ;
+    m_dirty.clear() ;
+    m_dirty.push_back(u) ;
+  }
+}
+
+void
+Scene::redraw(BLContext &ctx, const BLBoxI &rect, double sx, double sy)
+{
+  ctx.save() ;
+
+  // The clipping and the clear are done in frame coordinates.
+  ctx.clipToRect( BLRectI(rect.x0, rect.y0, rect.x1-rect.x0, rect.y1-rect.y0) ) ;
+  ctx.setCompOp(BL_COMP_OP_SRC_COPY) ;
+  ctx.setFillStyle(m_clear_color) ;
+  ctx.fillAll() ;
+  ctx.setCompOp(BL_COMP_OP_SRC_OVER) ;
+
+  ctx.scale(sx,sy) ;
+  ctx.userToMeta() ;
+
+  for (Entry &e : m_entries) {
+    if ( box_empty(e.prev) || !box_intersects(e.prev, rect) )
+      continue ;
+    ctx.save() ;
+    e.node->draw(ctx) ;
+    ctx.restore() ;
+  }
+
+  ctx.restore() ;
+}
+
+const BLImage &
+Scene::render(int w, int h, const Timestamp &ts)
+{
+  double sx = w / m_width ;
+  double sy = h / m_height ;
+
+  if ( m_frame.width()!=w || m_frame.height()!=h ) {
+    m_frame.create(w, h, BL_FORMAT_PRGB32) ;
+    m_valid = false ;
+  }
+
+  for (Entry &e : m_entries) {
+    e.node->prepare(ts) ;
+  }
+
+  m_dirty.clear() ;
+  bool full = !m_valid ;
+
+  if (full) {
+    m_pending.clear() ;
+    m_dirty.push_back( BLBoxI(0,0,w,h) ) ;
+    for (Entry &e : m_entries) {
+      e.node->changed() ; // reset the state
+      e.prev  = toPixels(e.node->bounds(), sx, sy, w, h) ;
+      e.drawn = true ;
+    }
+  } else {
+    m_dirty.swap(m_pending) ;
+    for (Entry &e : m_entries) {
+      // Reminder: changed() must be called for all nodes
+      bool changed = e.node->changed() ;
+      BLBoxI cur = toPixels(e.node->bounds(), sx, sy, w, h) ;
+      if ( changed || !e.drawn || !box_same(cur, e.prev) ) {
+        if (e.drawn) addDirty(e.prev) ;
+        addDirty(cur) ;
+      }
+      e.prev  = cur ;
+      e.drawn = true ;
+    }
+    mergeDirty() ;
+  }
+
+  if ( m_dirty.empty() ) {
+    // nothing to do
+  } else if (m_compositor) {
+    std::vector<TileCompositor::Layer> layers ;
+    for (Entry &e : m_entries) {
+      if (!box_empty(e.prev))
+        layers.push_back( TileCompositor::Layer{ e.node.get(), e.prev } ) ;
+    }
+    m_compositor->render(m_frame, m_dirty, layers, sx, sy, m_clear_color) ;
+    for (const BLBoxI &rect : m_dirty)
+      m_stats.pixels += box_area(rect) ;
+  } else {
+    BLContext ctx(m_frame) ;
+    for (const BLBoxI &rect : m_dirty) {
+      redraw(ctx, rect, sx, sy) ;
+      m_stats.pixels += box_area(rect) ;
+    }
+    ctx.end() ;
+  }
+
+  m_valid = true ;
+  m_stats.frames++ ;
+  m_stats.full += full ? 1 : 0 ;
+  m_stats.total += double(w)*h ;
+
+  return m_frame ;
+}
+
+
+void
+CachedLayerNode::draw(BLContext &ctx)
+{
+  // The Scene draws in design coordinates with the frame scaling
+  // in the meta matrix. The layer is rendered at the frame resolution
+  // in order to get a pixel exact blit.
+  BLMatrix2D m = ctx.metaMatrix() ;
+  double sx = m.m00 ;
+  double sy = m.m11 ;
+
+  BLBox box = bounds() ;
+  if ( box.x1 <= box.x0 || box.y1 <= box.y0 )
+    return ;
+  int x0 = int(std::floor(box.x0*sx)) ;
+  int y0 = int(std::floor(box.y0*sy)) ;
+  int x1 = int(std::ceil(box.x1*sx)) ;
+  int y1 = int(std::ceil(box.y1*sy)) ;
+  
+  // Reminder: BLImage is reference counted so img remains valid
+  //           after unlocking. 
+  BLImage img ;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    img = m_cache.get(LayerCache::key(m_key, sx, sy, x0, y0, x1, y1),
+                      x1-x0, y1-y0,
+                      [&](BLContext &c) {
+                        c.translate(-x0,-y0) ;
+                        c.scale(sx,sy) ;
+                        for (auto &child : m_children) {
+                          c.save() ;
+                          child->draw(c) ;
+                          c.restore() ;
+                        }
+                      } ) ;
+  }
+  ctx.blitImage( BLRect(x0/sx, y0/sy, (x1-x0)/sx, (y1-y0)/sy), img ) ;
+}
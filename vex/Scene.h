@@ -0,0 +1,407 @@
+#ifndef VEX_SCENE_H
+#define VEX_SCENE_H 1
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+
+#include <blend2d.h>
+
+#include "Timestamp.h"
+#include "TextBox.h"
+#include "LayerCache.h"
+#include "TileCompositor.h"
+
+//
+// A retained-mode scene graph with dirty region tracking.
+//
+// A Scene is an ordered list of nodes (from back to front) rendered
+// into a persistent frame. For each new timestamp, every node reports
+// its bounding box and whether its appearance changed since the
+// previous frame. Only the dirty regions (the old and the new bounds of
+// the modified nodes) are cleared and redrawn. The other pixels are
+// kept from the previous frame.
+//
+// All coordinates given to and by the nodes are in the 'design'
+// coordinate system of the scene (i.e. the size given to the Scene
+// constructor). The rendered frame may use a different size in which
+// case a scaling is applied (as done in VideoCommon::render_image).
+//
+// Example:
+//
+//    Scene scene(1920,1080);
+//    scene.add( std::make_shared<SolidBackgroundNode>(col::Black) );
+//    auto title = std::make_shared<TextBoxNode>("bold-XL", 100, 900);
+//    title->textbox().append("Hello");
+//    scene.add(title);
+//    ...
+//    for (...) {
+//      title->moveTo(100+f, 900) ;
+//      const BLImage &frame = scene.render(1920, 1080, ts) ;
+//      ...
+//    }
+//
+
+class SceneNode {
+public:
+  virtual ~SceneNode() {}
+
+  // Called once per frame before bounds(), changed() or draw().
+  // This is where a node shall update its state for the timestamp ts.
+  virtual void prepare(const Timestamp &ts) { }
+
+  // The area covered by the node in design coordinates.
+  // An empty box (x1<=x0 or y1<=y0) means that nothing is drawn.
+  //
+  // That box must include everything drawn by the node (so also
+  // antialiasing, strokes, glyph overshoots, ...)
+  virtual BLBox bounds() = 0;
+
+  // Tell if the appearance of the node changed since the previous
+  // frame. A change of bounds() is detected by the Scene and does
+  // not need to be reported.
+  virtual bool changed() = 0;
+
+  // Draw the node. The context is already clipped to the dirty
+  // region being redrawn and scaled to design coordinates.
+  //
+  // When the Scene uses a TileCompositor, draw() is called concurrently
+  // for multiple tiles so it shall not modify the node.
+  virtual void draw(BLContext &ctx) = 0;
+};
+
+
+class Scene {
+public:
+
+  struct Stats {
+    int    frames{0} ;      // Number of rendered frames
+    int    full{0} ;        // Number of full redraws
+    double pixels{0} ;      // Number of redrawn pixels
+    double total{0} ;       // Number of pixels in all rendered frames
+  } ;
+
+private:
+
+  struct Entry {
+    std::shared_ptr<SceneNode> node;
+    BLBoxI prev;       // the bounds (in frame pixels) at the previous render
+    bool   drawn;      // false if the node was never rendered
+  } ;
+
+  double              m_width;
+  double              m_height;
+  std::vector<Entry>  m_entries;
+  BLImage             m_frame;
+  bool                m_valid{false};
+  BLRgba32            m_clear_color{0x00000000};
+
+  // Regions that must be redrawn at the next render
+  // (e.g. the area of a removed node)
+  std::vector<BLBoxI> m_pending;
+
+  // The dirty regions processed by the last render()
+  std::vector<BLBoxI> m_dirty;
+
+  Stats               m_stats;
+
+  // Above that number of dirty rectangles, they are all merged into one.
+  int                 m_max_rects{16};
+
+  TileCompositor *    m_compositor{nullptr};
+
+public:
+
+  // Create a scene with the specified design size.
+  Scene(double width, double height) ;
+
+  // Append a node at the front of the scene.
+  void add(std::shared_ptr<SceneNode> node) ;
+
+  // Remove a node. Its area will be redrawn by the next render.
+  void remove(const std::shared_ptr<SceneNode> &node) ;
+
+  // Force a full redraw at the next render.
+  void invalidate() { m_valid = false ; }
+
+  // The color used to clear a dirty region before redrawing
+  // it (transparent by default).
+  void setClearColor(BLRgba32 c) { m_clear_color = c; invalidate(); }
+
+  // Limit the number of dirty rectangles per frame.
+  void setMaxRects(int n) { m_max_rects = std::max(1,n) ; }
+
+  // Use a TileCompositor to rasterize the dirty regions in parallel
+  // (or nullptr to render them in the calling thread).
+  // This is mostly interesting for large frames (4K, 8K).
+  void setCompositor(TileCompositor *compositor) { m_compositor = compositor ; }
+
+  // Render the scene at timestamp ts in a persistent w x h frame
+  // in BL_FORMAT_PRGB32.
+  //
+  // The result remains valid until the next call.
+  const BLImage & render(int w, int h, const Timestamp &ts) ;
+
+  // The dirty regions (in frame pixels) redrawn by the last render().
+  const std::vector<BLBoxI> & dirtyRects() const { return m_dirty; }
+
+  const Stats & stats() const { return m_stats; }
+
+  double width()  const { return m_width; }
+  double height() const { return m_height; }
+
+private:
+
+  BLBoxI toPixels(const BLBox &box, double sx, double sy, int w, int h) const ;
+  void   addDirty(const BLBoxI &box) ;
+  void   mergeDirty() ;
+  void   redraw(BLContext &ctx, const BLBoxI &rect, double sx, double sy) ;
+};
+
+
+//
+// A node filling the whole scene with a solid color.
+//
+class SolidBackgroundNode : public SceneNode {
+private:
+  BLRgba32 m_color;
+  bool     m_changed{true};
+public:
+  SolidBackgroundNode(BLRgba32 color) : m_color(color) { }
+
+  void setColor(BLRgba32 color) {
+    if (color != m_color) {
+      m_color = color;
+      m_changed = true;
+    }
+  }
+
+  // The whole scene.
+  virtual BLBox bounds() override {
+    return BLBox(-1e9, -1e9, 1e9, 1e9) ;
+  }
+
+  virtual bool changed() override {
+    bool c = m_changed ;
+    m_changed = false;
+    return c;
+  }
+
+  virtual void draw(BLContext &ctx) override {
+    ctx.save();
+    ctx.setCompOp(BL_COMP_OP_SRC_COPY);
+    ctx.setFillStyle(m_color);
+    ctx.fillAll();
+    ctx.restore();
+  }
+};
+
+
+//
+// A node drawing a btb::SimpleTextBox at a given position.
+//
+// Any access to the text box via textbox() is assumed to modify it.
+//
+class TextBoxNode : public SceneNode {
+private:
+  btb::SimpleTextBox m_tb;
+  double m_x;
+  double m_y;
+  double m_margin{4.0};  // extra margin for glyphs overshooting their box
+  bool   m_changed{true};
+public:
+  TextBoxNode(const std::string &fontname, double x=0, double y=0) :
+    m_tb(fontname), m_x(x), m_y(y)
+  {
+  }
+
+  btb::SimpleTextBox & textbox() {
+    m_changed = true;
+    return m_tb;
+  }
+
+  void moveTo(double x, double y) {
+    m_x = x;
+    m_y = y;
+  }
+
+  void setMargin(double margin) {
+    m_margin = margin;
+    m_changed = true;
+  }
+
+  virtual BLBox bounds() override {
+    BLBox box = m_tb.getBoxAt(m_x,m_y) ;
+    box.x0 -= m_margin ;
+    box.y0 -= m_margin ;
+    box.x1 += m_margin ;
+    box.y1 += m_margin ;
+    return box;
+  }
+
+  virtual bool changed() override {
+    bool c = m_changed ;
+    m_changed = false;
+    return c;
+  }
+
+  virtual void draw(BLContext &ctx) override {
+    m_tb.drawBox(ctx, m_x, m_y);
+    m_tb.draw(ctx, m_x, m_y);
+  }
+};
+
+
+//
+// A node drawing an image (e.g. a video frame) in a rectangle.
+//
+// The node is assumed to change each time setImage() is called.
+//
+class ImageNode : public SceneNode {
+private:
+  BLImage m_image;
+  BLRect  m_rect;
+  bool    m_changed{true};
+public:
+  ImageNode(const BLRect &rect) : m_rect(rect) { }
+
+  void setImage(const BLImage &image) {
+    m_image   = image ;
+    m_changed = true ;
+  }
+
+  void setRect(const BLRect &rect) {
+    m_rect = rect ;
+  }
+
+  virtual BLBox bounds() override {
+    if (m_image.empty())
+      return BLBox() ;
+    return BLBox(m_rect.x, m_rect.y, m_rect.x+m_rect.w, m_rect.y+m_rect.h) ;
+  }
+
+  virtual bool changed() override {
+    bool c = m_changed ;
+    m_changed = false;
+    return c;
+  }
+
+  virtual void draw(BLContext &ctx) override {
+    ctx.blitImage(m_rect, m_image);
+  }
+};
+
+
+//
+// A node implemented by callbacks.
+//
+// This is mostly intended for simple animated elements:
+//   - prepare_fn is optional.
+//   - changed_fn is optional. If not set then the node is always
+//     considered as changed.
+//
+class FunctionNode : public SceneNode {
+public:
+  std::function<void(const Timestamp &)> prepare_fn;
+  std::function<BLBox()>                 bounds_fn;
+  std::function<bool()>                  changed_fn;
+  std::function<void(BLContext&)>        draw_fn;
+public:
+  FunctionNode(std::function<BLBox()> bounds_fn,
+               std::function<void(BLContext&)> draw_fn) :
+    bounds_fn(bounds_fn), draw_fn(draw_fn)
+  {
+  }
+
+  virtual void prepare(const Timestamp &ts) override {
+    if (prepare_fn) prepare_fn(ts) ;
+  }
+
+  virtual BLBox bounds() override {
+    return bounds_fn() ;
+  }
+
+  virtual bool changed() override {
+    return changed_fn ? changed_fn() : true ;
+  }
+
+  virtual void draw(BLContext &ctx) override {
+    draw_fn(ctx) ;
+  }
+};
+
+
+//
+// A group of time-invariant nodes rendered once in a LayerCache and
+// then composited with a single blit.
+//
+// The children are never prepared and their changed() is ignored.
+// Instead, the appearance of the group is identified by a key that
+// must describe all the parameters affecting the children (see
+// LayerCache::key()). Changing the key triggers a new rendering. The
+// scale of the frame is automatically added to the key.
+//
+// Example:
+//
+//    auto statics = std::make_shared<CachedLayerNode>() ;
+//    statics->add(logo) ;
+//    statics->add(grid) ;
+//    statics->setKey( LayerCache::key("statics", logo_name, grid_step) ) ;
+//    scene.add(statics) ;
+//
+class CachedLayerNode : public SceneNode {
+private:
+  std::vector<std::shared_ptr<SceneNode>> m_children;
+  std::string m_key;
+  LayerCache  m_cache;
+  std::mutex  m_mutex;  // protect m_cache when drawing multiple tiles
+  bool        m_changed{true};
+public:
+
+  CachedLayerNode() {
+    m_cache.setMaxLayers(2) ;
+  }
+
+  void add(std::shared_ptr<SceneNode> node) {
+    m_children.push_back(node) ;
+    m_cache.clear() ;
+    m_changed = true ;
+  }
+
+  void setKey(const std::string &key) {
+    if (key != m_key) {
+      m_key = key ;
+      m_changed = true ;
+    }
+  }
+
+  // The union of the bounds of all children.
+  virtual BLBox bounds() override {
+    BLBox box ;
+    bool first = true ;
+    for (auto &child : m_children) {
+      BLBox b = child->bounds() ;
+      if ( b.x1 <= b.x0 || b.y1 <= b.y0 )
+        continue ;
+      if (first) {
+        box = b ;
+        first = false ;
+      } else {
+        box = BLBox( std::min(box.x0,b.x0), std::min(box.y0,b.y0),
+                     std::max(box.x1,b.x1), std::max(box.y1,b.y1) ) ;
+      }
+    }
+    return box ;
+  }
+
+  virtual bool changed() override {
+    bool c = m_changed ;
+    m_changed = false;
+    return c;
+  }
+
+  virtual void draw(BLContext &ctx) override ;
+};
+
+#endif
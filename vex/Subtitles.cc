@@ -0,0 +1,326 @@
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+
+#include <vex/Subtitles.h>
+
+static bool
+parse_digits(const std::string &str, size_t &pos, int64_t &value, int &count)
+{
+  value = 0 ;
+  count = 0 ;
+  while ( pos < str.size() && str[pos]>='0' && str[pos]<='9' ) {
+    value = value*10 + (str[pos]-'0') ;
+    pos++ ;
+    count++ ;
+  }
+  return count>0 ;
+}
+
+bool
+SubtitleTrack::parseTime(const std::string &str, size_t &pos, int64_t &ms)
+{
+  int64_t v[3] ;
+  int n = 0 ;
+  int count ;
+  size_t p = pos ;
+  while ( p < str.size() && (str[p]==' ' || str[p]=='\t') )
+    p++ ;
+  // Up to 3 components separated by ':'
+  while (n<3) {
+    if ( !parse_digits(str, p, v[n], count) )
+      return false ;
+    n++ ;
+    if ( p < str.size() && str[p]==':' )
+      p++ ;
+    else
+      break ;
+  }
+  if (n<2)
+    return false ;
+  // The milliseconds (',' in SRT and '.' in WebVTT)
+  int64_t millis = 0 ;
+  if ( p < str.size() && (str[p]==',' || str[p]=='.') ) {
+    p++ ;
+    if ( !parse_digits(str, p, millis, count) )
+      return false ;
+    for ( ; count<3 ; count++ )
+      millis *= 10 ;
+    for ( ; count>3 ; count-- )
+      millis /= 10 ;
+  }
+  int64_t hours   = (n==3) ? v[0] : 0 ;
+  int64_t minutes = v[n-2] ;
+  int64_t seconds = v[n-1] ;
+  ms = ((hours*60 + minutes)*60 + seconds)*1000 + millis ;
+  pos = p ;
+  return true ;
+}
+
+bool
+SubtitleTrack::load(const std::string &filename)
+{
+  std::ifstream in(filename, std::ios::binary) ;
+  if (!in) {
+    std::cerr << "Failed to open subtitle file '" << filename << "'\n" ;
+    return false ;
+  }
+  std::stringstream buffer ;
+  buffer << in.rdbuf() ;
+  parse(buffer.str()) ;
+  return true ;
+}
+
+// The SRT and WebVTT files are both made of blocks separated by empty
+// lines. A cue is a block with a timing line "START --> END" followed by
+// the text. The lines before the timing (SRT number or WebVTT identifier)
+// are ignored as well as the blocks without timing (WEBVTT header, NOTE,
+// STYLE, ...).
+size_t
+SubtitleTrack::parse(const std::string &content)
+{
+  std::vector<std::string> block ;
+  size_t found = 0 ;
+  size_t pos = 0 ;
+
+  // Skip the UTF-8 BOM
+  if ( content.compare(0, 3, "\xEF\xBB\xBF") == 0 )
+    pos = 3 ;
+
+  auto flush = [&]() {
+    for (size_t k=0 ; k<block.size() ; k++) {
+      const std::string &line = block[k] ;
+      size_t arrow = line.find("-->") ;
+      if (arrow == std::string::npos)
+        continue ;
+      SubtitleCue cue ;
+      size_t p1 = 0 ;
+      size_t p2 = arrow+3 ;
+      if ( !parseTime(line, p1, cue.start) || !parseTime(line, p2, cue.end) )
+        break ;
+      for (size_t j=k+1 ; j<block.size() ; j++) {
+        if (j>k+1)
+          cue.text += '\n' ;
+        cue.text += block[j] ;
+      }
+      if (cue.end > cue.start) {
+        append(cue) ;
+        found++ ;
+      }
+      break ;
+    }
+    block.clear() ;
+  } ;
+
+  while (pos <= content.size()) {
+    size_t eol = content.find('\n', pos) ;
+    if (eol == std::string::npos)
+      eol = content.size() ;
+    std::string line = content.substr(pos, eol-pos) ;
+    if ( !line.empty() && line.back()=='\r' )
+      line.pop_back() ;
+    if (line.empty())
+      flush() ;
+    else
+      block.push_back(line) ;
+    pos = eol+1 ;
+  }
+  flush() ;
+  m_index.build() ;
+  return found ;
+}
+
+void
+SubtitleTrack::append(const SubtitleCue &cue)
+{
+  m_index.add(cue.start, cue.end, m_cues.size()) ;
+  m_cues.push_back(cue) ;
+}
+
+void
+SubtitleTrack::add(const SubtitleCue &cue)
+{
+  append(cue) ;
+  m_index.build() ;
+}
+
+void
+SubtitleTrack::active(const Timestamp &ts, std::vector<size_t> &out) const
+{
+  int64_t ms = Timestamp(ts).floor_to_ms().milli.count ;
+  m_index.query(ms, out) ;
+}
+
+
+SubtitleNode::SubtitleNode(std::shared_ptr<SubtitleTrack> track,
+                           const std::string &fontname,
+                           double x, double bottom) :
+  m_track(track),
+  m_font(fontname),
+  m_x(x),
+  m_bottom(bottom)
+{
+  for (size_t i=0 ; i<m_track->size() ; i++)
+    m_entries.emplace_back(new Entry) ;
+}
+
+SubtitleNode::~SubtitleNode()
+{
+  m_stop = true ;
+  if (m_worker.joinable())
+    m_worker.join() ;
+}
+
+void
+SubtitleNode::preload()
+{
+  if (m_worker.joinable())
+    return ;
+  m_worker = std::thread( [this] {
+      for (size_t i=0 ; i<m_entries.size() && !m_stop ; i++)
+        textbox(i) ;
+    } ) ;
+}
+
+// Convert the cue text for a SimpleTextBox.
+std::string
+SubtitleNode::markup(const std::string &text) const
+{
+  std::string out ;
+  size_t pos = 0 ;
+  while (pos < text.size()) {
+    char c = text[pos] ;
+    if (c=='^') {
+      out += "^^" ;
+      pos++ ;
+    } else if (c=='<') {
+      size_t end = text.find('>', pos) ;
+      if (end == std::string::npos) {
+        out += c ;
+        pos++ ;
+        continue ;
+      }
+      std::string tag = text.substr(pos+1, end-pos-1) ;
+      if ( tag=="i" && !m_italic_font.empty() )
+        out += "^F[" + m_italic_font + "]" ;
+      else if ( tag=="b" && !m_bold_font.empty() )
+        out += "^F[" + m_bold_font + "]" ;
+      else if ( tag=="/i" || tag=="/b" )
+        out += "^F[" + m_font + "]" ;
+      pos = end+1 ;
+    } else if (c=='&') {
+      static const struct { const char *name; const char *utf8; } entities[] = {
+        { "&amp;",  "&" },
+        { "&lt;",   "<" },
+        { "&gt;",   ">" },
+        { "&nbsp;", "\xC2\xA0" },
+      } ;
+      bool done = false ;
+      for (auto &e : entities) {
+        size_t n = strlen(e.name) ;
+        if ( text.compare(pos, n, e.name) == 0 ) {
+          out += e.utf8 ;
+          pos += n ;
+          done = true ;
+          break ;
+        }
+      }
+      if (!done) {
+        out += c ;
+        pos++ ;
+      }
+    } else {
+      out += c ;
+      pos++ ;
+    }
+  }
+  return out ;
+}
+
+void
+SubtitleNode::build(size_t i)
+{
+  auto tb = std::unique_ptr<btb::SimpleTextBox>(new btb::SimpleTextBox(m_font)) ;
+  tb->setFillColor(m_fill) ;
+  tb->setBoxFillColor(m_box_fill) ;
+  tb->setBorder(m_padding) ;
+  tb->setAlign(btb::align_center) ;
+  tb->setWrapWidth(m_wrap_width) ;
+  tb->append( markup(m_track->cue(i).text) ) ;
+  tb->finalize() ;
+  m_entries[i]->tb = std::move(tb) ;
+}
+
+btb::SimpleTextBox &
+SubtitleNode::textbox(size_t i)
+{
+  Entry &entry = *m_entries[i] ;
+  std::call_once(entry.once, [this,i] { build(i); } ) ;
+  return *entry.tb ;
+}
+
+void
+SubtitleNode::prepare(const Timestamp &ts)
+{
+  std::vector<size_t> active ;
+  m_track->active(ts, active) ;
+  // Ignore the cues added to the track after the creation of the node.
+  active.erase( std::remove_if(active.begin(), active.end(),
+                               [this](size_t i) { return i >= m_entries.size(); } ),
+                active.end() ) ;
+  if (active != m_active) {
+    m_active.swap(active) ;
+    m_changed = true ;
+  }
+
+  // Stack the cues from the bottom (the most recent at the bottom).
+  m_pos.resize(m_active.size()) ;
+  double y = m_bottom ;
+  for (size_t k=m_active.size() ; k-->0 ; ) {
+    btb::SimpleTextBox &tb = textbox(m_active[k]) ;
+    double w = tb.width() ;
+    double h = tb.height() ;
+    y -= m_padding + h ;
+    m_pos[k] = BLPoint(m_x - w/2, y) ;
+    y -= m_padding + m_spacing ;
+  }
+}
+
+BLBox
+SubtitleNode::bounds()
+{
+  if (m_active.empty())
+    return BLBox() ;
+  BLBox box = textbox(m_active[0]).getBoxAt(m_pos[0].x, m_pos[0].y) ;
+  for (size_t k=1 ; k<m_active.size() ; k++) {
+    BLBox b = textbox(m_active[k]).getBoxAt(m_pos[k].x, m_pos[k].y) ;
+    box.x0 = std::min(box.x0, b.x0) ;
+    box.y0 = std::min(box.y0, b.y0) ;
+    box.x1 = std::max(box.x1, b.x1) ;
+    box.y1 = std::max(box.y1, b.y1) ;
+  }
+  box.x0 -= m_margin ;
+  box.y0 -= m_margin ;
+  box.x1 += m_margin ;
+  box.y1 += m_margin ;
+  return box ;
+}
+
+bool
+SubtitleNode::changed()
+{
+  bool c = m_changed ;
+  m_changed = false ;
+  return c ;
+}
+
+void
+SubtitleNode::draw(BLContext &ctx)
+{
+  for (size_t k=0 ; k<m_active.size() ; k++) {
+    btb::SimpleTextBox &tb = *m_entries[m_active[k]]->tb ;
+    tb.drawBox(ctx, m_pos[k].x, m_pos[k].y) ;
+    tb.draw(ctx, m_pos[k].x, m_pos[k].y) ;
+  }
+}
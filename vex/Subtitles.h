@@ -0,0 +1,153 @@
+#ifndef VEX_SUBTITLES_H
+#define VEX_SUBTITLES_H 1
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include <blend2d.h>
+
+#include "Timestamp.h"
+#include "IntervalTree.h"
+#include "TextBox.h"
+#include "Scene.h"
+
+//
+// A subtitle cue.
+//
+struct SubtitleCue {
+  int64_t     start ;   // in milliseconds
+  int64_t     end ;     // in milliseconds (excluded)
+  std::string text ;    // UTF-8 with '\n' between lines and the original tags (<i>, ...)
+} ;
+
+//
+// A list of subtitle cues indexed by time.
+//
+// The SRT and WebVTT formats are supported. Only the timing and the
+// text of the cues are used (so the WebVTT cue settings, styles and
+// regions are ignored).
+//
+// The index is rebuilt by parse() and add() so active() can be called
+// concurrently but not while cues are added.
+//
+class SubtitleTrack {
+private:
+  std::vector<SubtitleCue>      m_cues ;
+  IntervalTree<int64_t,size_t>  m_index ;
+public:
+
+  // Load a SRT or WebVTT file.
+  // Return false if the file cannot be read.
+  bool load(const std::string &filename) ;
+
+  // Parse the content of a SRT or WebVTT file and add its cues.
+  // Return the number of cues found.
+  size_t parse(const std::string &content) ;
+
+  // Add a single cue (prefer parse() to add many cues since the index
+  // is rebuilt after each call).
+  void add(const SubtitleCue &cue) ;
+
+  size_t size() const { return m_cues.size(); }
+
+  const SubtitleCue & cue(size_t i) const { return m_cues[i]; }
+
+  // Get the indices of the cues active at the timestamp (ordered by
+  // start time).
+  void active(const Timestamp &ts, std::vector<size_t> &out) const ;
+
+  // Parse a cue time of the form [HH:]MM:SS[.,]mmm starting at pos.
+  // On success, pos is moved after the time.
+  static bool parseTime(const std::string &str, size_t &pos, int64_t &ms) ;
+
+private:
+
+  // Add a cue without rebuilding the index.
+  void append(const SubtitleCue &cue) ;
+} ;
+
+
+//
+// A SceneNode drawing the active cues of a SubtitleTrack.
+//
+// Each cue is rendered with its own SimpleTextBox. The text boxes are
+// created and finalized (so shaped) on demand and, after preload(), by
+// a background thread so the rendering usually only has to draw the
+// glyphs of the active cues.
+//
+// The cues are horizontally centered on x and stacked up from the
+// bottom position.
+//
+// The <i> and <b> tags are supported when the corresponding fonts are
+// set. All other tags are ignored.
+//
+// Reminder: The style must be set before calling preload() or drawing
+// the first frame.
+//
+class SubtitleNode : public SceneNode {
+private:
+
+  struct Entry {
+    std::once_flag                      once ;
+    std::unique_ptr<btb::SimpleTextBox> tb ;
+  } ;
+
+  std::shared_ptr<SubtitleTrack>       m_track ;
+  std::vector<std::unique_ptr<Entry>>  m_entries ;
+
+  std::string m_font ;
+  std::string m_italic_font ;
+  std::string m_bold_font ;
+  BLRgba32    m_fill{0xFFFFFFFF} ;
+  BLRgba32    m_box_fill{0} ;
+  double      m_padding{10} ;
+  double      m_spacing{4} ;
+  double      m_wrap_width{0} ;
+  double      m_x ;
+  double      m_bottom ;
+  double      m_margin{4.0} ;   // extra margin for glyphs overshooting their box
+
+  std::vector<size_t>  m_active ;
+  std::vector<BLPoint> m_pos ;      // the position of each active cue
+  bool                 m_changed{true} ;
+
+  std::thread          m_worker ;
+  std::atomic<bool>    m_stop{false} ;
+
+public:
+
+  SubtitleNode(std::shared_ptr<SubtitleTrack> track, const std::string &fontname,
+               double x, double bottom) ;
+
+  ~SubtitleNode() ;
+
+  void setItalicFont(const std::string &fontname) { m_italic_font = fontname; }
+  void setBoldFont(const std::string &fontname)   { m_bold_font = fontname; }
+  void setFillColor(BLRgba32 c)                   { m_fill = c; }
+  void setBoxFillColor(BLRgba32 c)                { m_box_fill = c; }
+  void setPadding(double padding)                 { m_padding = padding; }
+  void setSpacing(double spacing)                 { m_spacing = spacing; }
+  void setWrapWidth(double width)                 { m_wrap_width = width; }
+
+  // Start shaping all cues in a background thread.
+  void preload() ;
+
+  // The text box of a cue (created if needed).
+  btb::SimpleTextBox & textbox(size_t i) ;
+
+  virtual void prepare(const Timestamp &ts) override ;
+  virtual BLBox bounds() override ;
+  virtual bool changed() override ;
+  virtual void draw(BLContext &ctx) override ;
+
+private:
+
+  void build(size_t i) ;
+  std::string markup(const std::string &text) const ;
+} ;
+
+#endif
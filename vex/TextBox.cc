@@ -3,22 +3,114 @@
 
 #include <map>
 #include <string>
+#include <cmath>
+#include <fstream>
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <fontconfig/fontconfig.h>
 
 namespace btb
 {
 
-  static FcConfig * fc_config = NULL ;
-  
-  void
-  createFaceFromFcPattern(BLFontFace &face, std::string p, const char32_t *charset) {   
+  static FcConfig *  fc_config = NULL ;
+  static bool        fc_fonts_built = false ;
+  static std::string fc_stamp ;
+
+  static long long
+  file_mtime(const std::string &filename)
+  {
+    struct stat st;
+    if ( stat(filename.c_str(), &st) != 0 )
+      return -1;
+    return (long long) st.st_mtime;
+  }
+
+  static void
+  stamp_add(uint64_t &h, const std::string &s)
+  {
+    // FNV-1a
+    for (unsigned char c : s) {
+      h ^= c;
+      h *= 1099511628211ull;
+    }
+  }
+
+  static void
+  stamp_add_files(uint64_t &h, FcStrList *list)
+  {
+    if (!list)
+      return;
+    FcChar8 *name;
+    while ( (name = FcStrListNext(list)) ) {
+      std::string filename = (const char*) name;
+      stamp_add(h, filename + "\t" + std::to_string(file_mtime(filename)) + "\n");
+    }
+    FcStrListDone(list);
+  }
+
+  // Load the fontconfig configuration but do not scan the fonts yet
+  // since the font cache may make that unnecessary.
+  //
+  // The stamp of the fontconfig state is made of the names and
+  // modification times of the configuration files and of the font
+  // directories. That covers the installation or removal of fonts
+  // and most configuration changes that could affect the resolution
+  // of a pattern. It is computed before the fonts are scanned since
+  // that adds the sub-directories to the font directories.
+  static FcConfig *
+  load_fc_config()
+  {
+    if ( !fc_config ) {
+      fc_config = FcInitLoadConfig();
+      if ( !fc_config ) {
+        std::cerr << "Failed to load the fontconfig configuration\n";
+        exit(1);
+      }
+      uint64_t h = 14695981039346656037ull;
+      stamp_add_files(h, FcConfigGetConfigFiles(fc_config));
+      stamp_add(h, "\n");
+      stamp_add_files(h, FcConfigGetFontDirs(fc_config));
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long) h);
+      fc_stamp = buffer;
+    }
+    return fc_config;
+  }
+
+  // Load a face from a font file. 
+  static bool
+  load_face(BLFontFace &face, const char *filename, int index, bool verbose)
+  {
+    BLFontLoader loader;
+    uint32_t flags =  BL_FILE_READ_MMAP_ENABLED | BL_FILE_READ_MMAP_AVOID_SMALL;
+    if ( loader.createFromFile(filename, flags) != BL_SUCCESS ) {        
+      if (verbose)
+        std::cerr << "INFO: Failed to load font file " << filename << "\n";
+      return false;
+    }
+    if ( face.createFromLoader(loader, index) != BL_SUCCESS ) {
+      if (verbose)
+        std::cerr << "INFO: Failed to create face from " << filename << "\n";
+      return false;
+    }
+    return true;
+  }
+
+  // Find the first font matching the pattern that can be loaded by Blend2D.
+  static bool
+  resolve_fc_pattern(BLFontFace &face, const std::string &p, std::string &file, int &index)
+  {
     FcPattern * fc_pattern = NULL;
-    FcPattern * fc_font = NULL;
     FcResult    result;
       
-    if ( !fc_config ) {
-      fc_config = FcInitLoadConfigAndFonts();    
-    } 
+    if ( !fc_fonts_built ) {
+      FcConfigBuildFonts( load_fc_config() );
+      fc_fonts_built = true;
+    }
     
     fc_pattern = FcNameParse( (const FcChar8*) p.c_str() );
     if (!fc_pattern) {
@@ -35,100 +127,726 @@ namespace btb
       exit(1);
     }
 
-#if 0
-    // Dump the first alternatives 
-    std::cerr << "###### " << p << "\n";
-    for (int k=0;k<10;k++) {
-      if (k >= fc_fontset->nfont)
-        break ;
-      FcChar8 *filename = NULL;
-      fc_font = FcFontRenderPrepare(fc_config, fc_pattern, fc_fontset->fonts[k]);
-      FcPatternGetString(fc_font, FC_FILE, 0, &filename);
-      std::cerr << "#    " << ((const char*)filename)  << "\n";
-    }
-    if (k==10) {
-      std::cerr << "#    ...\n";
-    }
-#endif
-    
     // Blend2d only support a subset of the possible font
     // formats that can be returned by fontconfig.
     // So try all matches until one can be loaded. 
-    for (int i=0; i<fc_fontset->nfont ; i++) {
+    bool found = false ;
+    for (int i=0; i<fc_fontset->nfont && !found ; i++) {
       FcChar8 *filename = NULL;
-      int index = 0;
-      fc_font = FcFontRenderPrepare(fc_config, fc_pattern, fc_fontset->fonts[i]);
-      
-      if (FcPatternGetString(fc_font, FC_FILE, 0, &filename)  != FcResultMatch)
-        continue;
-      if (FcPatternGetInteger(fc_font, FC_INDEX, 0, &index)  != FcResultMatch)
-        continue;
-      
-      BLFontLoader loader;
-      uint32_t flags =  BL_FILE_READ_MMAP_ENABLED | BL_FILE_READ_MMAP_AVOID_SMALL;
-      if ( loader.createFromFile((const char*)filename, flags) != BL_SUCCESS ) {        
-        std::cerr << "INFO: Failed to load font file " << filename << "\n";
+      int fc_index = 0;
+      FcPattern *fc_font = FcFontRenderPrepare(fc_config, fc_pattern, fc_fontset->fonts[i]);
+      if (!fc_font)
         continue;
+      if ( FcPatternGetString(fc_font, FC_FILE, 0, &filename) == FcResultMatch &&
+           FcPatternGetInteger(fc_font, FC_INDEX, 0, &fc_index) == FcResultMatch &&
+           load_face(face, (const char*)filename, fc_index, true) ) {
+        file  = (const char*) filename;
+        index = fc_index;
+        found = true;
       }
-      
-      if ( face.createFromLoader(loader, 0) != BL_SUCCESS ) {
-        std::cerr << "INFO: Failed to create face from " << filename << "\n";
-        continue;
+      FcPatternDestroy(fc_font);
+    }
+
+    FcFontSetSortDestroy(fc_fontset);
+    FcPatternDestroy(fc_pattern);
+    return found;
+  }
+
+  //
+  // The font resolution cache.
+  //
+  // Resolving a pattern with fontconfig is slow so the faces are
+  // memoized in memory and the resolved (file,index) are also stored
+  // in a cache file with one entry per line:
+  //
+  //    <mtime> TAB <index> TAB <file> TAB <key>
+  //
+  // The first line is a stamp of the fontconfig state (see
+  // load_fc_config) and the whole file is ignored when it does not
+  // match the current state.
+  //
+  // An entry is also ignored when the modification time of the font
+  // file changed or when the file cannot be loaded anymore. In that
+  // case, the pattern is resolved again and the whole file is
+  // rewritten.
+  //
+  struct ResolvedFace {
+    std::string file;
+    int         index;
+    long long   mtime;
+  };
+
+  static std::mutex                          face_mutex;
+  static std::map<std::string,BLFontFace>    face_memo;
+  static std::map<std::string,ResolvedFace>  face_disk;
+  static bool                                face_disk_loaded = false;
+  static bool                                face_cache_file_set = false;
+  static std::string                         face_cache_file;
+
+  static std::string
+  default_font_cache_file()
+  {
+    const char *env = getenv("VEX_FONT_CACHE");
+    if (env)
+      return env; // an empty value disables the cache
+    env = getenv("XDG_CACHE_HOME");
+    if (env && env[0])
+      return std::string(env) + "/vex/fonts.cache";
+    env = getenv("HOME");
+    if (env && env[0])
+      return std::string(env) + "/.cache/vex/fonts.cache";
+    return "";
+  }
+
+  // Create all the parent directories of a file.
+  static void
+  make_parent_dirs(const std::string &filename)
+  {
+    for ( size_t pos = filename.find('/',1) ;
+          pos != std::string::npos ;
+          pos = filename.find('/',pos+1) ) {
+      mkdir( filename.substr(0,pos).c_str(), 0755 ) ;
+    }
+  }
+
+  // Reminder: face_mutex must be locked
+  static void
+  load_font_cache()
+  {
+    if (face_disk_loaded)
+      return;
+    face_disk_loaded = true;
+    if (!face_cache_file_set) {
+      face_cache_file = default_font_cache_file();
+      face_cache_file_set = true;
+    }
+    if (face_cache_file.empty())
+      return;
+    load_fc_config();
+    std::ifstream in(face_cache_file);
+    std::string line;
+    if ( !std::getline(in,line) || line != "vex-font-cache " + fc_stamp )
+      return; // missing or stale
+    while ( std::getline(in,line) ) {
+      size_t t1 = line.find('\t');
+      size_t t2 = (t1==std::string::npos) ? t1 : line.find('\t',t1+1);
+      size_t t3 = (t2==std::string::npos) ? t2 : line.find('\t',t2+1);
+      if (t3==std::string::npos)
+        continue; // malformed
+      ResolvedFace entry;
+      entry.mtime = atoll( line.substr(0,t1).c_str() );
+      entry.index = atoi( line.substr(t1+1,t2-t1-1).c_str() );
+      entry.file  = line.substr(t2+1,t3-t2-1);
+      face_disk[line.substr(t3+1)] = entry;
+    }
+  }
+
+  // Rewrite the whole cache file. The content is first written
+  // to a temporary file that is then renamed so concurrent readers
+  // never see a partial file.
+  //
+  // Reminder: face_mutex must be locked
+  static void
+  save_font_cache_entry(const std::string &key, const ResolvedFace &entry)
+  {
+    if ( key.find_first_of("\t\n") != std::string::npos ||
+         entry.file.find_first_of("\t\n") != std::string::npos )
+      return;
+    face_disk[key] = entry;
+    if (face_cache_file.empty())
+      return;
+    make_parent_dirs(face_cache_file);
+    std::string tmp = face_cache_file + ".tmp." + std::to_string(getpid());
+    load_fc_config();
+    {
+      std::ofstream out(tmp, std::ios::trunc);
+      if (!out)
+        return;
+      out << "vex-font-cache " << fc_stamp << '\n';
+      for ( const auto & kv : face_disk ) {
+        out << kv.second.mtime << '\t' << kv.second.index << '\t'
+            << kv.second.file << '\t' << kv.first << '\n';
       }
+      out.flush();
+      if (!out) {
+        std::remove(tmp.c_str());
+        return;
+      }
+    }
+    if ( std::rename(tmp.c_str(), face_cache_file.c_str()) != 0 )
+      std::remove(tmp.c_str());
+  }
 
-      // Success
+  void
+  setFontCacheFile(const std::string &filename)
+  {
+    std::lock_guard<std::mutex> lock(face_mutex);
+    face_cache_file = filename;
+    face_cache_file_set = true;
+    face_disk.clear();
+    face_disk_loaded = false;
+  }
 
-      std::cerr << "INFO: Using `" << filename << "` for font pattern '" << p << "'\n";
-      
-      if (fc_fontset)
-        FcFontSetSortDestroy(fc_fontset);
-      if (fc_pattern)
-        FcPatternDestroy(fc_pattern);
-      if (fc_font)
-        FcPatternDestroy(fc_font);
+  void
+  createFaceFromFcPattern(BLFontFace &face, std::string p, const char32_t *charset) {   
+
+    // The charset is part of the key
+    std::string key = p;
+    if (charset) {
+      char buffer[16];
+      for ( const char32_t *c = charset ; *c ; c++ ) {
+        snprintf(buffer, sizeof(buffer), " U+%04X", unsigned(*c));
+        key += buffer;
+      }
+    }
+    
+    std::lock_guard<std::mutex> lock(face_mutex);
+
+    auto it = face_memo.find(key);
+    if (it != face_memo.end()) {
+      face = it->second;
       return;
-      
     }
 
-    std::cerr << "Failed to get font from pattern: '" << p << "'\n"; 
-    exit(1);
-     
+    load_font_cache();
+    auto dit = face_disk.find(key);
+    if ( dit != face_disk.end() ) {
+      const ResolvedFace &entry = dit->second;
+      if ( entry.mtime == file_mtime(entry.file) &&
+           load_face(face, entry.file.c_str(), entry.index, false) ) {
+        std::cerr << "INFO: Using `" << entry.file << "` for font pattern '" << p << "' (cached)\n";
+        face_memo[key] = face;
+        return;
+      }
+    }
+
+    std::string file;
+    int index = 0;
+    if ( !resolve_fc_pattern(face, p, file, index) ) {
+      std::cerr << "Failed to get font from pattern: '" << p << "'\n"; 
+      exit(1);
+    }
+
+    std::cerr << "INFO: Using `" << file << "` for font pattern '" << p << "'\n";
+    face_memo[key] = face;
+    save_font_cache_entry(key, ResolvedFace{ file, index, file_mtime(file) });
+  }
+
+  ShapedTextCache &
+  ShapedTextCache::global()
+  {
+    static ShapedTextCache cache ;
+    return cache ;
+  }
+
+  std::shared_ptr<const ShapedText>
+  ShapedTextCache::shape(const BLFont &font, const std::string &text)
+  {
+    Key key{ font.impl, text } ;
+    {
+      std::lock_guard<std::mutex> lock(mutex) ;
+      auto it = map.find(key) ;
+      if (it != map.end()) {
+        lru.splice(lru.begin(), lru, it->second) ;
+        counters.hits++ ;
+        return it->second->second ;
+      }
+      counters.misses++ ;
+    }
+
+    // Shape without holding the lock so that multiple threads
+    // can shape different texts concurrently.
+    auto shaped = std::make_shared<ShapedText>() ;
+    shaped->font = font ;
+    shaped->glyphs.setUtf8Text( text.data(), text.size() ) ;
+    font.shape(shaped->glyphs) ;
+    font.getTextMetrics(shaped->glyphs, shaped->metrics) ;
+
+    std::lock_guard<std::mutex> lock(mutex) ;
+    auto it = map.find(key) ;
+    if (it != map.end()) {
+      // Shaped meanwhile by another thread
+      return it->second->second ;
+    }
+    lru.emplace_front(key, shaped) ;
+    map[key] = lru.begin() ;
+    while (lru.size() > capacity) {
+      map.erase(lru.back().first) ;
+      lru.pop_back() ;
+    }
+    return shaped ;
+  }
+
+  void
+  ShapedTextCache::setCapacity(size_t n)
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    capacity = std::max(size_t(1),n) ;
+    while (lru.size() > capacity) {
+      map.erase(lru.back().first) ;
+      lru.pop_back() ;
+    }
+  }
+
+  void
+  ShapedTextCache::clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    map.clear() ;
+    lru.clear() ;
+  }
+
+  size_t
+  ShapedTextCache::size()
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    return lru.size() ;
+  }
+
+  ShapedTextCache::Stats
+  ShapedTextCache::stats()
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    return counters ;
+  }
+
+  GlyphAtlas &
+  GlyphAtlas::global()
+  {
+    static GlyphAtlas atlas ;
+    return atlas ;
+  }
+
+  bool
+  GlyphAtlas::fillGlyphRun(BLContext &ctx, const BLPoint &pos, const BLFont &font,
+                           const BLGlyphRun &run, BLRgba32 color)
+  {
+    return drawGlyphRun(ctx, pos, font, run, color, 0.0) ;
+  }
+
+  bool
+  GlyphAtlas::strokeGlyphRun(BLContext &ctx, const BLPoint &pos, const BLFont &font,
+                             const BLGlyphRun &run, BLRgba32 color, double width)
+  {
+    if (width <= 0)
+      return true ; // nothing to draw
+    return drawGlyphRun(ctx, pos, font, run, color, width) ;
+  }
+
+  void
+  GlyphAtlas::clear()
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    reset() ;
+  }
+
+  // Reminder: the mutex must be locked.
+  void
+  GlyphAtlas::reset()
+  {
+    cells.clear() ;
+    fonts.clear() ;
+    pages.clear() ;
+    shelf_x = shelf_y = shelf_h = 0 ;
+    full = false ;
+  }
+
+  GlyphAtlas::Stats
+  GlyphAtlas::stats()
+  {
+    std::lock_guard<std::mutex> lock(mutex) ;
+    Stats s = counters ;
+    s.pages = pages.size() ;
+    return s ;
+  }
+
+  // Find room for a w x h cell using a simple shelf packing in the
+  // last page. A new page is created when the last one is full.
+  //
+  // Return false if the cell is larger than a page or if all pages
+  // are full (and then set the full flag). The existing cells are
+  // never affected.
+  bool
+  GlyphAtlas::allocate(int w, int h, int &page, BLRectI &rect)
+  {
+    if (w > PAGE_SIZE || h > PAGE_SIZE)
+      return false ;
+
+    if (!pages.empty()) {
+      bool next_shelf = (shelf_x + w > PAGE_SIZE) ;
+      int  y = next_shelf ? shelf_y + shelf_h : shelf_y ;
+      if ( y + h > PAGE_SIZE && int(pages.size()) >= MAX_PAGES ) {
+        full = true ;
+        return false ;
+      }
+      if (next_shelf) {
+        shelf_y += shelf_h ;
+        shelf_x = 0 ;
+        shelf_h = 0 ;
+      }
+    }
+
+    if ( pages.empty() || shelf_y + h > PAGE_SIZE ) {
+      pages.emplace_back() ;
+      pages.back().create(PAGE_SIZE, PAGE_SIZE, BL_FORMAT_PRGB32) ;
+      BLContext ctx(pages.back()) ;
+      ctx.clearAll() ;
+      ctx.end() ;
+      shelf_x = shelf_y = shelf_h = 0 ;
+    }
+
+    page = int(pages.size())-1 ;
+    rect = BLRectI(shelf_x, shelf_y, w, h) ;
+    shelf_x += w ;
+    shelf_h = std::max(shelf_h, h) ;
+    return true ;
+  }
+
+  // Reminder: the mutex must be locked.
+  //
+  // Return nullptr if the glyph cannot be stored in the atlas.
+  const GlyphAtlas::Cell *
+  GlyphAtlas::getCell(const Key &key, const BLFont &font)
+  {
+    auto it = cells.find(key) ;
+    if (it != cells.end()) {
+      counters.hits++ ;
+      return &it->second ;
+    }
+    counters.misses++ ;
+
+    Cell cell{ -1, BLRectI(), 0, 0 } ;
+
+    // The outline at the final scale with the subpixel offset.
+    BLMatrix2D m = BLMatrix2D::makeScaling(key.sx, key.sy) ;
+    m.m20 = double(key.bucket) / SUBPIXELS ;
+    BLPath path ;
+    font.getGlyphOutlines(key.glyph, &m, path) ;
+
+    BLBox box ;
+    if ( !path.empty() && path.getBoundingBox(&box) == BL_SUCCESS ) {
+      double stroke = key.stroke * 0.5 * (key.sx+key.sy) ;
+      int pad = 1 + int(std::ceil(stroke*0.5)) ;
+      cell.ox = int(std::floor(box.x0)) - pad ;
+      cell.oy = int(std::floor(box.y0)) - pad ;
+      int w = int(std::ceil(box.x1)) + pad - cell.ox ;
+      int h = int(std::ceil(box.y1)) + pad - cell.oy ;
+      BLRectI rect ;
+      int page ;
+      if ( !allocate(w, h, page, rect) )
+        return nullptr ;
+      // If the page is also referenced by a thread currently blitting
+      // from it then Blend2D makes a private copy of the page.
+      BLContext ctx(pages[page]) ;
+      ctx.translate(rect.x - cell.ox, rect.y - cell.oy) ;
+      BLRgba32 color(key.color) ;
+      if (key.stroke > 0) {
+        BLStrokeOptions opts ;
+        opts.startCap   = key.start_cap ;
+        opts.endCap     = key.end_cap ;
+        opts.join       = key.join ;
+        opts.miterLimit = key.miter ;
+        opts.width      = stroke ;
+        ctx.setStrokeOptions(opts) ;
+        ctx.setStrokeStyle(color) ;
+        ctx.strokePath(path) ;
+      } else {
+        ctx.setFillStyle(color) ;
+        ctx.fillPath(path) ;
+      }
+      ctx.end() ;
+      cell.page = page ;
+      cell.rect = rect ;
+    }
+    
+    fonts.emplace(key.font, font) ;
+    return &(cells[key] = cell) ;
+  }
+
+  bool
+  GlyphAtlas::drawGlyphRun(BLContext &ctx, const BLPoint &pos, const BLFont &font,
+                           const BLGlyphRun &run, BLRgba32 color, double stroke)
+  {
+    // Only a scaling + translation is supported.
+    BLMatrix2D um = ctx.userMatrix() ;
+    BLMatrix2D mm = ctx.metaMatrix() ;
+    if ( um.m01!=0 || um.m10!=0 || mm.m01!=0 || mm.m10!=0 )
+      return false ;
+    if ( um.m00<=0 || um.m11<=0 || mm.m00<=0 || mm.m11<=0 ) 
+      return false ;
+
+    // The dashes depend on the position in the whole run.
+    const BLStrokeOptions &so = ctx.strokeOptions() ;
+    if ( stroke > 0 && !so.dashArray.empty() )
+      return false ;
+
+    // From user to device coordinates 
+    double sx = um.m00 * mm.m00 ;
+    double sy = um.m11 * mm.m11 ;
+    double tx = um.m20 * mm.m00 + mm.m20 ;
+    double ty = um.m21 * mm.m11 + mm.m21 ;
+
+    struct Blit {
+      int     page;
+      BLRectI rect;
+      int     x;
+      int     y;
+    };
+    std::vector<Blit> blits ;
+    std::vector<BLImage> used_pages ;
+    bool fits = true ;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex) ;
+
+      // Reset a full atlas before looking up any cell so that all the
+      // cells of the run refer to the same set of pages.
+      if (full)
+        reset() ;
+
+      const BLFontMatrix &fm = font.matrix() ;
+      double ax = 0 ;  // accumulated advance (in font units)
+      double ay = 0 ;
+      BLGlyphRunIterator it(run) ;
+      while (!it.atEnd()) {
+        double px = ax ;
+        double py = ay ;
+        if (it.hasPlacement()) {
+          const BLGlyphPlacement &pl = it.placement<BLGlyphPlacement>() ;
+          px += pl.placement.x ;
+          py += pl.placement.y ;
+          ax += pl.advance.x ;
+          ay += pl.advance.y ;
+        }
+        // Glyph origin in device coordinates
+        double dx = (pos.x + px*fm.m00 + py*fm.m10) * sx + tx ;
+        double dy = (pos.y + px*fm.m01 + py*fm.m11) * sy + ty ;
+        double ix = std::floor(dx) ;
+        int bucket = int( std::lround((dx-ix)*SUBPIXELS) ) ;
+        if (bucket==SUBPIXELS) {
+          bucket = 0 ;
+          ix += 1 ;
+        }
+        int iy = int(std::lround(dy)) ;
+
+        Key key{ font.impl, uint32_t(it.glyphId()), uint32_t(bucket), color.value,
+                 float(stroke), float(sx), float(sy), 0, 0, 0, 0.0f } ;
+        if (stroke > 0) {
+          key.start_cap = so.startCap ;
+          key.end_cap   = so.endCap ;
+          key.join      = so.join ;
+          key.miter     = float(so.miterLimit) ;
+        }
+        const Cell *cell = getCell(key, font) ;
+        if (!cell) {
+          fits = false ;
+          break ;
+        }
+        if (cell->page >= 0) 
+          blits.push_back( Blit{cell->page, cell->rect, int(ix) + cell->ox, iy + cell->oy} ) ;
+        it.advance() ;
+      }
+
+      // Take a reference to the pages so they remain valid after unlocking.
+      if (fits)
+        used_pages = pages ;
+    }
+
+    if (!fits) {
+      // Draw the run without the atlas.
+      ctx.save() ;
+      if (stroke > 0) {
+        ctx.setStrokeStyle(color) ;
+        ctx.setStrokeWidth(stroke) ;
+        ctx.strokeGlyphRun(pos, font, run) ;
+      } else {
+        ctx.setFillStyle(color) ;
+        ctx.fillGlyphRun(pos, font, run) ;
+      }
+      ctx.restore() ;
+      return true ;
+    }
+
+    // Blit in device coordinates. The blits only use the global alpha
+    // so it also includes the fill or stroke alpha.
+    double alpha = (stroke > 0) ? ctx.strokeAlpha() : ctx.fillAlpha() ;
+    ctx.save() ;
+    ctx.resetMatrix() ;
+    ctx.setGlobalAlpha( ctx.globalAlpha() * alpha ) ;
+    for (const Blit &b : blits) {
+      BLRect dst( (b.x - mm.m20) / mm.m00,
+                  (b.y - mm.m21) / mm.m11,
+                  b.rect.w / mm.m00,
+                  b.rect.h / mm.m11 ) ;
+      ctx.blitImage(dst, used_pages[b.page], b.rect) ;
+    }
+    ctx.restore() ;
+    return true ;
   }
 
-  // A global font map
-  std::map<std::string,BLFont> font_aliases;
+  //
+  // The global font registry.
+  //
+  // The fonts are stored in an append-only chunked array so they never
+  // move and the references returned by getFont() remain valid. Each
+  // registration appends a new font instead of modifying an existing
+  // one so a reader never sees a font being modified.
+  //
+  // The readers access an immutable snapshot of the alias/id tables
+  // with a single atomic load. The writers (registerFont & getFontId)
+  // are serialized by a mutex and publish a modified copy of the
+  // snapshot. The old snapshots only contain the tables and are
+  // released once their last reader is done.
+  //
+  struct FontRegistry {
+    std::unordered_map<std::string,FontId> ids;    // alias -> id
+    std::vector<std::string>               names;  // id -> alias
+    std::vector<const BLFont*>             fonts;  // id -> font or nullptr if not defined
+  };
+
+  class FontStore {
+  public:
+    // Reminder: registry_mutex must be locked.
+    const BLFont * add(const BLFont &font) {
+      if (m_used == CHUNK_SIZE || m_chunks.empty()) {
+        m_chunks.emplace_back(new BLFont[CHUNK_SIZE]);
+        m_used = 0;
+      }
+      BLFont *slot = &m_chunks.back()[m_used++];
+      *slot = font;
+      return slot;
+    }
+  private:
+    static const size_t CHUNK_SIZE = 64 ;
+    std::vector<std::unique_ptr<BLFont[]>> m_chunks;
+    size_t                                 m_used = 0;
+  };
+
+  static std::mutex                          registry_mutex;
+  static std::shared_ptr<const FontRegistry> registry;
+  static FontStore                           registry_fonts;
 
+  static const FontId FALLBACK_ID = 0 ;
+  
+  static std::shared_ptr<const FontRegistry>
+  load_registry()
+  {
+    return std::atomic_load(&registry);
+  }
+
+  // Reminder: registry_mutex must be locked.
+  static std::shared_ptr<FontRegistry>
+  copy_registry()
+  {
+    std::shared_ptr<const FontRegistry> cur = load_registry();
+    if (cur)
+      return std::make_shared<FontRegistry>(*cur);
+    // The id of the fallback font is always 0
+    auto reg = std::make_shared<FontRegistry>();
+    reg->ids["fallback"] = FALLBACK_ID;
+    reg->names.push_back("fallback");
+    reg->fonts.push_back(nullptr);
+    return reg;
+  }
+
+  // Reminder: registry_mutex must be locked.
+  static void
+  publish_registry(std::shared_ptr<const FontRegistry> reg)
+  {
+    std::atomic_store(&registry, std::move(reg));
+  }
+
+  // Reminder: registry_mutex must be locked.
+  static FontId
+  intern_alias(FontRegistry &reg, const std::string &alias)
+  {
+    auto it = reg.ids.find(alias);
+    if (it != reg.ids.end())
+      return it->second;
+    FontId id = FontId(reg.names.size());
+    reg.ids[alias] = id;
+    reg.names.push_back(alias);
+    reg.fonts.push_back(nullptr);
+    return id;
+  }
+
+  static void
+  define_font(const std::string &alias, const BLFont &font)
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::shared_ptr<FontRegistry> reg = copy_registry();
+    FontId id = intern_alias(*reg, alias);
+    reg->fonts[id] = registry_fonts.add(font);
+    publish_registry(std::move(reg));
+  }
+  
   void
   registerFont(std::string alias, const BLFont &font)
   {
-    font_aliases[alias] = font; 
+    define_font(alias, font);
   }
 
   void
   registerFont(std::string alias, std::string other)
   {
-    font_aliases[alias] = getFont(other,true); 
+    define_font(alias, getFont(other,true)); 
   }
   
   void
   registerFont(std::string alias, const BLFontFace &face, float size)
   {
-    font_aliases[alias].createFromFace(face,size); 
+    BLFont font;
+    font.createFromFace(face,size);
+    define_font(alias, font);
   }
-  
+
+  FontId
+  getFontId(const std::string &alias)
+  {
+    {
+      std::shared_ptr<const FontRegistry> reg = load_registry();
+      if (reg) {
+        auto it = reg->ids.find(alias);
+        if (it != reg->ids.end())
+          return it->second;
+      }
+    }
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::shared_ptr<FontRegistry> copy = copy_registry();
+    FontId id = intern_alias(*copy, alias);
+    publish_registry(std::move(copy));
+    return id;
+  }
+
   const BLFont &
-  getFont(std::string alias, bool strict)
+  getFont(FontId id, bool strict)
   {
-    static const std::string fallback("fallback"); 
-    auto it = font_aliases.find(alias) ;
-    if (it != font_aliases.end()) {
-      return it->second;
+    std::shared_ptr<const FontRegistry> reg = load_registry();
+    if ( reg && id < reg->names.size() ) {
+      if (reg->fonts[id])
+        return *reg->fonts[id];
+      if (!strict && id!=FALLBACK_ID && reg->fonts[FALLBACK_ID]) {
+        std::cerr << "Warning: Using fallback font instead of '" << reg->names[id] << "'\n";
+        return *reg->fonts[FALLBACK_ID];
+      }
+      std::cerr << "Unknown font alias '" << reg->names[id] << "'\n";
+      exit(1);
     }
-    if (!strict && alias!=fallback) {
-      it = font_aliases.find(fallback) ;
-      if (it != font_aliases.end()) {
+    std::cerr << "Unknown font id " << id << "\n";
+    exit(1);
+  }
+    
+  const BLFont &
+  getFont(const std::string &alias, bool strict)
+  {
+    std::shared_ptr<const FontRegistry> reg = load_registry();
+    if (reg) {
+      auto it = reg->ids.find(alias);
+      if (it != reg->ids.end())
+        return getFont(it->second, strict);
+      if (!strict && reg->fonts[FALLBACK_ID]) {
         std::cerr << "Warning: Using fallback font instead of '" << alias << "'\n";
-        return it->second;
+        return *reg->fonts[FALLBACK_ID];
       }
     }
     std::cerr << "Unknown font alias '" << alias << "'\n";
@@ -2,8 +2,15 @@
 #define VEX_TEXT_BOX_H
 
 #include <vector>
+#include <deque>
 #include <list>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <atomic>
+#include <limits>
+#include <algorithm>
 
 #include <iostream>
 
@@ -47,15 +54,239 @@ namespace btb
   // See also man fc-match(1)
   //
   //
+  // The resolved faces are memoized and the matching (file,index) are
+  // also stored in a cache file so that fontconfig is only queried once
+  // per pattern (see setFontCacheFile).
+  //
   void createFaceFromFcPattern(BLFontFace &face, std::string pattern, const char32_t *charset=0) ;
+
+  // Set the file used to store the resolved font patterns.
+  //
+  // The default is $VEX_FONT_CACHE if set, else
+  // $XDG_CACHE_HOME/vex/fonts.cache, else ~/.cache/vex/fonts.cache.
+  // An empty filename disables the cache file.
+  void setFontCacheFile(const std::string &filename) ;
   
   
   // Get the font previously registered to the the given alias.
   // If the alias is not defined then if strict is false then the
   // "fallback" font will be used instead. Otherwise a fatal error
   // occurs.
-  const BLFont & getFont(std::string alias, bool strict=false);
+  //
+  // The font registry can be read concurrently from multiple threads
+  // without locking (the registrations are expected to be rare and
+  // should preferably happen before rendering). The returned reference
+  // remains valid until the end of the program.
+  const BLFont & getFont(const std::string &alias, bool strict=false);
+
+  // An interned font alias for a faster lookup with getFont(FontId).
+  //
+  // The id of an alias never changes even if the alias is registered 
+  // again or is not yet registered. 
+  typedef uint32_t FontId;
+
+  // Get the id of a font alias.
+  FontId getFontId(const std::string &alias);
+
+  // Similar to getFont(alias,strict) with an interned alias.
+  const BLFont & getFont(FontId id, bool strict=false);
   
+  // The result of shaping a UTF-8 text with a given font.
+  struct ShapedText {
+    BLFont          font;     // Keep the font alive (it is part of the key)
+    BLGlyphBuffer   glyphs;
+    BLTextMetrics   metrics;
+  };
+
+  //
+  // A thread-safe LRU cache of shaped texts.
+  //
+  // Shaping (setUtf8Text + shape + getTextMetrics) is by far the most
+  // expensive part of TextBoxBase::finalize() so text boxes rebuilt at
+  // each frame with the same content should share their glyph runs.
+  //
+  // The key is the pair (font, text) where the font is identified by its
+  // Blend2D implementation. A BLFont implementation is immutable once
+  // created and fully describes the face, the size and the features
+  // so all copies of a registered font share the same cache entries.
+  //
+  // The entries are immutable and shared with their users (the blocks of
+  // text) so an eviction never invalidates a text box.
+  //
+  class ShapedTextCache {
+  public:
+    
+    struct Stats {
+      size_t hits{0};
+      size_t misses{0};
+    };
+    
+  private:
+    
+    struct Key {
+      const void *  font;
+      std::string   text;
+      bool operator==(const Key &k) const { return font==k.font && text==k.text; }
+    };
+
+    struct KeyHash {
+      size_t operator()(const Key &k) const {
+        return std::hash<std::string>()(k.text) ^ (std::hash<const void*>()(k.font) * 31) ;
+      }
+    };
+
+    typedef std::pair<Key, std::shared_ptr<const ShapedText>> Entry ;
+
+    std::mutex        mutex;
+    std::list<Entry>  lru;      // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map;
+    size_t            capacity{4096};
+    Stats             counters;
+    
+  public:
+
+    // The cache used by all text boxes.
+    static ShapedTextCache & global() ;
+    
+    // Provide the shaped version of text for the given font.
+    std::shared_ptr<const ShapedText> shape(const BLFont &font, const std::string &text) ;
+
+    // Set the maximum number of entries.
+    void setCapacity(size_t n) ;
+    
+    void clear() ;
+
+    size_t size() ;
+    
+    Stats stats() ;
+  };
+
+  //
+  // A cache of rasterized glyphs.
+  //
+  // Filling the glyph outlines is usually the dominant cost when drawing
+  // a lot of text. With the atlas, each glyph is rasterized only once per
+  // (font, scale, subpixel offset, style, color) in a page of the atlas
+  // and then blitted.
+  //
+  // Only the solid colors are supported and the transformation of the
+  // context must be a scaling plus a translation. The draw functions
+  // return false when that is not the case (or for a dashed stroke)
+  // and the caller is then expected to use the regular BLContext
+  // functions. The fill or stroke alpha and the stroke options of the
+  // context are honored as by the BLContext functions.
+  //
+  // The horizontal position of the glyphs is quantized to 1/4 of pixel
+  // and the vertical position to 1 pixel. 
+  //
+  // When all the pages are full, the atlas is reset before the next
+  // glyph run. A run that does not fit in the remaining space (or that
+  // contains a glyph larger than a page) is drawn directly.
+  //
+  // The atlas is thread-safe. The pages being reference counted, the
+  // rasterization of new glyphs never affects the pages being blitted
+  // by other threads.
+  //
+  class GlyphAtlas {
+  public:
+
+    struct Stats {
+      size_t hits{0};
+      size_t misses{0};
+      size_t pages{0};
+    };
+
+    static constexpr int PAGE_SIZE = 1024 ;
+    static constexpr int MAX_PAGES = 8 ;
+    static constexpr int SUBPIXELS = 4 ;
+    
+  private:
+
+    struct Key {
+      const void * font;
+      uint32_t     glyph;
+      uint32_t     bucket;   // subpixel offset (in 1/SUBPIXELS)
+      uint32_t     color;
+      float        stroke;   // stroke width or 0 for fill 
+      float        sx;
+      float        sy;
+      // The stroke options (0 for fill)
+      uint8_t      start_cap;
+      uint8_t      end_cap;
+      uint8_t      join;
+      float        miter;
+      bool operator==(const Key &k) const {
+        return font==k.font && glyph==k.glyph && bucket==k.bucket && color==k.color
+          && stroke==k.stroke && sx==k.sx && sy==k.sy
+          && start_cap==k.start_cap && end_cap==k.end_cap && join==k.join && miter==k.miter ;
+      }
+    };
+
+    struct KeyHash {
+      size_t operator()(const Key &k) const {
+        size_t h = std::hash<const void*>()(k.font) ;
+        h = h*31 + k.glyph ;
+        h = h*31 + k.bucket ;
+        h = h*31 + k.color ;
+        h = h*31 + std::hash<float>()(k.stroke) ;
+        h = h*31 + std::hash<float>()(k.sx) ;
+        h = h*31 + std::hash<float>()(k.sy) ;
+        h = h*31 + (k.start_cap | (k.end_cap << 8) | (k.join << 16)) ;
+        h = h*31 + std::hash<float>()(k.miter) ;
+        return h ;
+      }
+    };
+
+    struct Cell {
+      int     page;   // -1 for an empty glyph (e.g. space)
+      BLRectI rect;   // area in the page
+      int     ox;     // offset of the cell relatively to the glyph origin (in pixels)
+      int     oy;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<Key, Cell, KeyHash> cells;
+    // A reference to each font used in a key so that its implementation
+    // cannot be released and its address reused by another font.
+    std::unordered_map<const void *, BLFont> fonts;
+    std::vector<BLImage> pages;
+    // The shelf packing state of the last page
+    int shelf_x{0};
+    int shelf_y{0};
+    int shelf_h{0};
+    // Set when a glyph did not fit in the last page. The atlas is then
+    // reset before drawing the next run.
+    bool full{false};
+    Stats counters;
+    
+  public:
+
+    static GlyphAtlas & global() ;
+
+    // Fill a glyph run with a solid color. 
+    bool fillGlyphRun(BLContext &ctx, const BLPoint &pos, const BLFont &font,
+                      const BLGlyphRun &run, BLRgba32 color) ;
+
+    // Stroke a glyph run with a solid color and the specified width.
+    bool strokeGlyphRun(BLContext &ctx, const BLPoint &pos, const BLFont &font,
+                        const BLGlyphRun &run, BLRgba32 color, double width) ;
+
+    void clear() ;
+
+    Stats stats() ;
+
+  private:
+
+    bool drawGlyphRun(BLContext &ctx, const BLPoint &pos, const BLFont &font,
+                      const BLGlyphRun &run, BLRgba32 color, double stroke) ;
+    
+    const Cell * getCell(const Key &key, const BLFont &font) ;
+
+    bool allocate(int w, int h, int &page, BLRectI &rect) ;
+
+    void reset() ;
+  };
+
   enum align_t : uint32_t 
   {
     align_left,          // Align to the left
@@ -63,6 +294,13 @@ namespace btb
     align_center         // Align to the left
   };
 
+  // Line wrapping algorithm (see TextBoxBase::setWrapWidth)
+  enum wrap_t : uint32_t 
+  {
+    wrap_greedy,         // Put as many words as possible on each row
+    wrap_optimal         // Minimize the raggedness of the whole paragraph (Knuth-Plass)
+  };
+
   // Horizontal gravity (origin of x coordinates) 
   enum xpoint_t : uint32_t 
   {
@@ -127,32 +365,110 @@ namespace btb
       double          x;
       double          y;
       BLTextMetrics   metrics;
-      BLGlyphBuffer   glyphs; 
+      // The shaped text (shared with ShapedTextCache)
+      std::shared_ptr<const ShapedText> shaped;
+      // The text or the font changed since the last finalize()
+      bool            dirty = true;
+      inline BLGlyphRun glyphRun() const { return shaped->glyphs.glyphRun(); }
+      // A subset of the glyphs [g0,g1)
+      inline BLGlyphRun glyphRun(size_t g0, size_t g1) const {
+        BLGlyphRun run = shaped->glyphs.glyphRun();
+        run.glyphData = (uint8_t*)run.glyphData + g0*run.glyphAdvance;
+        if (run.placementData)
+          run.placementData = (uint8_t*)run.placementData + g0*run.placementAdvance;
+        run.size = g1-g0;
+        return run;
+      }
+      inline size_t glyphCount() const { return shaped->glyphs.size(); }
+    };
+
+    // The combined vertical metrics of blocks (so potentially using
+    // different fonts) and their total width.
+    struct LineMetrics {
+      double width   = 0;  // Sum of all block advances
+      double ascent  = 0;  // Max of all block font ascents
+      double descent = 0;  // Max of all block font descents
+      double lineGap = 0;  // Max of all block font lineGaps?
+
+      // Apply the font metrics of a block.
+      void addFont(const BLFontMetrics &fm) {
+        ascent  = std::max( ascent, double(fm.ascent)) ;
+        // Let's maximize the total descent (so descent+linegap) instead
+        // of always maximizing the linegap.   
+        double total_descent = std::max( descent + lineGap,
+                                         double(fm.descent) + double(fm.lineGap) );
+        descent = std::max( descent , double(fm.descent) ) ;          
+        lineGap = total_descent - descent ;
+      }
+    };
+
+    // A sequence of glyphs in a block that ends either at a break
+    // opportunity (after some spaces) or at the end of the block.
+    //
+    // They are computed once after shaping and reused by the line
+    // wrapping so changing the wrap width does not require any shaping.
+    struct BreakItem {
+      size_t block;    // index of the block in the line
+      size_t g0;       // first glyph
+      size_t g1;       // last glyph (excluded)
+      double width;    // total advance (including trailing spaces)
+      double trail;    // advance of the trailing spaces
+      bool   brk;      // a row can be ended after that item
     };
     
     
     // Describe a single line of text (composed of at least one block)
     // 
     struct Line {
-      inline Line(align_t a) : align(a) , cr(false) { } 
-      double x; // Can it be computed on the fly?
-      double y; // Can it be computed on the fly?
+      inline Line(align_t a) : align(a) , cr(false), dirty(true) { } 
       align_t align;
       bool cr;  // Carriage Return (\r) vs New Line (\n)
-      // The combined metrics for all blocks in the line (so potentially using
-      // different fonts). 
-      struct {
-        double width;    // Sum of all 'blocks[*].metrics.advance'
-        double ascent;   // Max of all block font ascents
-        double descent;  // Max of all block font descents
-        double lineGap;  // Max of all block font lineGaps?
-      } metrics;
-      std::list<BlockBase*> blocks;
+      bool dirty; // At least one block must be layout again
+      // The metrics of the whole line (so without wrapping)
+      LineMetrics metrics;
+      // The blocks are owned by the implementation (see new_block()).
+      std::vector<BlockBase*> blocks;
+      // The break opportunities (see layout_line).
+      std::vector<BreakItem> items;
     } ;
     
     std::vector<Line> lines;
+
+    // A part of a block drawn in a row.
+    struct Fragment {
+      BlockBase * block;
+      size_t      g0;    // first glyph
+      size_t      g1;    // last glyph (excluded)
+      double      x;     // relative to the row
+    } ;
+
+    // A row is a line of text as displayed (so after wrapping).
+    // Without wrapping, there is exactly one row per line.
+    struct Row {
+      double x;
+      double y;
+      align_t align;
+      bool cr;
+      LineMetrics metrics;
+      std::vector<Fragment> fragments;
+    } ;
+
+    std::vector<Row> rows;
+
+    double wrap_width = 0 ;            // 0 means no wrapping 
+    wrap_t wrap_mode  = wrap_greedy ;
+
+    // Force the creation of a new block by the next append().
+    bool force_new_block = false;
     
   public:
+
+    // Identify a block of text for the incremental modifications.
+    // See mark() and replaceBlockText()
+    struct BlockRef {
+      size_t line;   // index of the line
+      size_t index;  // index of the block in the line 
+    };
     
     TextBoxBase()  {
       lines.emplace_back(this->align);
@@ -161,6 +477,10 @@ namespace btb
     virtual ~TextBoxBase()  {      
     }            
 
+    // The lines refer to blocks owned by the implementation.
+    TextBoxBase(const TextBoxBase &) = delete;
+    TextBoxBase & operator=(const TextBoxBase &) = delete;
+
     // Get the font from the block.
     virtual const BLFont &block_font(BlockBase &block) =0 ;
    
@@ -172,22 +492,28 @@ namespace btb
     virtual bool modified_attributes(BlockBase &last_block) =0;
    
     // Create a new empty block using the current attributes.
+    //
+    // The block remains owned by the implementation which is expected
+    // to allocate it from an arena (so with good locality during the
+    // layout and the draw).
     virtual BlockBase *new_block(void) = 0;
 
-    // Delete a block
-    virtual void delete_block(BlockBase *block) =0 ;
+    // Release all the blocks at once.
+    virtual void release_blocks() =0 ;
+
+    // Apply the current attributes to an existing block.
+    // Return true if the change affects the layout (e.g. a new font)
+    // and false if only the appearance is modified (e.g. a new color).
+    virtual bool assign_attributes(BlockBase &block) =0 ;
    
     // Remove all blocks of text thus clearing the whole textbox.    
     void clear() {
-      for ( Line & line : this->lines ) {
-        for ( BlockBase *b : line.blocks ) {
-          this->delete_block(b);
-        }
-      }
       this->lines.clear();
+      this->release_blocks();
       // Start with one empty line
       this->align = align_left;
       this->lines.emplace_back(this->align);
+      force_new_block = false;
       finalized = false;
     }
     
@@ -195,14 +521,33 @@ namespace btb
     // changed, create a new current block.
     // In both cases, the new block is suitable for appending text.
     BlockBase & current_block() {
-      bool need_new = false ;
       auto & blocks = this->lines.back().blocks;
-      if (blocks.empty() || this->modified_attributes(*blocks.back())) {
+      if (blocks.empty() || force_new_block || this->modified_attributes(*blocks.back())) {
         blocks.emplace_back( this->new_block() );
+        force_new_block = false;
       }
       return *blocks.back();      
     }
 
+    // Get an existing block (or fail with a fatal error)
+    BlockBase & get_block(const BlockRef &ref) {
+      if ( ref.line < this->lines.size() ) {
+        auto & blocks = this->lines[ref.line].blocks;
+        if ( ref.index < blocks.size() ) 
+          return *blocks[ref.index];
+      }
+      std::cerr << "ERROR: no text block at line " << ref.line << " index " << ref.index << "\n";
+      exit(1);
+    }
+
+    // Allow modifications of a finalized text box.
+    //
+    // Only the modified lines will be shaped and measured again by the
+    // next finalize().
+    inline void reopen() {
+      finalized = false;
+    }
+
     void assert_not_finalized() {
       if (finalized) {
         std::cerr << "ERROR: text box is already finalized\n";
@@ -220,7 +565,10 @@ namespace btb
     append_raw(const char *text, size_t len)
     {
       if (len>0) {        
-        current_block().text.append(text,len);
+        BlockBase &block = current_block() ;
+        block.text.append(text,len);
+        block.dirty = true;
+        this->lines.back().dirty = true;
       }
       return *this;      
     }
@@ -247,10 +595,12 @@ namespace btb
       return 0 ;
     }
     
+    // Append some text. This is also allowed after finalize() in which
+    // case only the last line and the new ones are layout again.
     TextBoxBase &
     append(const char *text, size_t len)
     {
-      assert_not_finalized();
+      reopen();
       size_t start = 0; // Start of the current raw sequence of character
       size_t pos = 0;  
       while(pos<len) {
@@ -292,70 +642,282 @@ namespace btb
       return append(text.data(),text.size());
     }  
 
+    // Start a new block at the current position and return a reference
+    // to it. The block is created by the next append() and can later be
+    // modified with replaceBlockText() or updateBlockAttributes().
+    //
+    // This is intended for the parts of a text that change often
+    // (counters, clocks, ...). 
+    //
+    // Example:
+    //
+    //    box.append("Time: ") ;
+    //    auto clock = box.mark() ;
+    //    box.append("00:00") ;
+    //    ...
+    //    box.replaceBlockText(clock, "00:01") ;
+    //
+    BlockRef mark() {
+      force_new_block = true;
+      return BlockRef{ this->lines.size()-1, this->lines.back().blocks.size() };
+    }
+
+    // The text of a block.
+    const std::string & blockText(const BlockRef &ref) {
+      return get_block(ref).text;
+    }
+    
+    // Replace the text of a block.
+    //
+    // The text is used as is (so no escape sequences and no newlines).
+    // Only the line containing the block is shaped and measured again.
+    void replaceBlockText(const BlockRef &ref, const std::string &text) {
+      BlockBase &block = get_block(ref) ;
+      if (block.text == text)
+        return ;
+      block.text  = text;
+      block.dirty = true;
+      this->lines[ref.line].dirty = true;
+      reopen();
+    }
+
+    // Apply the current text attributes to an existing block.
+    void updateBlockAttributes(const BlockRef &ref) {
+      BlockBase &block = get_block(ref) ;
+      if ( this->assign_attributes(block) ) {
+        block.dirty = true;
+        this->lines[ref.line].dirty = true;
+        reopen();
+      }
+    }
+
+  protected:
+
+    // Shape the modified blocks of a line, compute its horizontal 
+    // layout, its metrics and its break opportunities.
+    void layout_line(Line &line) {
+      line.metrics = LineMetrics();
+      line.items.clear();
+      double x = 0 ;
+      for (size_t b=0 ; b<line.blocks.size() ; b++) {
+        BlockBase & block = *line.blocks[b] ;
+
+        block.x = x;
+        block.y = 0;   // reserved from future height adjustments (e.g. superscript, subscript)
+
+        auto &font = this->block_font(block);
+        if ( block.dirty || !block.shaped ) {
+          block.shaped  = ShapedTextCache::global().shape(font, block.text) ;
+          block.metrics = block.shaped->metrics ;
+          block.dirty   = false;
+        }
+        
+        x += block.metrics.advance.x;
+        // Apply the font metrics to the line metrics
+        line.metrics.addFont(font.metrics()) ;
+        find_breaks(line, b) ;
+      }
+      line.metrics.width = x;
+      line.dirty = false;
+    }
+
+    // Split a block into BreakItems.
+    //
+    // For now, a break is only possible after a sequence of spaces.
+    void find_breaks(Line &line, size_t b) {
+      BlockBase & block = *line.blocks[b] ;
+      const BLGlyphBuffer &gb = block.shaped->glyphs ;
+      const BLGlyphInfo      *info = gb.infoData() ;
+      const BLGlyphPlacement *pl   = gb.placementData() ;
+      size_t n = gb.size() ;
+      if (n==0)
+        return ;
+      double scale = this->block_font(block).matrix().m00 ;
+      bool in_space = false ;
+      BreakItem item{ b, 0, 0, 0, 0, false } ;
+      for (size_t i=0 ; i<n ; i++) {
+        // Reminder: the cluster is the byte offset in the UTF-8 text.
+        uint32_t c = info ? info[i].cluster : 0 ; 
+        bool space = c < block.text.size() && (block.text[c]==' ' || block.text[c]=='\t') ;
+        if ( in_space && !space ) {
+          item.g1  = i ;
+          item.brk = true ;
+          line.items.push_back(item) ;
+          item = BreakItem{ b, i, i, 0, 0, false } ;
+          in_space = false ;
+        }
+        double advance = pl ? pl[i].advance.x * scale : 0 ;
+        item.width += advance ;
+        if (space) {
+          item.trail += advance ;
+          in_space = true ;
+        }
+      }
+      item.g1  = n ;
+      item.brk = in_space ;
+      line.items.push_back(item) ;
+    }
+
+    // The rows ending positions (as word indices) using a greedy algorithm.
+    //
+    // ww and wt are the word widths (without the trailing spaces) and the
+    // width of their trailing spaces.
+    static std::vector<size_t>
+    break_greedy(const std::vector<double> &ww, const std::vector<double> &wt, double width) {
+      std::vector<size_t> breaks ;
+      size_t start = 0 ;
+      double w = 0 ;
+      for (size_t k=0 ; k<ww.size() ; k++) {
+        if ( k>start && w + ww[k] > width ) {
+          breaks.push_back(k) ;
+          start = k ;
+          w = 0 ;
+        }
+        w += ww[k] + wt[k] ;
+      }
+      breaks.push_back(ww.size()) ;
+      return breaks ;
+    }
+
+    // The rows ending positions (as word indices) minimizing the sum of
+    // the squared free space of all rows except the last one.
+    static std::vector<size_t>
+    break_optimal(const std::vector<double> &ww, const std::vector<double> &wt, double width) {
+      size_t n = ww.size() ;
+      const double inf = std::numeric_limits<double>::infinity() ;
+      std::vector<double> cost(n+1, inf) ;
+      std::vector<size_t> prev(n+1, 0) ;
+      cost[0] = 0 ;
+      for (size_t i=0 ; i<n ; i++) {   // a row starting with word i
+        if (cost[i]==inf)
+          continue ;
+        double w = 0 ;
+        for (size_t j=i ; j<n ; j++) { // and ending with word j 
+          w += ww[j] ;
+          if ( w > width && j>i )
+            break ;
+          double slack = width - w ;
+          double c = (j==n-1 && slack>=0) ? 0 : slack*slack ; 
+          if ( cost[i] + c < cost[j+1] ) {
+            cost[j+1] = cost[i] + c ;
+            prev[j+1] = i ;
+          }
+          w += wt[j] ;
+        }
+      }
+      std::vector<size_t> breaks ;
+      for (size_t k=n ; k>0 ; k=prev[k])
+        breaks.push_back(k) ;
+      std::reverse(breaks.begin(), breaks.end()) ;
+      return breaks ;
+    }
+
+    // Create a row from the items [i0,i1) of a line.
+    void add_row(Line &line, size_t i0, size_t i1, bool last) {
+      Row row{ 0, 0, line.align, last && line.cr, LineMetrics(), {} } ;
+      double x = 0 ;
+      for (size_t i=i0 ; i<i1 ; i++) {
+        const BreakItem &item = line.items[i] ;
+        BlockBase *block = line.blocks[item.block] ;
+        if ( !row.fragments.empty() && row.fragments.back().block==block ) {
+          row.fragments.back().g1 = item.g1 ;
+        } else {
+          row.fragments.push_back( Fragment{ block, item.g0, item.g1, x } ) ;
+          row.metrics.addFont( this->block_font(*block).metrics() ) ;
+        }
+        x += item.width ;
+      }
+      // The trailing spaces of the last word are not visible.
+      row.metrics.width = x - line.items[i1-1].trail ;
+      this->rows.push_back(std::move(row)) ;
+    }
+    
+    // Create the rows for a line.
+    void build_rows(Line &line) {
+      if ( wrap_width<=0 || line.metrics.width <= wrap_width || line.items.empty() ) {
+        // A single row with all blocks.
+        Row row{ 0, 0, line.align, line.cr, line.metrics, {} } ;
+        for (BlockBase *block : line.blocks) 
+          row.fragments.push_back( Fragment{ block, 0, block->glyphCount(), block->x } ) ;
+        this->rows.push_back(std::move(row)) ;
+        return ;
+      }
+
+      // Group the items into words (a word ends with an item allowing a break).
+      std::vector<size_t> ends ;   // the end of each word (exclusive item index)
+      std::vector<double> ww ;
+      std::vector<double> wt ;
+      double w = 0 ;
+      for (size_t i=0 ; i<line.items.size() ; i++) {
+        const BreakItem &item = line.items[i] ;
+        w += item.width ;
+        if ( item.brk || i+1 == line.items.size() ) {
+          ends.push_back(i+1) ;
+          ww.push_back(w-item.trail) ;
+          wt.push_back(item.trail) ;
+          w = 0 ;
+        }
+      }
+      
+      std::vector<size_t> breaks = (wrap_mode==wrap_optimal)
+        ? break_optimal(ww, wt, wrap_width)
+        : break_greedy(ww, wt, wrap_width) ;
+      
+      size_t k0 = 0 ;
+      for (size_t k : breaks) {
+        add_row(line, k0 ? ends[k0-1] : 0, ends[k-1], k==ends.size()) ;
+        k0 = k ;
+      }
+    }
+    
+  public:
+
     // (re)compute the position of all blocks and update
-    // metrics accordingly. 
+    // metrics accordingly.
+    //
+    // Only the modified lines are shaped and measured again. The
+    // wrapping, the vertical layout and the alignment do not require
+    // any shaping so they are always recomputed.
     TextBoxBase & finalize() {
       assert_not_finalized();   
+
+      this->rows.clear() ;
+      for ( Line &line : this->lines ) {
+        if (line.dirty)
+          layout_line(line) ;
+        build_rows(line) ;
+      }
+      
       this->text_width = 0; 
       double y = 0;
       double gap = 0;
 
-      // mcr values hold the combined vertical metrics for consecutive 'cr' lines. 
+      // mcr values hold the combined vertical metrics for consecutive 'cr' rows. 
       double mcr_ascent=0;
       double mcr_descent=0;
       double mcr_gap=0;
 
-      double kcr = 0; // first k index of the current sequence of 'cr' lines
-      size_t nl = this->lines.size() ;
-      for ( size_t k=0 ; k<nl ; k++) {
-        Line &line = this->lines[k];
-
-        line.x = 0; 
-        line.metrics.ascent=0; 
-        line.metrics.descent=0; 
-        line.metrics.lineGap=0; 
-        double x = 0 ;
-        for (BlockBase *block_p : line.blocks) {
-          BlockBase & block = *block_p ;
-
-          block.x = x;
-          block.y = 0;   // reserved from future height adjustments (e.g. superscript, subscript)
-
-          // block.glyphs.setUtf8Text(block.text.c_str());
-          block.glyphs.setUtf8Text( block.text.data() , block.text.size()  );
-          
-          auto &font = this->block_font(block);
-          font.shape(block.glyphs);
-          int err = font.getTextMetrics(block.glyphs, block.metrics);
-
-          x += block.metrics.advance.x;
-          // Apply the font metrics to the line metrics
-          const BLFontMetrics &fm = font.metrics();
-          line.metrics.ascent  = std::max( line.metrics.ascent, double(fm.ascent)) ;
-          // Let's maximize the total descent (so descent+linegap) instead
-          // of always maximizing the linegap.   
-          double total_descent = std::max( line.metrics.descent + line.metrics.lineGap,
-                                           double(fm.descent) + double(fm.lineGap) );
-          line.metrics.descent = std::max( line.metrics.descent , double(fm.descent) ) ;          
-          line.metrics.lineGap = total_descent - line.metrics.descent ;
-        }
-        line.metrics.width = x;            
-        this->text_width = std::max(this->text_width, line.metrics.width);
+      size_t kcr = 0; // first k index of the current sequence of 'cr' rows
+      size_t nr = this->rows.size() ;
+      for ( size_t k=0 ; k<nr ; k++) {
+        Row &row = this->rows[k];
+
+        this->text_width = std::max(this->text_width, row.metrics.width);
 
-        // Apply the current line metrics to  the combined cr metrics  
+        // Apply the current row metrics to the combined cr metrics  
         
-        mcr_ascent  = std::max(mcr_ascent,  line.metrics.ascent) ;
-        double mcr_total_descent = std::max( line.metrics.descent + line.metrics.lineGap,
+        mcr_ascent  = std::max(mcr_ascent,  row.metrics.ascent) ;
+        double mcr_total_descent = std::max( row.metrics.descent + row.metrics.lineGap,
                                              mcr_descent + mcr_gap );
-        mcr_descent = std::max(mcr_descent, line.metrics.descent) ;
+        mcr_descent = std::max(mcr_descent, row.metrics.descent) ;
         mcr_gap     = mcr_total_descent - mcr_descent;
         
-        if ( !line.cr || k==nl-1 ) {
+        if ( !row.cr || k==nr-1 ) {
           // Found a newline or reached the bottom. 
           // Apply the current combined cr metrics. 
           y += gap + mcr_ascent;
           for ( ; kcr <= k ; kcr++ ) {
-            this->lines[kcr].y = y ;
+            this->rows[kcr].y = y ;
           }
           y  += mcr_descent; 
           gap = mcr_gap;
@@ -368,36 +930,38 @@ namespace btb
       }
       this->text_height = y ;
 
-#if 0
-      if (this->align==align_right) {
-        for (Line &line : this->lines) {
-          line.x = this->text_width - line.metrics.width;
-        }
-      } else if (this->align==align_center) {
-        for (Line &line : this->lines) {
-          line.x = (this->text_width - line.metrics.width)/2;
-        }
-      }
-#else
-      for (Line &line : this->lines) {
-        switch (line.align) {       
+      for (Row &row : this->rows) {
+        switch (row.align) {       
         case align_right:
-          line.x = this->text_width - line.metrics.width;
+          row.x = this->text_width - row.metrics.width;
           break;
         case align_center:
-          line.x = (this->text_width - line.metrics.width)/2;
+          row.x = (this->text_width - row.metrics.width)/2;
+          break;
         case align_left:
         default:
-          line.x = line.x; 
+          row.x = 0; 
           break;
         }
       }
-#endif
       
       finalized = true;
       return *this;
     }
 
+    // Wrap the lines longer than width. A width of 0 disables the wrapping.
+    //
+    // The text is only broken after spaces so a single word can still
+    // be longer than the wrap width. Changing the width does not require
+    // to shape the text again.
+    void setWrapWidth(double width, wrap_t mode=wrap_greedy) {
+      if ( width != this->wrap_width || mode != this->wrap_mode ) {
+        reopen();
+        this->wrap_width = width;
+        this->wrap_mode  = mode;
+      }
+    }
+
     // Compute the width of the whole text area so excluding borders.
     double width() {
       auto_finalize();
@@ -411,8 +975,8 @@ namespace btb
     }
 
     void setAlign(align_t a) {
-      assert_not_finalized();
       if (a != this->align) {
+        reopen();
         this->lines.back().align = a;
         this->align = a;
       }
@@ -482,10 +1046,10 @@ namespace btb
         y = this->height() + border_bottom;
         break;
       case ypoint_top_baseline:
-        y = this->lines.front().y ;
+        y = this->rows.front().y ;
         break;
       case ypoint_bottom_baseline:
-        y = this->lines.back().y ;
+        y = this->rows.back().y ;
         break;
       }
       return y ;
@@ -549,11 +1113,10 @@ namespace btb
   protected:
 
 
-    // Draw the glyphs of a block of text.
-    virtual void drawBlock(BLContext &ctx, BlockBase &block, double x, double y)
+    // Draw some glyphs of a block of text at the given position.
+    virtual void drawBlock(BLContext &ctx, BlockBase &block, const BLGlyphRun &run, double x, double y)
     {
-      BLPoint pos( x+block.x, y+block.y ) ;
-      ctx.fillGlyphRun( pos, this->block_font(block), block.glyphs.glyphRun() );
+      ctx.fillGlyphRun( BLPoint(x,y), this->block_font(block), run );
     }
 
   public:
@@ -597,9 +1160,11 @@ namespace btb
     draw(BLContext &ctx, double x, double y)
     {
       auto_finalize();
-      for ( Line &line : this->lines) {
-        for ( BlockBase *block_p : line.blocks) {        
-          this->drawBlock(ctx, *block_p, x+line.x, y+line.y);
+      for ( Row &row : this->rows) {
+        for ( Fragment &frag : row.fragments) {
+          BlockBase &block = *frag.block ;
+          this->drawBlock(ctx, block, block.glyphRun(frag.g0, frag.g1),
+                          x+row.x+frag.x, y+row.y+block.y);
         }
       }
     }
@@ -711,8 +1276,14 @@ namespace btb
 
     Attributes current ;    
 
+    // The arena for all blocks. A deque never moves its elements
+    // so the pointers in Line::blocks remain valid.
+    std::deque<Block> arena ;
+
     BLRgba32 box_fill{0} ;
 
+    bool use_atlas{false} ;
+
     BLFont   default_font; 
     
   protected:
@@ -728,11 +1299,19 @@ namespace btb
     }
 
     virtual BlockBase *new_block(void) override {
-      return new Block(current); 
+      arena.emplace_back(current) ;
+      return &arena.back(); 
     }
 
-    virtual void delete_block(BlockBase *block) override {
-      delete (Block*) block;
+    virtual void release_blocks() override {
+      arena.clear() ;
+    }
+
+    virtual bool assign_attributes(BlockBase &block_) override {
+      Block &block = static_cast<Block&>(block_) ;
+      bool layout = ( block.attribs.font != current.font ) ;
+      block.attribs = current ;
+      return layout ;
     }
     
   public: 
@@ -744,6 +1323,10 @@ namespace btb
     void setFont(const std::string &fontname) {
       this->current.font = getFont(fontname) ;
     }
+
+    void setFont(FontId id) {
+      this->current.font = getFont(id) ;
+    }
     
     void setStrokeNone()  {
       this->current.stroke.style = STROKE_STYLE_NONE;
@@ -785,6 +1368,15 @@ namespace btb
       this->box_fill = c ;
     } 
 
+    // Draw the glyphs using the global GlyphAtlas when possible (so for
+    // the blocks using a solid fill or stroke color).
+    //
+    // This is mostly interesting for text drawn repeatedly (subtitles,
+    // tickers, ...). 
+    void setGlyphAtlas(bool enable)  {
+      this->use_atlas = enable ;
+    } 
+
     void setBoxFillColor(uint32_t r, uint32_t g, uint32_t b, uint32_t a = 0xFFu)  {
       this->box_fill = BLRgba32(r,g,b,a) ;
     } 
@@ -793,28 +1385,40 @@ namespace btb
   protected:
 
     
-    virtual void drawBlock(BLContext &ctx, BlockBase &block_, double x, double y) override 
+    virtual void drawBlock(BLContext &ctx, BlockBase &block_, const BLGlyphRun &run, double x, double y) override 
     {
       Block &block = static_cast<Block&>(block_);
       
-      BLPoint pos( x+block.x , y+block.y ) ;
+      BLPoint pos( x , y ) ;
       Attributes &attribs  = block.attribs ;
       auto &font = attribs.font ;
       ctx.save();
       
+      GlyphAtlas &atlas = GlyphAtlas::global() ;
+      
       if ( attribs.fill.style == FILL_STYLE_COLOR )
         ctx.setFillStyle( attribs.fill.color );
-      if ( attribs.fill.style != FILL_STYLE_NONE )
-        ctx.fillGlyphRun( pos,
-                          font,
-                          block.glyphs.glyphRun() );
+      if ( attribs.fill.style != FILL_STYLE_NONE ) {
+        bool done = use_atlas
+          && attribs.fill.style == FILL_STYLE_COLOR
+          && atlas.fillGlyphRun(ctx, pos, font, run, attribs.fill.color) ;
+        if (!done)
+          ctx.fillGlyphRun( pos,
+                            font,
+                            run );
+      }
 
       if ( attribs.stroke.style == STROKE_STYLE_COLOR ) 
         ctx.setStrokeStyle( attribs.stroke.color ) ;
-      if ( attribs.stroke.style != STROKE_STYLE_NONE )
-        ctx.strokeGlyphRun( pos,
-                            font,
-                            block.glyphs.glyphRun() );
+      if ( attribs.stroke.style != STROKE_STYLE_NONE ) {
+        bool done = use_atlas
+          && attribs.stroke.style == STROKE_STYLE_COLOR
+          && atlas.strokeGlyphRun(ctx, pos, font, run, attribs.stroke.color, ctx.strokeWidth()) ;
+        if (!done)
+          ctx.strokeGlyphRun( pos,
+                              font,
+                              run );
+      }
               
       ctx.restore();
     }
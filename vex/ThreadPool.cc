@@ -0,0 +1,184 @@
+#include <vex/ThreadPool.h>
+
+// The index of the pool worker running in the current thread (or -1)
+// and the pool owning it.
+static thread_local int          tls_worker_index = -1 ;
+static thread_local ThreadPool * tls_worker_pool  = nullptr ;
+
+ThreadPool::ThreadPool(int nthreads)
+{
+  if (nthreads <= 0)
+    nthreads = std::max(1u, std::thread::hardware_concurrency()) ;
+
+  for (int i=0 ; i<nthreads ; i++)
+    m_queues.emplace_back(new Queue) ;
+
+  for (int i=0 ; i<nthreads ; i++)
+    m_threads.emplace_back(&ThreadPool::worker, this, i) ;
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_stop = true ;
+  }
+  m_cv.notify_all() ;
+  for (std::thread &t : m_threads)
+    t.join() ;
+}
+
+void
+ThreadPool::submit(Task task)
+{
+  int index ;
+  if (tls_worker_pool == this)
+    index = tls_worker_index ;
+  else
+    index = m_next++ % m_queues.size() ;
+
+  {
+    Queue &q = *m_queues[index] ;
+    std::lock_guard<std::mutex> lock(q.mutex) ;
+    q.tasks.push_back(std::move(task)) ;
+  }
+
+  {
+    // Reminder: m_queued must be modified with m_mutex locked to
+    // avoid a lost wakeup in worker().
+    std::lock_guard<std::mutex> lock(m_mutex) ;
+    m_queued++ ;
+  }
+  m_cv.notify_one() ;
+}
+
+// Pop a task from the back of our own queue or steal one from the
+// front of another queue. self is -1 for a thread outside the pool.
+bool
+ThreadPool::pop(int self, Task &task)
+{
+  if (m_queued == 0)
+    return false ;
+
+  int n = int(m_queues.size()) ;
+
+  if (self >= 0) {
+    Queue &q = *m_queues[self] ;
+    std::lock_guard<std::mutex> lock(q.mutex) ;
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.back()) ;
+      q.tasks.pop_back() ;
+      m_queued-- ;
+      return true ;
+    }
+  }
+
+  int start = (self >= 0) ? self+1 : 0 ;
+  for (int k=0 ; k<n ; k++) {
+    int i = (start+k) % n ;
+    if (i == self)
+      continue ;
+    Queue &q = *m_queues[i] ;
+    std::lock_guard<std::mutex> lock(q.mutex) ;
+    if (!q.tasks.empty()) {
+      task = std::move(q.tasks.front()) ;
+      q.tasks.pop_front() ;
+      m_queued-- ;
+      return true ;
+    }
+  }
+  return false ;
+}
+
+bool
+ThreadPool::run_pending()
+{
+  Task task ;
+  int self = (tls_worker_pool == this) ? tls_worker_index : -1 ;
+  if (!pop(self,task))
+    return false ;
+  task() ;
+  return true ;
+}
+
+void
+ThreadPool::worker(int index)
+{
+  tls_worker_index = index ;
+  tls_worker_pool  = this ;
+
+  while (true) {
+    Task task ;
+    if (pop(index,task)) {
+      task() ;
+      continue ;
+    }
+    // Reminder: the queued tasks are completed before stopping.
+    std::unique_lock<std::mutex> lock(m_mutex) ;
+    m_cv.wait(lock, [this]{ return m_stop || m_queued > 0 ; }) ;
+    if (m_stop && m_queued == 0)
+      return ;
+  }
+}
+
+// The shared state of a parallel_for(). The helper tasks may run after
+// its completion so it is reference counted.
+struct ThreadPool::Batch {
+  const std::function<void(int)> * fn ;
+  int                      n ;
+  std::atomic<int>         next{0} ;   // The next index to execute
+  int                      remaining ; // Protected by mutex
+  std::mutex               mutex ;
+  std::condition_variable  cv ;
+
+  // Execute the indices not yet taken.
+  void run() {
+    int done = 0 ;
+    for (int i = next++ ; i < n ; i = next++) {
+      (*fn)(i) ;
+      done++ ;
+    }
+    if (done == 0)
+      return ;
+    std::lock_guard<std::mutex> lock(mutex) ;
+    remaining -= done ;
+    if (remaining == 0)
+      cv.notify_all() ;
+  }
+} ;
+
+void
+ThreadPool::parallel_for(int n, const std::function<void(int)> &fn)
+{
+  if (n <= 0)
+    return ;
+  if (n == 1) {
+    fn(0) ;
+    return ;
+  }
+
+  auto batch = std::make_shared<Batch>() ;
+  batch->fn        = &fn ;
+  batch->n         = n ;
+  batch->remaining = n ;
+
+  // The helpers take the indices dynamically so they are never more
+  // than the workers.
+  int helpers = std::min(n-1, size()) ;
+  for (int i=0 ; i<helpers ; i++)
+    submit( [batch] { batch->run(); } ) ;
+
+  // Only help with our own indices (so never with an unrelated and
+  // possibly long task) and then wait for the indices taken by the
+  // helpers.
+  batch->run() ;
+  std::unique_lock<std::mutex> lock(batch->mutex) ;
+  batch->cv.wait(lock, [&] { return batch->remaining == 0 ; } ) ;
+}
+
+ThreadPool &
+ThreadPool::global()
+{
+  static ThreadPool pool ;
+  return pool ;
+}
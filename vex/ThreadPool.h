@@ -0,0 +1,89 @@
+#ifndef VEX_THREAD_POOL_H
+#define VEX_THREAD_POOL_H 1
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+//
+// A simple work-stealing thread pool.
+//
+// Each worker owns a queue of tasks. A worker takes the tasks from the
+// back of its own queue (the most recent ones, so hopefully still in
+// cache) and, when empty, steals the oldest tasks at the front of the
+// other queues.
+//
+// Tasks submitted from a worker are pushed to its own queue. Other tasks
+// are distributed over all queues in a round-robin way.
+//
+// Example:
+//
+//    ThreadPool &pool = ThreadPool::global() ;
+//    pool.parallel_for(ntiles, [&](int i) { render_tile(i); } ) ;
+//
+class ThreadPool {
+public:
+
+  typedef std::function<void()> Task ;
+
+private:
+
+  struct Queue {
+    std::mutex       mutex ;
+    std::deque<Task> tasks ;
+  } ;
+
+  std::vector<std::unique_ptr<Queue>> m_queues ;
+  std::vector<std::thread>            m_threads ;
+
+  std::mutex               m_mutex ;     // protect m_queued and m_stop for the sleeping workers
+  std::condition_variable  m_cv ;
+  std::atomic<int>         m_queued{0} ; // number of tasks in all queues
+  bool                     m_stop{false} ;
+  std::atomic<unsigned>    m_next{0} ;   // for the round-robin distribution
+
+public:
+
+  // Create a pool with nthreads workers (0 means one per hardware thread).
+  explicit ThreadPool(int nthreads=0) ;
+
+  // Complete all the queued tasks and stop the workers.
+  ~ThreadPool() ;
+
+  ThreadPool(const ThreadPool &) = delete ;
+  ThreadPool & operator=(const ThreadPool &) = delete ;
+
+  // The number of workers.
+  int size() const { return int(m_threads.size()) ; }
+
+  // Queue a task for asynchronous execution.
+  void submit(Task task) ;
+
+  // Execute fn(0) ... fn(n-1) in parallel and wait for completion.
+  //
+  // The calling thread also executes the indices not yet taken by the
+  // workers (but no other task) so it is safe to call parallel_for()
+  // from a task.
+  void parallel_for(int n, const std::function<void(int)> &fn) ;
+
+  // Execute one pending task (if any) in the calling thread.
+  // Return false if no task was found.
+  bool run_pending() ;
+
+  // A pool shared by the whole application (created at first use).
+  static ThreadPool & global() ;
+
+private:
+
+  struct Batch ;
+
+  bool pop(int self, Task &task) ;
+  void worker(int index) ;
+} ;
+
+#endif
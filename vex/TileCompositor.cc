@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <atomic>
+
+#include <vex/TileCompositor.h>
+#include <vex/Scene.h>
+#include <vex/PixelOps.h>
+
+static inline bool
+box_intersects(const BLBoxI &a, const BLBoxI &b)
+{
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1 ;
+}
+
+static inline BLBoxI
+box_intersection(const BLBoxI &a, const BLBoxI &b)
+{
+  return BLBoxI( std::max(a.x0,b.x0), std::max(a.y0,b.y0),
+                 std::min(a.x1,b.x1), std::min(a.y1,b.y1) ) ;
+}
+
+// Fill a box of PRGB32 pixels. This is faster than creating a
+// context for the tiles without any layer.
+static void
+fill_box(uint8_t *pixels, intptr_t stride, const BLBoxI &box, uint32_t value)
+{
+  for (int y=box.y0 ; y<box.y1 ; y++) {
+    uint32_t *row = (uint32_t*)(pixels + y*stride) ;
+    std::fill(row+box.x0, row+box.x1, value) ;
+  }
+}
+
+TileCompositor::TileCompositor(ThreadPool &pool, int tile_size) :
+  m_pool(pool),
+  m_tile_size(std::max(16,tile_size))
+{
+}
+
+void
+TileCompositor::render(BLImage &frame,
+                       const std::vector<BLBoxI> &regions,
+                       const std::vector<Layer> &layers,
+                       double sx, double sy,
+                       BLRgba32 clear)
+{
+  BLImageData data ;
+  frame.makeMutable(&data) ;
+  uint8_t *pixels = (uint8_t*) data.pixelData ;
+  intptr_t stride = data.stride ;
+  int w = data.size.w ;
+  int h = data.size.h ;
+
+  // Premultiply the clear color for fill_box()
+  uint32_t a = clear.a ;
+  uint32_t clear_value = (a << 24)
+    | (pixops::div255(clear.r*a) << 16)
+    | (pixops::div255(clear.g*a) << 8)
+    | (pixops::div255(clear.b*a)) ;
+
+  int ts = m_tile_size ;
+  int nx = (w+ts-1)/ts ;
+  int ny = (h+ts-1)/ts ;
+
+  // Only keep the tiles intersecting at least one region
+  std::vector<BLBoxI> tiles ;
+  for (int j=0 ; j<ny ; j++) {
+    for (int i=0 ; i<nx ; i++) {
+      BLBoxI tile(i*ts, j*ts, std::min((i+1)*ts,w), std::min((j+1)*ts,h)) ;
+      for (const BLBoxI &r : regions) {
+        if (box_intersects(tile,r)) {
+          tiles.push_back(tile) ;
+          break ;
+        }
+      }
+    }
+  }
+
+  std::atomic<int> empty{0} ;
+  std::atomic<int> draws{0} ;
+
+  m_pool.parallel_for( int(tiles.size()), [&](int k) {
+      const BLBoxI &tile = tiles[k] ;
+
+      // Cull the layers
+      std::vector<const Layer*> visible ;
+      for (const Layer &layer : layers) {
+        if (box_intersects(layer.bounds, tile))
+          visible.push_back(&layer) ;
+      }
+
+      if (visible.empty()) {
+        for (const BLBoxI &r : regions) {
+          if (box_intersects(tile,r))
+            fill_box(pixels, stride, box_intersection(tile,r), clear_value) ;
+        }
+        empty++ ;
+        return ;
+      }
+
+      // A view of the tile pixels.
+      BLImage view ;
+      view.createFromData(tile.x1-tile.x0, tile.y1-tile.y0, BL_FORMAT_PRGB32,
+                          pixels + tile.y0*stride + tile.x0*4, stride) ;
+      BLContext ctx(view) ;
+
+      for (const BLBoxI &r : regions) {
+        if (!box_intersects(tile,r))
+          continue ;
+        BLBoxI clip = box_intersection(tile,r) ;
+        ctx.save() ;
+        ctx.clipToRect( BLRectI(clip.x0-tile.x0, clip.y0-tile.y0,
+                                clip.x1-clip.x0, clip.y1-clip.y0) ) ;
+        ctx.setCompOp(BL_COMP_OP_SRC_COPY) ;
+        ctx.setFillStyle(clear) ;
+        ctx.fillAll() ;
+        ctx.setCompOp(BL_COMP_OP_SRC_OVER) ;
+        ctx.translate(-tile.x0, -tile.y0) ;
+        ctx.scale(sx,sy) ;
+        ctx.userToMeta() ;
+        for (const Layer *layer : visible) {
+          if (!box_intersects(layer->bounds, clip))
+            continue ;
+          ctx.save() ;
+          layer->node->draw(ctx) ;
+          ctx.restore() ;
+          draws++ ;
+        }
+        ctx.restore() ;
+      }
+      ctx.end() ;
+    } ) ;
+
+  m_stats.tiles = int(tiles.size()) ;
+  m_stats.empty = empty ;
+  m_stats.draws = draws ;
+}
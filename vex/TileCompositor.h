@@ -0,0 +1,71 @@
+#ifndef VEX_TILE_COMPOSITOR_H
+#define VEX_TILE_COMPOSITOR_H 1
+
+#include <vector>
+
+#include <blend2d.h>
+
+#include "ThreadPool.h"
+
+class SceneNode ;
+
+//
+// Rasterize a set of layers (SceneNode) by splitting the output frame
+// into square tiles rendered in parallel on a ThreadPool.
+//
+// Each tile is rendered with its own BLContext on a view of the frame
+// pixels (so without copy). Only the layers intersecting a tile are
+// drawn in that tile and tiles without any layer are simply cleared.
+//
+// The draw() member of the layers is called concurrently from multiple
+// threads so it must not modify the layer. That is usually the case
+// once bounds() was called (e.g. the text boxes are finalized).
+//
+// See also Scene::setCompositor()
+//
+class TileCompositor {
+public:
+
+  struct Layer {
+    SceneNode * node ;
+    BLBoxI      bounds ;   // in frame pixels
+  } ;
+
+  struct Stats {
+    int tiles{0} ;       // Number of tiles processed by the last render
+    int empty{0} ;       // Number of tiles without any layer
+    int draws{0} ;       // Number of node draws
+  } ;
+
+private:
+
+  ThreadPool & m_pool ;
+  int          m_tile_size ;
+  Stats        m_stats ;
+
+public:
+
+  TileCompositor(ThreadPool &pool = ThreadPool::global(), int tile_size=256) ;
+
+  int tileSize() const { return m_tile_size; }
+
+  //
+  // Render the layers (from back to front) into the regions of the
+  // frame (in BL_FORMAT_PRGB32).
+  //
+  //  - regions are boxes in frame pixels. Only the pixels inside
+  //    those regions are modified. They are first filled with
+  //    the clear color.
+  //  - the layers are drawn with a scaling (sx,sy) from their
+  //    coordinates to the frame pixels.
+  //
+  void render(BLImage &frame,
+              const std::vector<BLBoxI> &regions,
+              const std::vector<Layer> &layers,
+              double sx, double sy,
+              BLRgba32 clear) ;
+
+  const Stats & stats() const { return m_stats; }
+} ;
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef VEX_TIME_MAPPER_H
+#define VEX_TIME_MAPPER_H 1
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <iostream>
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+#include "Timestamp.h"
+
+//
+// Map the frames of an output stream to the pts of a source stream.
+//
+// The source time of the output frame f is
+//
+//    offset + f * speed / frame_rate
+//
+// and the source pts is that time expressed in the source time base
+// and rounded down (so the source frame displayed at that time).
+//
+// All computations are exact. The mapping is reduced once to
+//
+//    pts(f) = floor( (f*A + B) / C )
+//
+// and, since pts(f+C) = pts(f) + A, the C first values are precomputed
+// when C is small enough (this is the usual case, e.g. C=6 from 25 to
+// 30000/1001 fps). Otherwise, a Cursor steps from frame to frame with
+// integer accumulators (as in the Bresenham algorithm) so there is no
+// division per frame.
+//
+// Example:
+//
+//    // Play a 1/90000 source at half speed starting at 12s in a 25 fps output
+//    TimeMapper mapper( AVRational{25,1}, AVRational{1,90000},
+//                       AVRational{1,2}, 12_s ) ;
+//    int64_t pts = mapper.pts(f) ;
+//
+class TimeMapper {
+public:
+
+  // Above that size, the table is not used.
+  static constexpr int64_t MAX_TABLE = 4096 ;
+
+  // Step over the consecutive frames.
+  class Cursor {
+  private:
+    int64_t m_frame ;
+    int64_t m_pts ;
+    int64_t m_rem ;   // in [0,C)
+    int64_t m_dq ;
+    int64_t m_dr ;    // in [0,C)
+    int64_t m_c ;
+    friend class TimeMapper ;
+  public:
+    int64_t frame() const { return m_frame; }
+    int64_t pts()   const { return m_pts; }
+
+    void next() {
+      m_frame++ ;
+      m_pts += m_dq ;
+      m_rem += m_dr ;
+      if (m_rem >= m_c) {
+        m_rem -= m_c ;
+        m_pts++ ;
+      }
+    }
+  } ;
+
+private:
+
+  AVRational           m_frame_rate ;
+  AVRational           m_source_tb ;
+  int64_t              m_a{0} ;
+  int64_t              m_b{0} ;
+  int64_t              m_c{1} ;
+  std::vector<int64_t> m_table ;   // pts(k) for k in [0,C)
+
+public:
+
+  TimeMapper(AVRational frame_rate, AVRational source_tb,
+             AVRational speed = AVRational{1,1},
+             const Timestamp &offset = Timestamp()) :
+    m_frame_rate(frame_rate),
+    m_source_tb(source_tb)
+  {
+    if ( frame_rate.num<=0 || frame_rate.den<=0 ||
+         source_tb.num<=0  || source_tb.den<=0 || speed.den==0 ) {
+      std::cerr << "ERROR: Invalid time base in TimeMapper\n" ;
+      exit(1) ;
+    }
+    // A/C = speed/frame_rate in the source time base
+    __int128 a = __int128(frame_rate.den) * speed.num * source_tb.den ;
+    __int128 c = __int128(frame_rate.num) * speed.den * source_tb.num ;
+    if (c<0) {
+      a = -a ;
+      c = -c ;
+    }
+    __int128 g = gcd(a<0 ? -a : a, c) ;
+    a /= g ;
+    c /= g ;
+    // Reminder: B is computed in units of 1/(source_tb.den*C) seconds.
+    if ( a > INT64_MAX || a < -INT64_MAX || c > INT64_MAX ||
+         c * source_tb.den > INT64_MAX ) {
+      std::cerr << "ERROR: Time bases too large in TimeMapper\n" ;
+      exit(1) ;
+    }
+    m_a = int64_t(a) ;
+    m_c = int64_t(c) ;
+    // Rounding down the offset in units of 1/C source ticks does not change
+    // the final floor since f*A is an integer.
+    m_b = offset.rescale(source_tb.num, int64_t(source_tb.den)*m_c, Timestamp::round_down) ;
+
+    if (m_c <= MAX_TABLE) {
+      m_table.resize(m_c) ;
+      Cursor cur = cursor(0) ;
+      for (int64_t k=0 ; k<m_c ; k++, cur.next())
+        m_table[k] = cur.pts() ;
+    }
+  }
+
+  AVRational frameRate() const { return m_frame_rate; }
+  AVRational sourceTimeBase() const { return m_source_tb; }
+
+  // The source pts of the output frame f.
+  int64_t pts(int64_t f) const {
+    if (!m_table.empty()) {
+      int64_t q = floordiv(f, m_c) ;
+      return m_table[f - q*m_c] + q*m_a ;
+    }
+    return int64_t( floordiv128( __int128(f)*m_a + m_b, m_c ) ) ;
+  }
+
+  // The source time of the output frame f (rounded down to the source pts).
+  Timestamp sourceTime(int64_t f) const {
+    return Timestamp::make_local(pts(f), m_source_tb.num, m_source_tb.den) ;
+  }
+
+  // The time of the output frame f.
+  Timestamp frameTime(int64_t f) const {
+    return Timestamp::make_main(f, m_frame_rate.den, m_frame_rate.num) ;
+  }
+
+  // A cursor positioned at the output frame f.
+  Cursor cursor(int64_t f) const {
+    Cursor cur ;
+    __int128 n = __int128(f)*m_a + m_b ;
+    __int128 q = floordiv128(n, m_c) ;
+    cur.m_frame = f ;
+    cur.m_pts   = int64_t(q) ;
+    cur.m_rem   = int64_t(n - q*m_c) ;
+    cur.m_dq    = floordiv(m_a, m_c) ;
+    cur.m_dr    = m_a - cur.m_dq*m_c ;
+    cur.m_c     = m_c ;
+    return cur ;
+  }
+
+  // Store the source pts of the output frames f0 to f0+count-1 in out.
+  //
+  // With the table, that is a sequence of simple additions that the
+  // compiler can vectorize.
+  void map(int64_t f0, size_t count, int64_t *out) const {
+    if (m_table.empty()) {
+      Cursor cur = cursor(f0) ;
+      for (size_t i=0 ; i<count ; i++, cur.next())
+        out[i] = cur.pts() ;
+      return ;
+    }
+    int64_t q    = floordiv(f0, m_c) ;
+    int64_t k    = f0 - q*m_c ;
+    int64_t base = q*m_a ;
+    const int64_t *table = m_table.data() ;
+    size_t i = 0 ;
+    while (i<count) {
+      size_t n = std::min(count-i, size_t(m_c-k)) ;
+      for (size_t j=0 ; j<n ; j++)
+        out[i+j] = table[k+j] + base ;
+      i += n ;
+      k = 0 ;
+      base += m_a ;
+    }
+  }
+
+private:
+
+  static __int128 gcd(__int128 a, __int128 b) {
+    while (b!=0) {
+      __int128 t = a % b ;
+      a = b ;
+      b = t ;
+    }
+    return a ;
+  }
+
+  // Division rounded toward -infinity (with d>0)
+  static int64_t floordiv(int64_t n, int64_t d) {
+    int64_t q = n / d ;
+    return (n % d < 0) ? q-1 : q ;
+  }
+
+  static __int128 floordiv128(__int128 n, __int128 d) {
+    __int128 q = n / d ;
+    return (n % d < 0) ? q-1 : q ;
+  }
+
+} ;
+
+#endif
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <iostream>
+
+#include <vex/Timeline.h>
+
+size_t
+Timeline::addTrack(const std::string &name)
+{
+  m_tracks.push_back(name) ;
+  return m_tracks.size()-1 ;
+}
+
+size_t
+Timeline::add(const TimelineClip &clip)
+{
+  if (clip.track >= m_tracks.size()) {
+    std::cerr << "ERROR: Invalid track " << clip.track << " in Timeline::add()\n" ;
+    exit(1) ;
+  }
+  if (!(clip.in < clip.out)) {
+    std::cerr << "ERROR: Empty clip [" << clip.in << "," << clip.out << ") in Timeline::add()\n" ;
+    exit(1) ;
+  }
+  size_t id = m_clips.size() ;
+  m_clips.push_back(clip) ;
+  m_index.add(clip.in, clip.out, id) ;
+  m_starts.push_back( Start{clip.in, id} ) ;
+  if (id==0 || m_duration < clip.out)
+    m_duration = clip.out ;
+  return id ;
+}
+
+void
+Timeline::build()
+{
+  std::lock_guard<std::mutex> lock(m_build_mutex) ;
+  if (m_index.built())
+    return ;
+  m_index.build() ;
+  std::stable_sort(m_starts.begin(), m_starts.end(),
+                   [](const Start &a, const Start &b) { return a.in < b.in; } ) ;
+}
+
+// The interval tree provides the clips ordered by start. Only the
+// results appended after first are reordered.
+void
+Timeline::sort_by_track(std::vector<size_t> &ids, size_t first) const
+{
+  std::stable_sort(ids.begin()+first, ids.end(),
+                   [this](size_t a, size_t b) { return m_clips[a].track < m_clips[b].track; } ) ;
+}
+
+void
+Timeline::active(const Timestamp &t, std::vector<size_t> &out)
+{
+  build() ;
+  size_t first = out.size() ;
+  m_index.query(t, out) ;
+  sort_by_track(out, first) ;
+}
+
+void
+Timeline::overlapping(const Timestamp &a, const Timestamp &b, std::vector<size_t> &out)
+{
+  build() ;
+  size_t first = out.size() ;
+  m_index.query(a, b, out) ;
+  sort_by_track(out, first) ;
+}
+
+void
+Timeline::starting(const Timestamp &t, const Timestamp &delta, std::vector<size_t> &out)
+{
+  build() ;
+  Timestamp end = t + delta ;
+  auto it = std::lower_bound(m_starts.begin(), m_starts.end(), t,
+                             [](const Start &s, const Timestamp &v) { return s.in < v; } ) ;
+  for ( ; it != m_starts.end() && it->in < end ; ++it)
+    out.push_back(it->id) ;
+}
+
+
+void
+TimelineNode::prepare(const Timestamp &ts)
+{
+  std::vector<size_t> active ;
+  m_timeline->active(ts, active) ;
+  // Ignore the clips without node
+  active.erase( std::remove_if(active.begin(), active.end(),
+                               [this](size_t id) { return !m_timeline->clip(id).node; } ),
+                active.end() ) ;
+  if (active != m_active) {
+    m_active.swap(active) ;
+    m_changed = true ;
+  }
+  for (size_t id : m_active) {
+    const TimelineClip &clip = m_timeline->clip(id) ;
+    clip.node->prepare( clip.sourceTime(ts) ) ;
+  }
+}
+
+BLBox
+TimelineNode::bounds()
+{
+  BLBox box ;
+  bool first = true ;
+  for (size_t id : m_active) {
+    BLBox b = m_timeline->clip(id).node->bounds() ;
+    if ( b.x1 <= b.x0 || b.y1 <= b.y0 )
+      continue ;
+    if (first) {
+      box = b ;
+      first = false ;
+    } else {
+      box.x0 = std::min(box.x0, b.x0) ;
+      box.y0 = std::min(box.y0, b.y0) ;
+      box.x1 = std::max(box.x1, b.x1) ;
+      box.y1 = std::max(box.y1, b.y1) ;
+    }
+  }
+  return box ;
+}
+
+bool
+TimelineNode::changed()
+{
+  bool c = m_changed ;
+  m_changed = false ;
+  // Reminder: changed() must be called for all nodes
+  for (size_t id : m_active) {
+    if (m_timeline->clip(id).node->changed())
+      c = true ;
+  }
+  return c ;
+}
+
+void
+TimelineNode::draw(BLContext &ctx)
+{
+  for (size_t id : m_active) {
+    ctx.save() ;
+    m_timeline->clip(id).node->draw(ctx) ;
+    ctx.restore() ;
+  }
+}
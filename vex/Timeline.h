@@ -0,0 +1,137 @@
+#ifndef VEX_TIMELINE_H
+#define VEX_TIMELINE_H 1
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include <blend2d.h>
+
+#include "Timestamp.h"
+#include "IntervalTree.h"
+#include "Scene.h"
+
+//
+// A clip placed on a track of a Timeline.
+//
+// The clip is active in the half-open interval [in,out) of the timeline
+// and, during that interval, the timeline time t corresponds to the
+// time source_in + (t-in) in its source.
+//
+struct TimelineClip {
+  size_t      track{0} ;
+  Timestamp   in ;          // start in the timeline
+  Timestamp   out ;         // end in the timeline (excluded)
+  Timestamp   source_in ;   // the source time at 'in'
+  std::string source ;      // an optional media file
+  std::shared_ptr<SceneNode> node ;  // an optional node drawn while the clip is active
+
+  Timestamp sourceTime(const Timestamp &t) const {
+    return source_in + (t - in) ;
+  }
+} ;
+
+//
+// A Timeline is a list of tracks containing clips.
+//
+// The clips are indexed by an interval tree so finding the clips
+// active at a given time is in O(log n + k) where k is the number of
+// results. Similarly, the clips starting in a time window (e.g. those
+// that shall be prefetched) are found by a binary search.
+//
+// The index is rebuilt on demand by the first query after adding
+// clips. The queries can be called concurrently (e.g. by the threads
+// of a PlaybackEngine) but not while clips are added.
+//
+// Example:
+//
+//    Timeline timeline ;
+//    size_t video  = timeline.addTrack("video") ;
+//    size_t titles = timeline.addTrack("titles") ;
+//    TimelineClip clip ;
+//    clip.track = titles ;
+//    clip.in    = 2_s ;
+//    clip.out   = 5_s ;
+//    timeline.add(clip) ;
+//    ...
+//    std::vector<size_t> active ;
+//    timeline.active(ts, active) ;
+//
+class Timeline {
+private:
+
+  struct Start {
+    Timestamp in ;
+    size_t    id ;
+  } ;
+
+  std::vector<std::string>         m_tracks ;
+  std::vector<TimelineClip>        m_clips ;
+  IntervalTree<Timestamp,size_t>   m_index ;
+  std::vector<Start>               m_starts ;   // sorted by in
+  Timestamp                        m_duration ;
+  std::mutex                       m_build_mutex ;
+
+public:
+
+  // Add a track and return its index.
+  // The tracks are drawn in order (so the first one at the back).
+  size_t addTrack(const std::string &name) ;
+
+  size_t trackCount() const { return m_tracks.size(); }
+
+  const std::string & trackName(size_t track) const { return m_tracks[track]; }
+
+  // Add a clip and return its id.
+  // A fatal error occurs if the track is invalid or if out<=in.
+  size_t add(const TimelineClip &clip) ;
+
+  size_t size() const { return m_clips.size(); }
+
+  const TimelineClip & clip(size_t id) const { return m_clips[id]; }
+
+  // The end of the last clip.
+  Timestamp duration() const { return m_duration; }
+
+  // Get the ids of the clips active at t ordered by track and then by start.
+  void active(const Timestamp &t, std::vector<size_t> &out) ;
+
+  // Get the ids of the clips overlapping [a,b) ordered by track and then by start.
+  void overlapping(const Timestamp &a, const Timestamp &b, std::vector<size_t> &out) ;
+
+  // Get the ids of the clips that become active in [t,t+delta) ordered by
+  // start (so the candidates for a prefetch).
+  void starting(const Timestamp &t, const Timestamp &delta, std::vector<size_t> &out) ;
+
+private:
+
+  void build() ;
+  void sort_by_track(std::vector<size_t> &ids, size_t first) const ;
+} ;
+
+
+//
+// A SceneNode drawing the nodes of the clips active in a Timeline.
+//
+// The nodes are prepared with the source time of their clip and drawn
+// in the track order.
+//
+class TimelineNode : public SceneNode {
+private:
+  std::shared_ptr<Timeline> m_timeline ;
+  std::vector<size_t>       m_active ;
+  bool                      m_changed{true} ;
+public:
+
+  TimelineNode(std::shared_ptr<Timeline> timeline) : m_timeline(timeline) { }
+
+  Timeline & timeline() { return *m_timeline; }
+
+  virtual void prepare(const Timestamp &ts) override ;
+  virtual BLBox bounds() override ;
+  virtual bool changed() override ;
+  virtual void draw(BLContext &ctx) override ;
+} ;
+
+#endif
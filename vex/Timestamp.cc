@@ -44,7 +44,7 @@ std::ostream & operator<<( std::ostream &os, const Timestamp &v) {
 }
 
 std::string
-Timestamp::human()
+Timestamp::human() const
 {
   char buffer[100] ;
   
@@ -105,7 +105,7 @@ Timestamp::human()
 }
 
 std::string
-Timestamp::str(bool full)
+Timestamp::str(bool full) const
 {
   char buffer[100] ;
   
@@ -253,9 +253,11 @@ Timestamp::parse(const char *str, Timestamp &out)
 }
 
 Timestamp
-Timestamp::add(const Timestamp &b) const
+Timestamp::add(const Timestamp &b0) const
 {
   const Timestamp &a = *this ;
+  Timestamp b = b0 ;
+  match_num_den(a,b) ;
   Timestamp out ;
   out.init_num_den(a,b);  
   out.main.count  = a.main.count  + b.main.count;
@@ -266,9 +268,11 @@ Timestamp::add(const Timestamp &b) const
 
 
 Timestamp
-Timestamp::sub(const Timestamp &b) const
+Timestamp::sub(const Timestamp &b0) const
 {
   const Timestamp &a = *this ;
+  Timestamp b = b0 ;
+  match_num_den(a,b) ;
   Timestamp out ;
   out.init_num_den(a,b);  
   out.main.count  = a.main.count  - b.main.count;
@@ -290,69 +294,195 @@ Timestamp::neg() const
   return out;
 }
 
+//
+// The exact arithmetic.
+//
+// A timestamp is represented by the fraction N/D where D is the
+// least common multiple of main.den, local.den and 1000. 128 bit
+// integers are used so there is no overflow for any realistic
+// timestamp (e.g. a count of 2^40 in a time base of 1001/120000).
+//
+
+typedef __int128 int128 ;
+
+static int128
+gcd128(int128 a, int128 b)
+{
+  if (a<0) a = -a ;
+  if (b<0) b = -b ;
+  while (b!=0) {
+    int128 t = a % b ;
+    a = b ;
+    b = t ;
+  }
+  return a ;
+}
+
+static inline int128
+lcm128(int128 a, int128 b)
+{
+  return (a / gcd128(a,b)) * b ;
+}
+
+// Round the fraction n/d (with d>0) to an integer.
+static int128
+round_div(int128 n, int128 d, Timestamp::Rounding rnd)
+{
+  int128 q = n / d ;   // so rounded toward zero
+  int128 r = n % d ;
+  if (r==0)
+    return q ;
+  switch (rnd) {
+  case Timestamp::round_down:
+    return (n<0) ? q-1 : q ;
+  case Timestamp::round_up:
+    return (n<0) ? q : q+1 ;
+  case Timestamp::round_near:
+    if (r<0) r = -r ;
+    if (2*r >= d)
+      return (n<0) ? q-1 : q+1 ;
+    return q ;
+  case Timestamp::round_zero:
+  default:
+    return q ;
+  }
+}
+
+// Compute the exact value of the selected components of ts as n/d with d>0.
+static void
+exact(const Timestamp &ts, bool with_main, bool with_local, bool with_milli,
+      int128 &n, int128 &d)
+{
+  bool use_main  = with_main && ts.has_main() && ts.main.count!=0 ;
+  bool use_local = with_local && ts.has_local() && ts.local.count!=0 ;
+  d = with_milli ? 1000 : 1 ;
+  if (use_main)
+    d = lcm128(d, ts.main.den) ;
+  if (use_local)
+    d = lcm128(d, ts.local.den) ;
+  n = 0 ;
+  if (use_main)
+    n += int128(ts.main.count) * ts.main.num * (d / ts.main.den) ;
+  if (use_local)
+    n += int128(ts.local.count) * ts.local.num * (d / ts.local.den) ;
+  if (with_milli)
+    n += int128(ts.milli.count) * (d / 1000) ;
+  // A negative den is allowed in the time bases
+  if (d<0) {
+    n = -n ;
+    d = -d ;
+  }
+}
+
+static inline int64_t
+clamp64(int128 v)
+{
+  if (v > INT64_MAX) return INT64_MAX ;
+  if (v < INT64_MIN) return INT64_MIN ;
+  return int64_t(v) ;
+}
+
+int64_t
+Timestamp::rescale(int64_t num, int64_t den, Rounding rnd) const
+{
+  if (num==0 || den==0) {
+    std::cerr << "Timestamp::rescale() with an invalid time base " << num << "/" << den << "\n" ;
+    exit(1);
+  }
+  int128 n, d ;
+  exact(*this, true, true, true, n, d) ;
+  // (n/d) / (num/den) = (n*den) / (d*num)
+  int128 nn = n * den ;
+  int128 dd = d * num ;
+  if (dd<0) {
+    nn = -nn ;
+    dd = -dd ;
+  }
+  return clamp64( round_div(nn, dd, rnd) ) ;
+}
+
+int64_t
+Timestamp::to_ms(bool with_main, bool with_local, Rounding rnd) const
+{
+  int128 n, d ;
+  exact(*this, with_main, with_local, false, n, d) ;
+  return clamp64( this->milli.count + round_div(n*1000, d, rnd) ) ;
+}
+
+double
+Timestamp::eval() const
+{
+  int128 n, d ;
+  exact(*this, true, true, true, n, d) ;
+  // Reminder: d is usually small enough to be exact in a double
+  int128 q = n / d ;
+  int128 r = n % d ;
+  return double(q) + double(r)/double(d) ;
+}
+
+int
+Timestamp::compare(const Timestamp &a, const Timestamp &b)
+{
+  int128 na, da, nb, db ;
+  exact(a, true, true, true, na, da) ;
+  exact(b, true, true, true, nb, db) ;
+  // Both denominators are strictly positive.
+  int128 x = na * db ;
+  int128 y = nb * da ;
+  return (x<y) ? -1 : (x>y) ? +1 : 0 ;
+}
+
 int
 Timestamp::sign() const
 {
-  int64_t main_count = 0 ; 
-  int     main_num   = 1 ;
-  int     main_den   = 1 ;
-  if ( has_main() ) {
-    main_count = main.count ; 
-    main_num   = main.num ; 
-    main_den   = main.den ; 
+  int128 n, d ;
+  exact(*this, true, true, true, n, d) ;
+  return (n<0) ? -1 : (n>0) ? +1 : 0 ;
+}
+
+// Express a count in the time base num/den into the time base
+// tnum/tden. Return false if that cannot be done exactly.
+static bool
+convert_exact(int64_t &count, int num, int den, int tnum, int tden)
+{
+  int128 n = int128(count) * num * tden ;
+  int128 d = int128(den) * tnum ;
+  if (d==0 || n % d != 0)
+    return false ;
+  int128 v = n / d ;
+  if (v > INT64_MAX || v < INT64_MIN)
+    return false ;
+  count = int64_t(v) ;
+  return true ;
+}
+
+bool
+Timestamp::match_num_den(const Timestamp &a, Timestamp &b)
+{
+  bool ok = true ;
+  if ( a.has_main() && b.has_main() &&
+       (a.main.num != b.main.num || a.main.den != b.main.den) ) {
+    int64_t count = b.main.count ;
+    if ( convert_exact(count, b.main.num, b.main.den, a.main.num, a.main.den) ) {
+      b.main.count = count ;
+      b.main.num   = a.main.num ;
+      b.main.den   = a.main.den ;
+    } else {
+      ok = false ;
+    }
   }
-  
-  int64_t local_count = 0 ; 
-  int     local_num   = 1 ;
-  int     local_den   = 1 ;
-  if ( has_local() ) {
-    local_count = local.count ; 
-    local_num   = local.num ; 
-    local_den   = local.den ; 
+  if ( a.has_local() && b.has_local() &&
+       (a.local.num != b.local.num || a.local.den != b.local.den) ) {
+    int64_t count = b.local.count ;
+    if ( convert_exact(count, b.local.num, b.local.den, a.local.num, a.local.den) ) {
+      b.local.count = count ;
+      b.local.num   = a.local.num ;
+      b.local.den   = a.local.den ;
+    } else {
+      ok = false ;
+    }
   }
-  
-  int64_t ms_count = milli.count ;
-  int     ms_num   = 1 ;
-  int     ms_den   = 1000 ;
-  
-  // So we want the sign of
-  //   main_count*main_num/main_den + local_count*local_num/local_den + ms_count*ms_num/ms_den
-  // knowing that all 'den' are strictly positive and also assuming no overflow
-  // when working with int64_t
-  
-  // --> sign_of(main_count*main_num/main_den + local_count*local_num/local_den + ms_count*ms_num/ms_den)
-  
-  // Normalize all denominators to main_den*local_den*ms_den
-  
-  // --> sign_of( ( main_count  * main_num  * local_den             * ms_den
-  //              + local_count * local_num             * main_den  * ms_den
-  //              + ms_count    * ms_num    * local_den * main_den           ) 
-  //              / (main_den*local_den*ms_den)
-  //            )
-  // The denominator does not affect the sign because all den are strictly
-  // positive so we only care about the numerator
-  //
-  // --> sign_of( main_count  * main_num  * local_den             * ms_den
-  //            + local_count * local_num             * main_den  * ms_den
-  //            + ms_count    * ms_num    * local_den * main_den
-  //            )
-  //
-  //
-  
-  int64_t val =
-      ((main_count * main_num) * local_den ) * ms_den
-    + ( (local_count * local_num) * ms_den +
-        (ms_count    * ms_num   ) * local_den
-        ) * main_den
-    ;
-  
-  if (val<0)
-    return -1 ;
-  else if ( val>0)
-    return +1 ;
-  else
-    return 0;
-  
+  return ok ;
 }
 
 #ifdef TEST
@@ -41,9 +41,11 @@ extern "C" {
 //
 // main_tb and local_tb can be undefined (0/1) if their respective 'ts' factor is zero.
 //
-// Two timestamps can be compared, added or substracted as long as their tb are compatible.
-// If this is not the case then an exception is triggered. Functions are also provided to round the
-// local time component into the milli_ts component.
+// Two timestamps can always be compared (exactly) but they can only be added or
+// substracted if their tb are compatible or if one can be converted exactly into the
+// other. If this is not the case then a fatal error occurs. Functions are also provided
+// to round the local time component into the milli_ts component or to rescale the
+// whole timestamp into any time base.
 //
 // 
 //
@@ -145,6 +147,11 @@ public:
     return !(local.num==0 && local.den==0) ;
   }
 
+  // Try to express the main and local components of b in the time bases
+  // of a. This is only possible when the conversion is exact (e.g. 1/25
+  // to 1/50 or 2*1/30 to 1*1/15). Return false if that is not the case.
+  static bool match_num_den(const Timestamp &a, Timestamp &b) ;
+
   // Initialize main.num, main.den, local.num and local.den from the
   // specified timestamp.
   inline void init_num_den(const Timestamp &a)
@@ -157,6 +164,8 @@ public:
   
   // Initialize main.num, main.den, local.num and local.den from two compatible
   // time stamps. A fatal error will occur if they are not compatible.
+  //
+  // See also match_num_den() to make them compatible.
   inline void init_num_den(const Timestamp &a, const Timestamp &b)
   {
     // Initialize main_num_den
@@ -196,129 +205,82 @@ public:
   }
 
  
-  inline Timestamp round_to_ms() {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
-    return Timestamp( 0,0,0,
-                      0,0,0,
-                      this->milli.count + int64_t(round(v*1000.0))
-                      );
+  // The rounding modes of rescale() and of the *_to_ms() functions.
+  enum Rounding {
+    round_down,   // toward -infinity
+    round_up,     // toward +infinity
+    round_near,   // to nearest with halfway cases away from zero
+    round_zero    // toward zero
+  } ;
+
+  // Express the timestamp as a number of num/den units (so a count in the
+  // time base num/den) in the spirit of av_rescale_q_rnd().
+  //
+  // The computation is exact (using 128 bit integers) except for the final
+  // rounding.
+  int64_t rescale(int64_t num, int64_t den, Rounding rnd=round_near) const ;
+
+  // Compare two timestamps. Return -1, 0 or +1.
+  //
+  // This is a total ordering that is also exact when the time bases of a
+  // and b are different.
+  static int compare(const Timestamp &a, const Timestamp &b) ;
+
+  // The exact value of the main and/or local components rounded to
+  // milliseconds and added to milli.count.
+  int64_t to_ms(bool with_main, bool with_local, Rounding rnd) const ;
+
+  inline Timestamp round_to_ms() const {
+    return make_ms( to_ms(true, true, round_near) ) ;
   }
   
-  inline Timestamp round_main_to_ms() {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
+  inline Timestamp round_main_to_ms() const {
     return Timestamp( 0,0,0,
                       this->local.count, this->local.num, this->local.den,
-                      this->milli.count + int64_t(round(v*1000.0))
-                      );
+                      to_ms(true, false, round_near) ) ;
   }
   
-  inline Timestamp round_local_to_ms() {
-    double v = 0 ;
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
+  inline Timestamp round_local_to_ms() const {
     return Timestamp( this->main.count, this->main.num, this->main.den,
                       0,0,0,
-                      this->milli.count + int64_t(round(v*1000.0))
-                      );
+                      to_ms(false, true, round_near) ) ;
   }
 
-  inline Timestamp ceil_to_ms() {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
-    return Timestamp( 0,0,0,
-                      0,0,0,
-                      this->milli.count + int64_t(ceil(v*1000.0))
-                      );
+  inline Timestamp ceil_to_ms() const {
+    return make_ms( to_ms(true, true, round_up) ) ;
   }
   
-  inline Timestamp ceil_main_to_ms() {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
+  inline Timestamp ceil_main_to_ms() const {
     return Timestamp( 0,0,0,
                       this->local.count, this->local.num, this->local.den,
-                      this->milli.count + int64_t(ceil(v*1000.0))
-                      );
+                      to_ms(true, false, round_up) ) ;
   }
   
-  inline Timestamp ceil_local_to_ms() {
-    double v = 0 ;
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
+  inline Timestamp ceil_local_to_ms() const {
     return Timestamp( this->main.count, this->main.num, this->main.den,
                       0,0,0,
-                      this->milli.count + int64_t(ceil(v*1000.0))
-                      );
+                      to_ms(false, true, round_up) ) ;
   }
 
-  inline Timestamp floor_to_ms() {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
-    return Timestamp( 0,0,0,
-                      0,0,0,
-                      this->milli.count + int64_t(floor(v*1000.0))
-                      );
+  inline Timestamp floor_to_ms() const {
+    return make_ms( to_ms(true, true, round_down) ) ;
   }
   
-  inline Timestamp floor_main_to_ms() {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
+  inline Timestamp floor_main_to_ms() const {
     return Timestamp( 0,0,0,
                       this->local.count, this->local.num, this->local.den,
-                      this->milli.count + int64_t(floor(v*1000.0))
-                      );
+                      to_ms(true, false, round_down) ) ;
   }
   
-  inline Timestamp floor_local_to_ms() {
-    double v = 0 ;
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
+  inline Timestamp floor_local_to_ms() const {
     return Timestamp( this->main.count, this->main.num, this->main.den,
                       0,0,0,
-                      this->milli.count + int64_t(floor(v*1000.0))
-                      );
+                      to_ms(false, true, round_down) ) ;
   }
-  
 
   // Evaluate the timestamp as a 'double'.
-  // Rounding may occur.
-  inline double eval()
-  {
-    double v = 0 ;
-    if ( has_main() ) {
-      v += (double(this->main.count)*double(this->main.num))/double(this->main.den) ;
-    }
-    if ( has_local() ) {
-      v += (double(this->local.count)*double(this->local.num))/double(this->local.den) ;
-    }
-    v += this->milli.count/1000.0 ;
-    return v; 
-  }
+  // The only rounding is the final conversion to double.
+  double eval() const ;
 
   // Convert to a human readable string.
   //
@@ -333,7 +295,7 @@ public:
   //   +00:03:00.000     # 3 minues  
   //   +01:30:00.000     # 1 hour and 30 minutes  
   //
-  std::string str(bool full=false) ;  
+  std::string str(bool full=false) const ;  
 
   
   // Similar to Timestamp::str() but produces a more readable 
@@ -351,7 +313,7 @@ public:
   //
   // TODO: write a Timestamp::human_parse() function?
   //
-  std::string human() ;  
+  std::string human() const ;  
 
 public: // Arithmetic operations on timestamps 
 
@@ -387,27 +349,27 @@ inline Timestamp operator-( const Timestamp &a ) {
 }
 
 inline bool operator==( const Timestamp &a, const Timestamp &b ) {
-  return (a-b).sign() == 0 ;
+  return Timestamp::compare(a,b) == 0 ;
 }
 
 inline bool operator!=( const Timestamp &a, const Timestamp &b ) {
-  return (a-b).sign() != 0 ;
+  return Timestamp::compare(a,b) != 0 ;
 }
 
 inline bool operator<( const Timestamp &a, const Timestamp &b ) {
-  return (a-b).sign() < 0 ;
+  return Timestamp::compare(a,b) < 0 ;
 }
 
 inline bool operator<=( const Timestamp &a, const Timestamp &b ) {
-  return (a-b).sign() <= 0 ;
+  return Timestamp::compare(a,b) <= 0 ;
 }
 
 inline bool operator>( const Timestamp &a, const Timestamp &b ) {
-  return (a-b).sign() > 0 ;
+  return Timestamp::compare(a,b) > 0 ;
 }
 
 inline bool operator>=( const Timestamp &a, const Timestamp &b ) {
-  return (a-b).sign() >= 0 ;
+  return Timestamp::compare(a,b) >= 0 ;
 }
 
 inline Timestamp max(const Timestamp &a, const Timestamp &b) {
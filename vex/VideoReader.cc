@@ -1,4 +1,6 @@
 
+#include <cmath>
+
 #include "VideoReader.h"
 
 #include <libavutil/timestamp.h>
@@ -55,10 +57,50 @@ VideoReaderBase::VideoReaderBase(std::string filename) :
 
 VideoReaderBase::~VideoReaderBase()
 {
-  // TODO: Free everything
+  close() ;
+}
+
+void
+VideoReaderBase::close()
+{
+  stopBackward() ;
+  if (m_sws_to_argb) {
+    sws_freeContext(m_sws_to_argb) ;
+    m_sws_to_argb = NULL ;
+  }
+  if (m_decoded_frame) {
+    av_frame_free(&m_decoded_frame) ;
+  }
+  if (m_rgb_frame) {
+    av_frame_free(&m_rgb_frame) ;
+  }
+  if (m_video_codec_context) {
+    avcodec_free_context(&m_video_codec_context) ;
+  }
+  if (m_audio_codec_context) {
+    avcodec_free_context(&m_audio_codec_context) ;
+  }
+  if (m_format_ctxt) {
+    // Reminder: also free the context 
+    avformat_close_input(&m_format_ctxt) ;
+  }
   if (m_packet) {
     av_packet_free(&m_packet);
   }
+  
+  m_video_stream       = NULL ;
+  m_video_stream_index = -1 ;
+  m_video_codec        = NULL ;
+  m_video_codec_params = NULL ;
+  m_width              = 0 ;
+  m_height             = 0 ;
+  
+  m_audio_stream       = NULL ;
+  m_audio_stream_index = -1 ;
+  m_audio_codec        = NULL ;
+  m_audio_codec_params = NULL ;
+
+  m_run_state = PSTATE_READ_PACKET ;
 }
 
 
@@ -80,6 +122,15 @@ VideoReaderBase::frameFormat()
   return m_video_codec_context->pix_fmt ;
 }
 
+AVRational
+VideoReaderBase::frameRate()
+{
+  AVRational rate = m_video_stream->avg_frame_rate ;
+  if (rate.num <= 0 || rate.den <= 0)
+    rate = m_video_stream->r_frame_rate ;
+  return rate ;
+}
+
 void
 VideoReaderBase::seek_before(double timestamp)
 {
@@ -119,6 +170,111 @@ VideoReaderBase::seek_before(double timestamp)
 
 }
 
+// Seek to the keyframe at or before pts in the video stream.
+bool
+VideoReaderBase::seek_video_pts(int64_t pts)
+{
+  int err = av_seek_frame(m_format_ctxt, m_video_stream_index, pts, AVSEEK_FLAG_BACKWARD) ;
+  if ( err < 0 )
+    return false ;
+  avcodec_flush_buffers(m_video_codec_context);
+  m_run_state = PSTATE_READ_PACKET ;
+  return true ;
+}
+
+void
+VideoReaderBase::setKeyframesOnly(bool enable)
+{
+  m_keyframes_only = enable ;
+  if (m_video_codec_context) {
+    m_video_codec_context->skip_frame = enable ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT ;
+  }
+}
+
+void
+VideoReaderBase::stopBackward()
+{
+  for (AVFrame *frame : m_backward_frames)
+    av_frame_free(&frame) ;
+  m_backward_frames.clear() ;
+  if (m_backward_frame)
+    av_frame_free(&m_backward_frame) ;
+  m_backward_end = AV_NOPTS_VALUE ;
+}
+
+void
+VideoReaderBase::startBackward(double t)
+{
+  stopBackward() ;
+  AVRational tb = videoTimeBase() ;
+  int64_t start = (m_video_stream->start_time != AV_NOPTS_VALUE) ? m_video_stream->start_time : 0 ;
+  // +1 because the frame at exactly t is included
+  m_backward_end = start + int64_t( std::floor( t * tb.den / tb.num ) ) + 1 ;
+}
+
+// Called by run() instead of onReceiveVideoFrame() during fetch_backward().
+VideoReaderBase::run_proceed_t
+VideoReaderBase::collect_backward(AVFrame *frame)
+{
+  if (frame->pts == AV_NOPTS_VALUE)
+    return RUN_CONTINUE ;
+  // The decoder provides the frames in pts order.
+  if (frame->pts >= m_backward_end)
+    return RUN_INTERRUPT ;
+  m_backward_frames.push_back( av_frame_clone(frame) ) ;
+  if ( m_backward_frames.size() > m_backward_max ) {
+    av_frame_free( &m_backward_frames.front() ) ;
+    m_backward_frames.pop_front() ;
+  }
+  return RUN_CONTINUE ;
+}
+
+// Decode the frames before m_backward_end starting from the previous
+// keyframe.
+//
+// Return false if there is no such frame.
+bool
+VideoReaderBase::fetch_backward()
+{
+  AVRational tb = videoTimeBase() ;
+  int64_t start = (m_video_stream->start_time != AV_NOPTS_VALUE) ? m_video_stream->start_time : 0 ;
+  int64_t target = m_backward_end - 1 ;
+  int64_t step   = std::max<int64_t>(1, tb.den / std::max(1,tb.num)) ;  // about 1s 
+
+  while (true) {
+    if ( !seek_video_pts(target) )
+      return false ;
+    m_collecting = true ;
+    run_proceed_t status = run() ;
+    m_collecting = false ;
+    if ( !m_backward_frames.empty() )
+      return true ;
+    if ( status == RUN_FAIL || target <= start )
+      return false ;
+    // The seek did not go far enough (e.g. an imprecise index or the
+    // last frames are after the end of the stream). Try again before.
+    target = std::max(start, target - step) ;
+    step *= 2 ;
+  }
+}
+
+AVFrame *
+VideoReaderBase::previousFrame()
+{
+  if ( m_backward_end == AV_NOPTS_VALUE )
+    return NULL ;
+  if ( m_backward_frames.empty() && !fetch_backward() ) {
+    stopBackward() ;
+    return NULL ;
+  }
+  if (m_backward_frame)
+    av_frame_free(&m_backward_frame) ;
+  m_backward_frame = m_backward_frames.back() ;
+  m_backward_frames.pop_back() ;
+  m_backward_end = m_backward_frame->pts ;
+  return m_backward_frame ;
+}
+
 FFMpegFrameConverter
 VideoReaderBase::frameConverter(AVPixelFormat dstFormat,
                              int flags,
@@ -211,20 +367,33 @@ VideoReaderBase::convertFrame1(SwsContext *swsCtx,
                             void * dst,
                             int    dstStride
                             )
+{
+  uint8_t *dstData[1] = { (uint8_t*) dst } ;
+  return convertFrame(swsCtx, srcFrame, dstData, &dstStride) ; 
+}
+
+bool
+VideoReaderBase::convertFrame(SwsContext *swsCtx,
+                              AVFrame *srcFrame,
+                              uint8_t *const dst[],
+                              const int dstStride[]
+                              )
 {
   // It is unfortunate that SwsContext is an opaque structure.
   // No way to check that everything is correct.
-  // TODO: create a wrapper around SwsContext? Could make sense.
+  // Use FFMpegFrameConverter for a safer alternative.
   
   int n = sws_scale( swsCtx,
                      srcFrame->data,
                      srcFrame->linesize,
                      0,             // No clipping at top
                      srcFrame->height, // No clipping at bottom
-                     (uint8_t**) &dst,
-                     &dstStride
+                     dst,
+                     dstStride
                      ) ;
-  return (n == srcFrame->height) ;
+  // sws_scale() returns the height of the output slice which
+  // differs from the source height when scaling.
+  return (n > 0) ;
 }
 
 void
@@ -268,6 +437,8 @@ VideoReaderBase::init_video(int index, AVStream *stream, AVCodecParameters *para
   
   m_width  = m_video_codec_context->width ;
   m_height = m_video_codec_context->height ;
+
+  setKeyframesOnly(m_keyframes_only) ;
   
   m_decoded_frame = av_frame_alloc();
   if (!m_decoded_frame) {
@@ -415,7 +586,8 @@ VideoReaderBase::open()
       AVStream * stream = m_format_ctxt->streams[index] ;
       AVCodecParameters *params = stream->codecpar;
       
-      dump_stream_info(std::cout, index) ;
+      if (m_verbosity>0)
+        dump_stream_info(std::cout, index) ;
       
       switch (params->codec_type) {
       case AVMEDIA_TYPE_VIDEO:
@@ -532,6 +704,7 @@ VideoReaderBase::run()
                proceed = onReadVideoPacket(m_packet, ignore) ;
                if (ignore) {
                  // We are not decoding so go read the next packet 
+                 av_packet_unref(m_packet);
                  m_run_state = PSTATE_READ_PACKET;
                } else {                 
                  m_run_state = PSTATE_SEND_VIDEO_PACKET;
@@ -539,6 +712,7 @@ VideoReaderBase::run()
              } else {
                // Not a video packet.
                // Ignore and continue reading packets.
+               av_packet_unref(m_packet);
              }
            } else {
              // Failure.  
@@ -558,6 +732,8 @@ VideoReaderBase::run()
              // Success
              m_run_state = PSTATE_RECEIVE_FRAME;
              proceed = this->onSendVideoPacket(m_packet) ;
+             // The decoder has its own reference
+             av_packet_unref(m_packet);
            } else {
              // Failure
              this->onFailSendVideoPacket(m_packet,err);
@@ -588,7 +764,10 @@ VideoReaderBase::run()
              // The default behavior is to try again because
              // frames can arrive in chunks. 
              m_run_state = PSTATE_RECEIVE_FRAME ;
-             proceed = this->onReceiveVideoFrame(m_decoded_frame) ;
+             if (m_collecting)
+               proceed = this->collect_backward(m_decoded_frame) ;
+             else
+               proceed = this->onReceiveVideoFrame(m_decoded_frame) ;
              av_frame_unref(m_decoded_frame);
            } else if (err==AVERROR_EOF) {
              // The decoder has been fully flushed, and there
@@ -1,6 +1,8 @@
 #ifndef VEX_VIDEO_READER_H
 #define VEX_VIDEO_READER_H 1
 
+#include <deque>
+
 #include "FFMpegCommon.h"
 
 
@@ -58,6 +60,16 @@ protected:
   
   run_state_t m_run_state{PSTATE_READ_PACKET} ;
 
+  // ============= Fast and reverse playback ================
+
+  bool                m_keyframes_only{false};
+  
+  std::deque<AVFrame*> m_backward_frames ;              // The next frames of previousFrame() in pts order
+  int64_t             m_backward_end{AV_NOPTS_VALUE};    // The exclusive pts limit of the next frames
+  size_t              m_backward_max{64};                // The maximum size of m_backward_frames
+  AVFrame *           m_backward_frame{NULL};            // The last frame provided by previousFrame()
+  bool                m_collecting{false};               // run() is collecting frames for previousFrame()
+
   // The value type of most onXXX callbacks. Indicates
   // how to proceed in the current run.   
   enum run_proceed_t {
@@ -81,6 +93,10 @@ private:
 
   void dump_stream_info(std::ostream &out, int index) ;
 
+  bool seek_video_pts(int64_t pts) ;
+  bool fetch_backward() ;
+  run_proceed_t collect_backward(AVFrame *frame) ;
+
 protected: 
   
   // Virtual members of the form onXXX() are expected to 
@@ -96,6 +112,8 @@ protected:
   // - [out] ignore if assigned to false, then the
   //         packet will not be decoded.  
   //
+  // Reminder: The packet is unreferenced after its processing.
+  //
   //
   // Result: if true then continue running else interrupt.
   //
@@ -296,6 +314,29 @@ public:
                      int          dstStride
                      );
 
+  // Similar to convertFrame1() but for any destination pixel format
+  // including the planar ones (e.g. AV_PIX_FMT_YUV420P).
+  //
+  //  - dst and dstStride are per-plane arrays as in sws_scale().
+  //
+  // Example: Convert a frame to AV_PIX_FMT_YUV444P 
+  //
+  //       AVFrame *yuv = av_frame_alloc() ; 
+  //       yuv->width  = this->frameWidth() ;
+  //       yuv->height = this->frameHeight() ;
+  //       yuv->format = AV_PIX_FMT_YUV444P ;
+  //       av_frame_get_buffer(yuv, 0) ;
+  //       bool ok = this->convertFrame(sws_yuv444, frame, yuv->data, yuv->linesize);
+  //
+  // See also FFMpegFrameConverter::convertBatch() to convert
+  // multiple frames in a single call.
+  // 
+  bool convertFrame(SwsContext *    swsCtx,
+                    AVFrame *       srcFrame,
+                    uint8_t *const  dst[],
+                    const int       dstStride[]
+                    );
+
   
   // The width of the video frames. 
   int frameWidth();
@@ -308,8 +349,71 @@ public:
 
   void seek_before(double timestamp) ;
 
+  // Only decode the keyframes (e.g. for a fast forward playback).
+  //
+  // That is done via the skip_frame option of the decoder so the other
+  // packets are still read but they are discarded by the decoder. 
+  //
+  // Remark: Disabling that mode shall be followed by a seek because the
+  //         next frames may refer to the frames that were skipped.
+  void setKeyframesOnly(bool enable) ;
+
+  bool keyframesOnly() const { return m_keyframes_only ; }
+
+  // Start a backward decoding from the time t (in seconds relative to
+  // the start of the video stream). 
+  //
+  // previousFrame() then provides the frames in reverse order starting
+  // with the last one at or before t. They are decoded GOP by GOP: the
+  // reader seeks to the keyframe before the last provided frame, decodes
+  // up to that frame and buffers the result.
+  //
+  // Since a GOP can be very long, at most size frames are buffered (the
+  // most recent ones). The remaining frames of the GOP are then decoded
+  // again later so the memory stays bounded at the cost of some extra
+  // decoding.
+  //
+  // This is compatible with setKeyframesOnly() for a fast backward
+  // playback.
+  //
+  // Example:
+  //
+  //    reader.startBackward(12.5) ;
+  //    while ( AVFrame *frame = reader.previousFrame() ) {
+  //       ...
+  //    }
+  //
+  void startBackward(double t) ;
+
+  // The previous frame of a backward decoding or NULL if the start of
+  // the video was reached (or in case of error).
+  //
+  // The frame is owned by the reader and is valid until the next call.
+  AVFrame * previousFrame() ;
+
+  // Stop a backward decoding and release its frames.
+  void stopBackward() ;
+
+  // The maximum number of frames buffered by a backward decoding.
+  void setBackwardBufferSize(size_t size) { m_backward_max = std::max(size_t(1), size) ; }
+
+  // The time base of the video stream.
+  AVRational videoTimeBase() { return m_video_stream->time_base ; }
+
+  // The frame rate of the video stream (the average frame rate if known
+  // or else the guessed base frame rate). 
+  AVRational frameRate() ;
+
   // Open and prepare the file. 
   virtual bool open() ;
+
+  // Tell if open() was called (and close() was not).
+  bool isOpen() const { return m_format_ctxt != NULL ; }
+
+  // Release the decoders and close the file.
+  //
+  // The reader can then be opened again.
+  virtual void close() ;
   
   //
   // Run the reader until it is interrupted by an error or by one of
@@ -11,76 +11,115 @@ std::string VideoWriter::default_video_encoder = VEX_DATA_DIR "/video-encoder";
 // Escape an argument for 'sh'
 // This is not perfect.
 // TODO: Get rid of intermediate sh in popen() using pipe/fork/dup2/execl
-static std::string
-escape(const std::string &str)
+//
+// Return false if the argument cannot be escaped.
+static bool
+escape(const std::string &str, std::string &out)
 {
   if ( str.find('`') != std::string::npos )  {
     std::cerr << "Cannot espace '`' character in ffmpeg command\n";
-    std::exit(1);
+    return false;
   } else if ( str.find('$') != std::string::npos )  {
     std::cerr << "Cannot espace '$' character in ffmpeg command\n";
-    std::exit(1);
+    return false;
   } else if ( str.find_first_of(" '\"\\") != std::string::npos )  {
     std::stringstream ss;
     ss << std::quoted(str,'\"','\\') ;
-    return ss.str() ;
+    out = ss.str() ;
   } else {
-    return str;
+    out = str;
   }
+  return true;
 }
 
-void VideoWriter::open(std::string preset, int w, int h, AVPixelFormat fmt, AVRational framerate, std::string filename)                                   
+// Report an error. Always return false.
+bool
+VideoWriter::fail(const char *msg)
+{
+  std::cerr << "ERROR: " << msg << "\n" ;
+  if (exit_on_error)
+    std::exit(1);
+  return false;
+}
+
+bool VideoWriter::open(std::string preset, int w, int h, AVPixelFormat fmt, AVRational framerate, std::string filename)                                   
 {    
   assert(pipe==NULL);
 
   width  = w; 
   height = h;
   pixfmt = fmt;
+  premultiplied = false;
   
   // For now, we do not need to support multiple planes 
   assert(av_pix_fmt_count_planes(pixfmt)==1);  
   
+  std::string preset_arg, filename_arg ;
+  if ( !escape(preset, preset_arg) || !escape(filename, filename_arg) )
+    return fail("Invalid ffmpeg command argument") ;
+
   std::stringstream cmd ;
   
   cmd << this->video_encoder ;
-  cmd << " " << escape(preset) ;
+  cmd << " " << preset_arg ;
   cmd << " " << width << "x" << height ;
   cmd << " " << av_get_pix_fmt_name(pixfmt) ;
   cmd << " " << framerate;
-  cmd << " " << escape(filename);
+  cmd << " " << filename_arg;
   
   std::string fullcmd = cmd.str() ;
   
-  std::cout << "CMD: " << fullcmd << "\n";
+  if (verbose)
+    std::cout << "CMD: " << fullcmd << "\n";
   pipe = popen(fullcmd.c_str() , "w") ;
     
-  if (!pipe) {
-    std::cerr << "ERROR: Failed to execute command\n" ;
+  if (!pipe)
+    return fail("Failed to execute command") ;
+
+  return true;
+}
+
+void
+VideoWriter::set_premultiplied(bool enable)
+{
+  assert(pipe!=NULL);
+  if (enable && !pix_fmt_has_trailing_alpha8(pixfmt)) {
+    std::cerr << "ERROR: Premultiplied alpha is not supported for pixel format "
+              << av_get_pix_fmt_name(pixfmt) << "\n" ;
     std::exit(1);
-  }    
-  
+  }
+  premultiplied = enable;
+  row.resize(enable ? width : 0);
 }
     
-void
+bool
 VideoWriter::add_frame(uint8_t *data, int stride)
 {
   size_t n = av_image_get_linesize(pixfmt, width, 0); 
   for (int y=0;y<height;y++) {
-    size_t res = fwrite(data, n, 1, pipe) ;
-    if (res != 1) {
-      std::cerr << "ERROR: Failed to write frame to encoder process\n";
-      std::exit(1);
+    const void *out = data;
+    if (premultiplied) {
+      pixops::unpremultiply_row((const uint32_t*)data, row.data(), width);
+      out = row.data();
     }
+    size_t res = fwrite(out, n, 1, pipe) ;
+    if (res != 1)
+      return fail("Failed to write frame to encoder process") ;
     data += stride ;
   }
+  return true;
 }
 
-void
+bool
 VideoWriter::close() {
   assert(pipe!=NULL);
   int n = pclose(pipe);
-  std::cerr << "ffmpeg command terminate with " << n << "\n";
+  if (verbose)
+    std::cerr << "ffmpeg command terminate with " << n << "\n";
   pipe = NULL;
+  if (n != 0)
+    return fail("The encoder process failed") ;
+  return true;
 }
 
 
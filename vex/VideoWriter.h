@@ -1,6 +1,8 @@
 #ifndef VEX_VIDEO_WRITER_H
 #define VEX_VIDEO_WRITER_H
 
+#include <vector>
+
 #include "FFMpegCommon.h"
 
 // This is a very simple class to write video files
@@ -16,14 +18,34 @@ public:
   AVPixelFormat pixfmt=AV_PIX_FMT_NONE;  
   FILE *pipe=NULL;
   std::string video_encoder{VideoWriter::default_video_encoder} ; 
+  bool premultiplied=false;
+  // When set (the default), the errors are fatal. Otherwise, they are
+  // reported by the result of open(), add_frame() and close() (e.g.
+  // for a writer running in a background thread).
+  bool exit_on_error=true;
+  // Print the encoder command and its exit status.
+  bool verbose=true;
+private:
+  std::vector<uint32_t> row ; // used to unpremultiply the rows
 public:
   static void set_default_video_encoder(std::string program) ;
 private:
   static std::string default_video_encoder ;
+  bool fail(const char *msg) ;
 public:
-  void open(std::string preset, int w, int h, AVPixelFormat pixfmt, AVRational framerate, std::string filename) ;     
-  void add_frame(uint8_t *data, int stride) ;
-  void close() ;  
+  // Start the encoder. Return false on error.
+  bool open(std::string preset, int w, int h, AVPixelFormat pixfmt, AVRational framerate, std::string filename) ;     
+  // Indicate that the frames given to add_frame() have a premultiplied
+  // alpha channel (e.g. Blend2D images in BL_FORMAT_PRGB32). They are then
+  // converted to straight alpha as expected by the encoder. 
+  //
+  // Must be called after open(). The pixel format must be accepted by
+  // pix_fmt_has_trailing_alpha8() (e.g. AV_PIX_FMT_BGRA).
+  void set_premultiplied(bool enable) ;
+  // Send a frame to the encoder. Return false on error.
+  bool add_frame(uint8_t *data, int stride) ;
+  // Wait for the termination of the encoder. Return false if it failed.
+  bool close() ;  
 };
 
 #endif
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <chrono>
+#include <cmath>
 #include <SDL2/SDL.h>
 #include <blend2d.h>
 
@@ -189,6 +190,92 @@ public:
   
 } ; 
 
+//
+// Adapt the render scale of an interactive preview to a frame time
+// budget.
+//
+// The render time of each frame rendered at scale() is given to
+// measure(). The scale is lowered at once when a frame exceeds the
+// budget, assuming that the render time is proportional to the area,
+// and raised by small steps when the recent frames are comfortably
+// within the budget. idle() restores the full scale (e.g. when the
+// playback is paused so the still frame is rendered at full quality).
+//
+// The scales are multiples of 1/8 so the render size does not change
+// for each frame.
+//
+// Example:
+//
+//    AdaptiveScaler scaler(1000.0/60) ;
+//    ...
+//    double s = scaler.scale() ;
+//    Timer::time_point t0 = Timer::now() ;
+//    render(w*s, h*s, s) ;   // using ctx.scale(s) and ctx.userToMeta()
+//    scaler.measure( elapsed_ms(Timer::now()-t0) ) ;
+//
+class AdaptiveScaler {
+private:
+  double m_budget_ms ;
+  double m_min_scale ;
+  double m_scale{1.0} ;
+  double m_avg_ms{0} ;    // Smoothed render time at the current scale
+  int    m_calm{0} ;      // Number of consecutive frames within the budget
+
+  static constexpr double STEP_UP   = 1.25 ;
+  static constexpr int    CALM_MIN  = 15 ;
+  static constexpr double HEADROOM  = 0.8 ;
+
+  double quantize(double s) {
+    return clamp( m_min_scale, std::floor(s*8)/8, 1.0 ) ;
+  }
+
+public:
+  AdaptiveScaler(double budget_ms, double min_scale=0.25) :
+    m_budget_ms(budget_ms),
+    m_min_scale(min_scale)
+  {
+  }
+
+  double scale() const { return m_scale ; }
+  
+  double budget() const { return m_budget_ms ; }
+  
+  // Report the render time of a frame rendered at scale(). 
+  void measure(double ms)
+  {
+    if (ms > m_budget_ms) {
+      double s = quantize( m_scale * std::sqrt( HEADROOM * m_budget_ms / ms ) ) ;
+      if (s < m_scale) {
+        m_scale  = s ;
+        m_avg_ms = 0 ;
+      }
+      m_calm = 0 ;
+      return ;
+    }
+    m_avg_ms = (m_avg_ms==0) ? ms : 0.8*m_avg_ms + 0.2*ms ;
+    if (m_scale >= 1.0)
+      return ;
+    // Only raise the scale if the predicted render time is still within
+    // the budget.
+    double next  = std::min( 1.0, std::max( m_scale + 1.0/8, std::floor(m_scale*STEP_UP*8)/8 ) ) ;
+    double ratio = next / m_scale ;
+    if ( ++m_calm >= CALM_MIN &&
+         m_avg_ms * ratio * ratio < HEADROOM * m_budget_ms ) {
+      m_scale  = next ;
+      m_avg_ms = 0 ;
+      m_calm   = 0 ;
+    }
+  }
+
+  // Go back to the full scale.
+  void idle()
+  {
+    m_scale  = 1.0 ;
+    m_avg_ms = 0 ;
+    m_calm   = 0 ;
+  }
+} ;
+
 class AutoTimer {
 private:
   Timer::time_point t0;
@@ -270,6 +357,162 @@ createSDLSurface(BLImage &img)
   return surf ;
 }
 
+//
+// Present images in an SDL window via a persistent streaming texture.
+//
+// createSDLSurface() followed by SDL_BlitSurface() performs a surface
+// allocation and a software copy for each frame. Instead, the renderer
+// can draw directly in the texture memory: lock() provides a BLImage
+// wrapping the locked texture and unlock() gives it back to SDL. The
+// texture is then drawn, centered, by present().
+//
+// Frames rendered elsewhere (e.g. by a PlaybackEngine) can be given
+// with upload() which only copies the pixels to the texture.
+//
+// The images can be smaller than the texture (e.g. when rendered at a
+// lower scale by an AdaptiveScaler). They are drawn in the top-left
+// corner of the texture and stretched to the texture size by present().
+//
+// Remark: SDL_GetWindowSurface() shall not be used on the same window.
+//
+// Example:
+//
+//    SDLPresenter presenter(win, w, h) ;
+//    BLImage img ;
+//    if (presenter.lock(img)) {
+//      draw(img) ;      // the previous content is undefined
+//      presenter.unlock(img) ;
+//    }
+//    presenter.present() ;
+//
+class SDLPresenter {
+private:
+  SDL_Renderer * m_renderer ;
+  SDL_Texture  * m_texture{NULL} ;
+  int            m_w{0} ;
+  int            m_h{0} ;
+  int            m_src_w{0} ;   // The size of the last image
+  int            m_src_h{0} ;
+  
+public:
+  
+  SDLPresenter(SDL_Window *win, int w, int h, bool vsync=false)
+  {
+    m_renderer = SDL_CreateRenderer(win, -1,
+                                    SDL_RENDERER_ACCELERATED |
+                                    (vsync ? SDL_RENDERER_PRESENTVSYNC : 0) ) ;
+    if (!m_renderer) {
+      std::cerr << "ERROR: Failed to create SDL renderer: " << SDL_GetError() << "\n" ;
+      exit(1) ;
+    }
+    // Smooth the stretched images (applies to the textures created after)
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear") ;
+    resize(w,h) ;
+  }
+
+  ~SDLPresenter()
+  {
+    if (m_texture)
+      SDL_DestroyTexture(m_texture) ;
+    SDL_DestroyRenderer(m_renderer) ;
+  }
+  
+  SDLPresenter(const SDLPresenter &) = delete ;
+  SDLPresenter & operator=(const SDLPresenter &) = delete ;
+
+  int width()  const { return m_w ; }
+  int height() const { return m_h ; }
+  
+  // Change the size of the texture (so of the images).
+  void resize(int w, int h)
+  {
+    if (m_texture && w==m_w && h==m_h)
+      return ;
+    if (m_texture)
+      SDL_DestroyTexture(m_texture) ;
+    // ARGB8888 is a packed format so it matches BL_FORMAT_XRGB32 in
+    // the native endianness.
+    m_texture = SDL_CreateTexture(m_renderer,
+                                  SDL_PIXELFORMAT_ARGB8888,
+                                  SDL_TEXTUREACCESS_STREAMING,
+                                  w, h) ;
+    if (!m_texture) {
+      std::cerr << "ERROR: Failed to create SDL texture: " << SDL_GetError() << "\n" ;
+      exit(1) ;
+    }
+    SDL_SetTextureBlendMode(m_texture, SDL_BLENDMODE_NONE) ;
+    m_w = m_src_w = w ;
+    m_h = m_src_h = h ;
+  }
+
+  // Lock the texture and wrap its memory in img (BL_FORMAT_XRGB32).
+  // The image is only valid until unlock().
+  //
+  // The size of the image is w x h (the full texture by default).
+  bool lock(BLImage &img, int w=0, int h=0)
+  {
+    w = (w>0) ? std::min(w,m_w) : m_w ;
+    h = (h>0) ? std::min(h,m_h) : m_h ;
+    SDL_Rect rect = { 0, 0, w, h } ;
+    void *pixels ;
+    int pitch ;
+    if ( SDL_LockTexture(m_texture, &rect, &pixels, &pitch) != 0 )
+      return false ;
+    if ( img.createFromData(w, h, BL_FORMAT_XRGB32, pixels, pitch) != BL_SUCCESS ) {
+      SDL_UnlockTexture(m_texture) ;
+      return false ;
+    }
+    m_src_w = w ;
+    m_src_h = h ;
+    return true ;
+  }
+
+  void unlock(BLImage &img)
+  {
+    img.reset() ;
+    SDL_UnlockTexture(m_texture) ;
+  }
+
+  // Copy the pixels of an image to the texture (resized if the image
+  // is larger).
+  void upload(const BLImage &img)
+  {
+    BLImageData data ;
+    if ( img.getData(&data) != BL_SUCCESS )
+      return ;
+    if ( data.format != BL_FORMAT_XRGB32 && data.format != BL_FORMAT_PRGB32 ) {
+      std::cerr << "ERROR: Unsupported BL image format for SDL presentation " << data.format << "\n" ;
+      abort();
+    }
+    if ( data.size.w > m_w || data.size.h > m_h )
+      resize( std::max(m_w, data.size.w), std::max(m_h, data.size.h) ) ;
+    SDL_Rect rect = { 0, 0, data.size.w, data.size.h } ;
+    SDL_UpdateTexture(m_texture, &rect, data.pixelData, int(data.stride)) ;
+    m_src_w = data.size.w ;
+    m_src_h = data.size.h ;
+  }
+
+  // Draw the last image, stretched to the texture size, centered in the
+  // window (and clipped if the window is too small).
+  void present()
+  {
+    int ww, wh ;
+    SDL_GetRendererOutputSize(m_renderer, &ww, &wh) ;
+    int cw = std::min(m_w,ww) ;  // The visible part at the texture size
+    int ch = std::min(m_h,wh) ;
+    double sx = double(m_src_w) / m_w ;
+    double sy = double(m_src_h) / m_h ;
+    SDL_Rect src  = { int( std::max(0, (m_w-ww)/2) * sx ), int( std::max(0, (m_h-wh)/2) * sy ),
+                      std::max(1, int(cw*sx)), std::max(1, int(ch*sy)) } ;
+    SDL_Rect dest = { std::max(0, (ww-m_w)/2), std::max(0, (wh-m_h)/2),
+                      cw, ch } ;
+    SDL_SetRenderDrawColor(m_renderer, 0, 0, 0, 255) ;
+    SDL_RenderClear(m_renderer) ;
+    SDL_RenderCopy(m_renderer, m_texture, &src, &dest) ;
+    SDL_RenderPresent(m_renderer) ;
+  }
+} ;
+
 // An abstract representation of an image (32 bit RGBA). 
 class Image {
 public: